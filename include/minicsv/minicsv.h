@@ -26,8 +26,11 @@
 // version 1.7.11 : Fixed num_of_delimiters function: do not count delimiter within quotes
 // version 1.8.0  : Add meaningful error message for data conversion during reading
 // version 1.8.1  : Put under the mini namespace
+// version 1.8.2  : Buffered writes from an optional background thread, numbers formatted without streams and fixed precision on ofstream
+// version 1.8.3  : Add parallel_ifstream, parsing a memory-mapped file into typed columns on several threads
 
 //#define USE_BOOST_LEXICAL_CAST
+//#define USE_BOOST_THREAD
 
 #ifndef MiniCSV_H
 	#define MiniCSV_H
@@ -37,11 +40,35 @@
 #include <fstream>
 #include <algorithm>
 #include <stdexcept>
+#include <vector>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <iterator>
 
 #ifdef USE_BOOST_LEXICAL_CAST
 #	include <boost/lexical_cast.hpp>
 #endif
 
+#ifdef USE_BOOST_THREAD
+#	include <boost/thread/condition_variable.hpp>
+#	include <boost/thread/mutex.hpp>
+#	include <boost/thread/thread.hpp>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define MINICSV_USE_MMAP
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
 #define NEWLINE '\n'
 
 namespace mini
@@ -369,12 +396,31 @@ namespace mini
 				, surround_quote_on_str(false)
 				, surround_quote('\"')
 				, quote_escape("&quot;")
+				, buffered(false)
+				, buffer_size(0)
+				, fixed_precision(-1)
+#ifdef USE_BOOST_THREAD
+				, background(false)
+				, stop_writer(false)
+#endif
 			{
 			}
 			ofstream(const char * file)
+				: buffered(false)
+				, buffer_size(0)
+				, fixed_precision(-1)
+#ifdef USE_BOOST_THREAD
+				, background(false)
+				, stop_writer(false)
+#endif
 			{
 				open(file);
 			}
+			~ofstream()
+			{
+				flush_buffer();
+				stop_writer_thread();
+			}
 			void open(const char * file)
 			{
 				init();
@@ -391,16 +437,57 @@ namespace mini
 			}
 			void flush()
 			{
+				flush_buffer();
+				wait_for_writer();
 				ostm.flush();
 			}
 			void close()
 			{
+				flush_buffer();
+				stop_writer_thread();
 				ostm.close();
 			}
 			bool is_open()
 			{
 				return ostm.is_open();
 			}
+			// Buffer the output and write it in blocks of buffer_size_ bytes, from
+			// a background thread if background_ is set and USE_BOOST_THREAD defined
+			void enable_buffered_writes(bool enable, size_t buffer_size_ = 1 << 20, bool background_ = false)
+			{
+				flush_buffer();
+				stop_writer_thread();
+
+				buffered = enable && buffer_size_ > 0;
+				buffer_size = buffered ? buffer_size_ : 0;
+				buffer.clear();
+				buffer.reserve(buffer_size);
+
+#ifdef USE_BOOST_THREAD
+				background = buffered && background_;
+				if (background)
+				{
+					stop_writer = false;
+					writer = boost::thread(&ofstream::run_writer, this);
+				}
+#else
+				(void)background_;
+#endif
+			}
+			bool is_buffered() const
+			{
+				return buffered;
+			}
+			// Digits after the decimal point of float and double values, or -1 for
+			// the default formatting of iostream
+			void set_fixed_precision(int precision)
+			{
+				fixed_precision = precision;
+			}
+			int get_fixed_precision() const
+			{
+				return fixed_precision;
+			}
 			void enable_surround_quote_on_str(bool enable, char quote, const std::string& escape = "&quot;")
 			{
 				surround_quote_on_str = enable;
@@ -428,13 +515,37 @@ namespace mini
 			{
 				return after_newline;
 			}
+			// Writing to it directly bypasses the buffer, which is flushed first
 			std::ofstream& get_ofstream()
 			{
+				flush_buffer();
+				wait_for_writer();
 				return ostm;
 			}
+			void write(const char * str, size_t size)
+			{
+				if (!buffered)
+				{
+					ostm.write(str, size);
+					return;
+				}
+
+				buffer.insert(buffer.end(), str, str + size);
+				if (buffer.size() >= buffer_size)
+					flush_buffer();
+			}
+			void write(const std::string& str)
+			{
+				write(str.data(), str.size());
+			}
+			void write_delimiter()
+			{
+				if (!after_newline)
+					write(delimiter);
+			}
 			void escape_and_output(std::string src)
 			{
-				ostm << ((escape_str.empty()) ? src : replace(src, delimiter, escape_str));
+				write((escape_str.empty()) ? src : replace(src, delimiter, escape_str));
 			}
 			void escape_str_and_output(std::string src)
 			{
@@ -445,14 +556,146 @@ namespace mini
 					{
 						src = replace(src, std::string(1, surround_quote), quote_escape);
 					}
-					ostm << surround_quote << src << surround_quote;
+					write(&surround_quote, 1);
+					write(src);
+					write(&surround_quote, 1);
 				}
 				else
 				{
-					ostm << src;
+					write(src);
+				}
+			}
+			// Numbers are formatted without a stream, to the same text as iostream
+			void output_integer(long val)
+			{
+				unsigned long magnitude = val < 0 ? 0UL - (unsigned long)val : (unsigned long)val;
+				output_integer(magnitude, val < 0);
+			}
+			void output_integer(unsigned long val, bool negative = false)
+			{
+				char buf[32];
+				char * end = buf + sizeof(buf);
+				char * begin = end;
+				do
+				{
+					*--begin = (char)('0' + val % 10);
+					val /= 10;
+				} while (val != 0);
+
+				if (negative)
+					*--begin = '-';
+
+				output_number(begin, end - begin);
+			}
+			void output_floating(double val)
+			{
+				char buf[64];
+				int size = (fixed_precision >= 0)
+					? snprintf(buf, sizeof(buf), "%.*f", fixed_precision, val)
+					: snprintf(buf, sizeof(buf), "%g", val);
+
+				if (size >= 0 && size < (int)sizeof(buf))
+				{
+					output_number(buf, size);
+					return;
 				}
+
+				// Too long for the buffer, e.g. large values in fixed notation
+				std::ostringstream os_temp;
+				if (fixed_precision >= 0)
+					os_temp << std::fixed << std::setprecision(fixed_precision);
+				os_temp << val;
+
+				write_delimiter();
+				escape_and_output(os_temp.str());
+				after_newline = false;
 			}
 		private:
+			void output_number(const char * str, size_t size)
+			{
+				write_delimiter();
+
+				// Only a delimiter such as '.' or '-' needs escaping in a number
+				if (!escape_str.empty() && std::search(str, str + size, delimiter.begin(), delimiter.end()) != str + size)
+					escape_and_output(std::string(str, size));
+				else
+					write(str, size);
+
+				after_newline = false;
+			}
+			// Hand the buffer to the writer thread, or write it
+			void flush_buffer()
+			{
+				if (buffer.empty())
+					return;
+
+#ifdef USE_BOOST_THREAD
+				if (background)
+				{
+					boost::mutex::scoped_lock lock(writer_mutex);
+					while (!pending.empty())
+						writer_cond.wait(lock);
+
+					pending.swap(buffer);
+					writer_cond.notify_all();
+					lock.unlock();
+
+					buffer.reserve(buffer_size);
+					return;
+				}
+#endif
+				ostm.write(&buffer[0], buffer.size());
+				buffer.clear();
+			}
+			void wait_for_writer()
+			{
+#ifdef USE_BOOST_THREAD
+				if (!background)
+					return;
+
+				boost::mutex::scoped_lock lock(writer_mutex);
+				while (!pending.empty())
+					writer_cond.wait(lock);
+#endif
+			}
+			void stop_writer_thread()
+			{
+#ifdef USE_BOOST_THREAD
+				if (!background)
+					return;
+
+				{
+					boost::mutex::scoped_lock lock(writer_mutex);
+					stop_writer = true;
+				}
+				writer_cond.notify_all();
+				writer.join();
+				background = false;
+#endif
+			}
+#ifdef USE_BOOST_THREAD
+			void run_writer()
+			{
+				boost::mutex::scoped_lock lock(writer_mutex);
+
+				while (true)
+				{
+					while (pending.empty() && !stop_writer)
+						writer_cond.wait(lock);
+
+					if (pending.empty())
+						break;
+
+					// The pending buffer is only touched by this thread until cleared
+					lock.unlock();
+					ostm.write(&pending[0], pending.size());
+					lock.lock();
+
+					pending.clear();
+					writer_cond.notify_all();
+				}
+			}
+#endif
 			std::ofstream ostm;
 			bool after_newline;
 			std::string delimiter;
@@ -460,6 +703,503 @@ namespace mini
 			bool surround_quote_on_str;
 			char surround_quote;
 			std::string quote_escape;
+			bool buffered;
+			size_t buffer_size;
+			std::vector<char> buffer;
+			int fixed_precision;
+#ifdef USE_BOOST_THREAD
+			bool background;
+			bool stop_writer;
+			std::vector<char> pending;
+			boost::mutex writer_mutex;
+			boost::condition_variable writer_cond;
+			boost::thread writer;
+#endif
+		};
+
+		// Conversions of a token as operator >> of ifstream does, without a stream
+		// for numbers. false on a conversion error
+		template<typename T>
+		inline bool convert_token(const std::string& str, T& val)
+		{
+#ifdef USE_BOOST_LEXICAL_CAST
+			try
+			{
+				val = boost::lexical_cast<T>(str);
+			}
+			catch (boost::bad_lexical_cast&)
+			{
+				return false;
+			}
+			return true;
+#else
+			std::istringstream is(str);
+			is >> val;
+			return (bool)is;
+#endif
+		}
+		inline bool convert_token(const std::string& str, std::string& val)
+		{
+			val = str;
+			return true;
+		}
+		inline bool convert_token(const std::string& str, long& val)
+		{
+			const char * begin = str.c_str();
+			char * end;
+			errno = 0;
+			val = strtol(begin, &end, 10);
+			return end != begin && errno != ERANGE;
+		}
+		inline bool convert_token(const std::string& str, unsigned long& val)
+		{
+			const char * begin = str.c_str();
+			char * end;
+			errno = 0;
+			val = strtoul(begin, &end, 10);
+			return end != begin && errno != ERANGE;
+		}
+		inline bool convert_token(const std::string& str, int& val)
+		{
+			long l;
+			if (!convert_token(str, l) || l < INT_MIN || l > INT_MAX)
+				return false;
+			val = (int)l;
+			return true;
+		}
+		inline bool convert_token(const std::string& str, unsigned int& val)
+		{
+			unsigned long l;
+			if (!convert_token(str, l) || l > UINT_MAX)
+				return false;
+			val = (unsigned int)l;
+			return true;
+		}
+		inline bool convert_token(const std::string& str, double& val)
+		{
+			const char * begin = str.c_str();
+			char * end;
+			errno = 0;
+			val = strtod(begin, &end);
+			return end != begin && !(errno == ERANGE && (val == HUGE_VAL || val == -HUGE_VAL));
+		}
+		inline bool convert_token(const std::string& str, float& val)
+		{
+			double d;
+			if (!convert_token(str, d) || d > FLT_MAX || d < -FLT_MAX)
+				return false;
+			val = (float)d;
+			return true;
+		}
+
+		// Reads a whole file into typed columns. The file is memory-mapped and
+		// split at line boundaries into chunks that are parsed by several threads
+		// if USE_BOOST_THREAD is defined, then appended to the columns in row order.
+		// Rows are parsed as with ifstream::read_line and operator >>, except for
+		// a trailing '\r' which is dropped, so "\r\n" files have blank lines
+		class parallel_ifstream
+		{
+		public:
+			parallel_ifstream()
+			{
+				init();
+			}
+			parallel_ifstream(const char * file)
+			{
+				init();
+				open(file);
+			}
+			~parallel_ifstream()
+			{
+				close();
+				for (size_t i = 0; i < columns.size(); ++i)
+					delete columns[i];
+			}
+			bool open(const char * file)
+			{
+				close();
+				filename = file;
+
+#ifdef MINICSV_USE_MMAP
+				int fd = ::open(file, O_RDONLY);
+				if (fd < 0)
+					return false;
+
+				struct stat st;
+				if (fstat(fd, &st) == 0)
+				{
+					size = st.st_size;
+					if (size == 0)
+						opened = true;
+					else
+					{
+						void * mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+						if (mapping != MAP_FAILED)
+						{
+							data = (const char *)mapping;
+							mapped = true;
+							opened = true;
+						}
+					}
+				}
+				::close(fd);
+
+				if (opened)
+					return true;
+#endif
+				// Read it all where it can't be mapped
+				std::ifstream istm(file, std::ios_base::in | std::ios_base::binary);
+				if (!istm.is_open())
+					return false;
+
+				contents.assign(std::istreambuf_iterator<char>(istm), std::istreambuf_iterator<char>());
+				data = contents.empty() ? NULL : &contents[0];
+				size = contents.size();
+				opened = true;
+				return true;
+			}
+			void close()
+			{
+#ifdef MINICSV_USE_MMAP
+				if (mapped)
+					munmap((void *)data, size);
+#endif
+				std::vector<char>().swap(contents);
+				data = NULL;
+				size = 0;
+				mapped = false;
+				opened = false;
+			}
+			bool is_open() const
+			{
+				return opened;
+			}
+			void set_delimiter(char delimiter_, std::string const & unescape_str_)
+			{
+				delimiter = delimiter_;
+				unescape_str = unescape_str_;
+			}
+			void enable_trim_quote_on_str(bool enable, char quote, const std::string& unescape = "&quot;")
+			{
+				trim_quote_on_str = enable;
+				trim_quote = quote;
+				quote_unescape = unescape;
+			}
+			void enable_terminate_on_blank_line(bool enable)
+			{
+				terminate_on_blank_line = enable;
+			}
+			// Lines skipped at the start of the file, e.g. 1 for a header
+			void skip_lines(size_t lines)
+			{
+				lines_to_skip = lines;
+			}
+			// 0 for the number of hardware threads
+			void set_num_of_threads(size_t threads)
+			{
+				num_of_threads = threads;
+			}
+			// The next token of each row is converted and appended to column
+			template<typename T>
+			parallel_ifstream& add_column(std::vector<T>& column)
+			{
+				columns.push_back(new typed_column<T>(&column));
+				return *this;
+			}
+			// The next token of each row is ignored
+			parallel_ifstream& skip_column()
+			{
+				columns.push_back(new typed_column<std::string>(NULL));
+				return *this;
+			}
+			// Parses the file into the columns, throwing std::runtime_error with the
+			// line of ifstream::error_line on a conversion error, with the columns
+			// left unchanged. Returns the number of rows read
+			size_t read()
+			{
+				const char * begin = data;
+				const char * end = data + size;
+
+				if (size >= 3 && begin[0] == (char)0xEF && begin[1] == (char)0xBB && begin[2] == (char)0xBF)
+					begin += 3;
+
+				// The skipped lines that aren't blank are counted in the line numbers
+				// of errors, as ifstream counts the header lines read with read_line()
+				size_t skipped_rows = 0;
+				for (size_t i = 0; i < lines_to_skip && begin < end; ++i)
+				{
+					const char * eol = (const char *)memchr(begin, '\n', end - begin);
+					if ((eol ? eol : end) > begin)
+						++skipped_rows;
+					begin = eol ? eol + 1 : end;
+				}
+
+				// Chunks end after a newline, small files are parsed by one thread
+				size_t threads = num_of_threads;
+#ifdef USE_BOOST_THREAD
+				if (threads == 0)
+					threads = boost::thread::hardware_concurrency();
+#else
+				threads = 1;
+#endif
+				threads = std::max<size_t>(1, std::min<size_t>(threads, (end - begin) / MIN_CHUNK_SIZE));
+
+				std::vector<chunk> chunks(threads);
+				const char * from = begin;
+				for (size_t i = 0; i < threads; ++i)
+				{
+					const char * to = end;
+					if (i + 1 < threads)
+					{
+						to = std::max(from, begin + (end - begin) / threads * (i + 1));
+						const char * eol = (const char *)memchr(to, '\n', end - to);
+						to = eol ? eol + 1 : end;
+					}
+
+					chunks[i].begin = from;
+					chunks[i].end = to;
+					for (size_t c = 0; c < columns.size(); ++c)
+						chunks[i].columns.push_back(columns[c]->create());
+					from = to;
+				}
+
+#ifdef USE_BOOST_THREAD
+				boost::thread_group group;
+				for (size_t i = 1; i < threads; ++i)
+					group.add_thread(new boost::thread(&parallel_ifstream::parse_chunk, this, &chunks[i]));
+#else
+				for (size_t i = 1; i < threads; ++i)
+					parse_chunk(&chunks[i]);
+#endif
+				parse_chunk(&chunks[0]);
+#ifdef USE_BOOST_THREAD
+				group.join_all();
+#endif
+
+				// Rows up to the first blank line, if it terminates the file
+				size_t rows = 0;
+				size_t last = 0;
+				std::string error;
+				for (; last < threads; ++last)
+				{
+					const chunk& c = chunks[last];
+					if (c.failed)
+					{
+						error = error_line(skipped_rows + rows + c.error_row, c.error_token, c.error_str);
+						break;
+					}
+
+					rows += c.rows;
+					if (c.terminated)
+						break;
+				}
+
+				if (error.empty())
+				{
+					for (size_t c = 0; c < columns.size(); ++c)
+						columns[c]->reserve(rows);
+
+					for (size_t i = 0; i <= last && i < threads; ++i)
+						for (size_t c = 0; c < columns.size(); ++c)
+							columns[c]->append(*chunks[i].columns[c]);
+				}
+
+				for (size_t i = 0; i < threads; ++i)
+					for (size_t c = 0; c < chunks[i].columns.size(); ++c)
+						delete chunks[i].columns[c];
+
+				if (!error.empty())
+					throw std::runtime_error(error.c_str());
+
+				return rows;
+			}
+			std::string error_line(size_t line_num, size_t token_num, const std::string& token) const
+			{
+				std::ostringstream is;
+				is << "csv::parallel_ifstream Conversion error at line no.:" << line_num << ", filename:" << filename << ", token position:" << token_num << ", token:" << token;
+				return is.str();
+			}
+
+		private:
+			// Chunks smaller than this aren't worth a thread
+			static const size_t MIN_CHUNK_SIZE = 1 << 16;
+
+			class column_base
+			{
+			public:
+				virtual ~column_base() {}
+				// An empty column of the same type, holding the values of a chunk
+				virtual column_base * create() const = 0;
+				virtual bool push_back(const std::string& token) = 0;
+				virtual void reserve(size_t rows) = 0;
+				// Appends the values of a chunk's column to the target
+				virtual void append(const column_base& chunk) = 0;
+			};
+
+			template<typename T>
+			class typed_column : public column_base
+			{
+			public:
+				typed_column(std::vector<T> * target_) : target(target_) {}
+
+				column_base * create() const
+				{
+					return new typed_column<T>(NULL);
+				}
+				bool push_back(const std::string& token)
+				{
+					T val;
+					if (!convert_token(token, val))
+						return false;
+					values.push_back(val);
+					return true;
+				}
+				void reserve(size_t rows)
+				{
+					if (target)
+						target->reserve(target->size() + rows);
+				}
+				void append(const column_base& chunk)
+				{
+					const std::vector<T>& chunk_values = static_cast<const typed_column<T>&>(chunk).values;
+					if (target)
+						target->insert(target->end(), chunk_values.begin(), chunk_values.end());
+				}
+
+			private:
+				std::vector<T> * target;
+				std::vector<T> values;
+			};
+
+			struct chunk
+			{
+				const char * begin;
+				const char * end;
+				std::vector<column_base *> columns;
+				size_t rows;
+				bool terminated;
+				bool failed;
+				size_t error_row;
+				size_t error_token;
+				std::string error_str;
+
+				chunk() : begin(NULL), end(NULL), rows(0), terminated(false), failed(false), error_row(0), error_token(0) {}
+			};
+
+			void init()
+			{
+				data = NULL;
+				size = 0;
+				mapped = false;
+				opened = false;
+				delimiter = ',';
+				unescape_str = "##";
+				trim_quote_on_str = false;
+				trim_quote = '\"';
+				quote_unescape = "&quot;";
+				terminate_on_blank_line = true;
+				lines_to_skip = 0;
+				num_of_threads = 0;
+			}
+			// As ifstream::get_delimited_str and unescape, on the line [line, line_end)
+			void get_delimited_str(const char * line, const char * line_end, size_t & pos, std::string & str) const
+			{
+				str.clear();
+				const size_t length = line_end - line;
+				bool within_quote = false;
+
+				while (pos < length)
+				{
+					char ch = line[pos];
+					if (trim_quote_on_str)
+					{
+						if (within_quote == false && ch == trim_quote && (pos == 0 || line[pos - 1] == delimiter[0]))
+							within_quote = true;
+						else if (within_quote && ch == trim_quote)
+							within_quote = false;
+					}
+
+					++pos;
+
+					if (ch == delimiter[0] && within_quote == false)
+						break;
+
+					str += ch;
+				}
+
+				if (!unescape_str.empty())
+					replace(str, unescape_str, delimiter);
+
+				if (trim_quote_on_str)
+				{
+					str = trim(str, std::string(1, trim_quote));
+					replace(str, quote_unescape, std::string(1, trim_quote));
+				}
+			}
+			void parse_chunk(chunk * c) const
+			{
+				std::string token;
+				const char * line = c->begin;
+
+				while (line < c->end)
+				{
+					const char * eol = (const char *)memchr(line, '\n', c->end - line);
+					if (!eol)
+						eol = c->end;
+
+					const char * line_end = eol;
+					if (line_end > line && line_end[-1] == '\r')
+						--line_end;
+
+					if (line_end == line)
+					{
+						if (terminate_on_blank_line)
+						{
+							c->terminated = true;
+							return;
+						}
+						line = eol + 1;
+						continue;
+					}
+
+					++c->rows;
+					size_t pos = 0;
+					for (size_t k = 0; k < c->columns.size(); ++k)
+					{
+						get_delimited_str(line, line_end, pos, token);
+						if (!c->columns[k]->push_back(token))
+						{
+							c->failed = true;
+							c->error_row = c->rows;
+							c->error_token = k + 1;
+							c->error_str = token;
+							return;
+						}
+					}
+
+					line = eol + 1;
+				}
+			}
+
+			// Not copyable, it owns the mapping and the columns
+			parallel_ifstream(const parallel_ifstream&);
+			parallel_ifstream& operator=(const parallel_ifstream&);
+
+			const char * data;
+			size_t size;
+			bool mapped;
+			bool opened;
+			std::vector<char> contents;
+			std::string filename;
+			std::string delimiter;
+			std::string unescape_str;
+			bool trim_quote_on_str;
+			char trim_quote;
+			std::string quote_unescape;
+			bool terminate_on_blank_line;
+			size_t lines_to_skip;
+			size_t num_of_threads;
+			std::vector<column_base *> columns;
 		};
 
 
@@ -511,7 +1251,7 @@ template<typename T>
 mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, const T& val)
 {
 	if(!ostm.get_after_newline())
-		ostm.get_ofstream() << ostm.get_delimiter();
+		ostm.write(ostm.get_delimiter());
 
 	std::ostringstream os_temp;
 
@@ -528,7 +1268,7 @@ template<typename T>
 mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, const T* val)
 {
 	if (!ostm.get_after_newline())
-		ostm.get_ofstream() << ostm.get_delimiter();
+		ostm.write(ostm.get_delimiter());
 
 	std::ostringstream os_temp;
 
@@ -545,7 +1285,7 @@ template<>
 inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, const std::string& val)
 {
 	if (!ostm.get_after_newline())
-		ostm.get_ofstream() << ostm.get_delimiter();
+		ostm.write(ostm.get_delimiter());
 
 	std::string temp = val;
 	ostm.escape_str_and_output(temp);
@@ -568,7 +1308,7 @@ inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, const char&
 {
 	if(val==NEWLINE)
 	{
-		ostm.get_ofstream() << NEWLINE;
+		ostm.write(&val, 1);
 
 		ostm.set_after_newline(true);
 	}
@@ -593,6 +1333,44 @@ inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, const char*
 	return ostm;
 }
 
+// Numbers are written without the ostringstream of the generic operator
+inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, int val)
+{
+	ostm.output_integer((long)val);
+
+	return ostm;
+}
+inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, unsigned int val)
+{
+	ostm.output_integer((unsigned long)val);
+
+	return ostm;
+}
+inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, long val)
+{
+	ostm.output_integer(val);
+
+	return ostm;
+}
+inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, unsigned long val)
+{
+	ostm.output_integer(val);
+
+	return ostm;
+}
+inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, float val)
+{
+	ostm.output_floating(val);
+
+	return ostm;
+}
+inline mini::csv::ofstream& operator << (mini::csv::ofstream& ostm, double val)
+{
+	ostm.output_floating(val);
+
+	return ostm;
+}
+
 namespace mini
 {
 	namespace csv
@@ -0,0 +1,168 @@
+#ifndef PFUCLT_BELIEF_H
+#define PFUCLT_BELIEF_H
+
+#include <ros/ros.h>
+#include <boost/random.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Start of every belief summary datagram
+#define BELIEF_MAGIC 0x50464253
+
+// Largest UDP payload, summaries are much smaller
+#define BELIEF_MAX_DATAGRAM_BYTES 65507
+
+// Most states in a mixture, received mixtures with more are malformed
+#define BELIEF_MAX_DIMENSIONS 16
+
+// Lloyd iterations when fitting a mixture to weighted particles
+#define BELIEF_FIT_ITERATIONS 5
+
+// Added to the variance of every component, so that a cluster of identical
+// particles is still a proper gaussian
+#define BELIEF_MIN_VARIANCE 1e-4
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The GaussianMixture struct - a compact belief over a few states, such
+ * as a robot's pose or the target's position, fitted to weighted particles
+ */
+struct GaussianMixture
+{
+  typedef boost::random::mt19937 RNGType;
+
+  struct Component
+  {
+    double weight;
+    std::vector<double> mean;
+    std::vector<double> covariance; // row-major, dimensions x dimensions
+
+    // Set by prepare(), for sampling and evaluating the density
+    std::vector<double> cholesky; // lower triangular, row-major
+    std::vector<double> inverse;
+    double logNormalizer;
+
+    Component() : weight(0.0), logNormalizer(0.0) {}
+  };
+
+  uint dimensions;
+
+  // Index of a state that is an angle, wrapped to [-pi,pi], or -1
+  int angular;
+
+  std::vector<Component> components;
+
+  GaussianMixture() : dimensions(0), angular(-1) {}
+
+  /**
+   * @brief fit - fit the mixture to weighted particles with a weighted
+   * k-means, starting from the heaviest particle and then the ones farthest
+   * from the centers already chosen. Each cluster becomes a component with
+   * its share of the weight, and its weighted mean and covariance
+   * @param states - one subparticle set per dimension
+   * @param weights - the particle weights
+   * @param maxComponents - components at most, fewer if the particles don't
+   * have that many distinct values
+   * @param angular - the index of a state that is an angle, or -1
+   * @return false if the weights sum to 0 or there are more than
+   * BELIEF_MAX_DIMENSIONS states, and the mixture is left empty
+   */
+  bool fit(const std::vector<const std::vector<float>*>& states,
+           const std::vector<float>& weights, const uint maxComponents,
+           const int angular);
+
+  /**
+   * @brief prepare - factorize the covariances, after fit() or receiving
+   * @return false if a covariance is not positive definite
+   */
+  bool prepare();
+
+  /**
+   * @brief logDensity - log of the mixture density at x, after prepare()
+   */
+  double logDensity(const double* x) const;
+
+  /**
+   * @brief sample - draw x from the mixture, after prepare()
+   */
+  void sample(RNGType& rng, double* x) const;
+};
+
+/**
+ * @brief The BeliefSummary struct - what a robot shares with its teammates:
+ * its own pose and the target, as it believes them
+ */
+struct BeliefSummary
+{
+  // The sender's robot number [0,N]
+  uint32_t robot;
+
+  // Counts the sender's summaries
+  uint32_t sequence;
+
+  // Stamp of the iteration the belief was taken from
+  ros::Time stamp;
+
+  GaussianMixture pose;
+
+  // No components if the sender doesn't see the target
+  GaussianMixture target;
+
+  BeliefSummary() : robot(0), sequence(0) {}
+};
+
+/**
+ * @brief The BeliefExchange class - sends belief summaries to the teammates
+ * and receives theirs, one UDP datagram each. Summaries may be lost or
+ * arrive out of order, the receiver keeps the latest of each robot
+ * @remark summaries are sent in the host's byte order, so robots must share
+ * the architecture
+ */
+class BeliefExchange
+{
+public:
+  /**
+   * @brief BeliefExchange - constructor, binds the socket summaries are
+   * received on
+   * @param address - host:port to receive on, e.g. 0.0.0.0:9200
+   * @param peers - comma-separated host:port of the teammates, which may
+   * include this robot's own address
+   */
+  BeliefExchange(const std::string& address, const std::string& peers);
+
+  /**
+   * @brief ~BeliefExchange - closes the socket
+   */
+  ~BeliefExchange();
+
+  bool isOpen() const { return socket_ >= 0; }
+
+  uint numPeers() const { return peers_.size(); }
+
+  /**
+   * @brief send - send a summary to every peer
+   * @return the bytes sent, over every peer
+   */
+  size_t send(const BeliefSummary& summary);
+
+  /**
+   * @brief receive - take the next summary received, without waiting.
+   * Malformed datagrams are skipped
+   * @param summary - output, with its mixtures prepared
+   * @return false when no summary is left
+   */
+  bool receive(BeliefSummary& summary);
+
+private:
+  int socket_;
+  int family_;
+  std::vector<std::vector<uint8_t> > peers_; // sockaddr of each peer
+  std::vector<uint8_t> buffer_;
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_BELIEF_H
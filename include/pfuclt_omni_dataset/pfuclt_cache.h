@@ -0,0 +1,196 @@
+#ifndef PFUCLT_CACHE_H
+#define PFUCLT_CACHE_H
+
+#include <ros/ros.h>
+#include <nav_msgs/Odometry.h>
+#include <read_omni_dataset/read_omni_dataset.h>
+#include <read_omni_dataset/BallData.h>
+#include <read_omni_dataset/LRMLandmarksData.h>
+#include <read_omni_dataset/LRMGTData.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define DATASET_CACHE_MAGIC "PFUCLTDC"
+#define DATASET_CACHE_VERSION 1
+
+// Number of values of each pose column - position xyz and orientation xyzw
+#define DATASET_CACHE_POSE_SIZE 7
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The DatasetCache class - a preprocessed dataset, where the odometry,
+ * target, landmark and ground truth messages of every robot are merged in time
+ * order and stored by column, so that it can be memory-mapped and replayed
+ * without decoding bags
+ * @remark events are indexed in time order, and each event points to a row of
+ * the table of its message type. The file is written in the machine's byte
+ * order and is meant to be read on the machine that converted it
+ */
+class DatasetCache
+{
+public:
+  /**
+   * @brief The EventType enum - the message types in the cache
+   */
+  enum EventType
+  {
+    ODOMETRY,
+    TARGET,
+    LANDMARKS,
+    GROUND_TRUTH
+  };
+
+  /**
+   * @brief The Column enum - every column in the file, each contiguous and
+   * aligned to 8 bytes
+   */
+  enum Column
+  {
+    EVENT_TIME,  // int64 ns, time the message was recorded
+    EVENT_STAMP, // int64 ns, header stamp
+    EVENT_SEQ,   // uint32, header sequence number
+    EVENT_TYPE,  // uint8, EventType
+    EVENT_ROBOT, // uint8, robot number starting at 0
+    EVENT_ROW,   // uint32, row in the table of the event type
+    ODOMETRY_POSE,      // double x DATASET_CACHE_POSE_SIZE
+    TARGET_FOUND,       // uint8
+    TARGET_POSITION,    // double x 3
+    TARGET_MISMATCH,    // double
+    LANDMARKS_FOUND,    // uint8 x nLandmarks
+    LANDMARKS_X,        // float x nLandmarks
+    LANDMARKS_Y,        // float x nLandmarks
+    LANDMARKS_AREA_ACTUAL,   // float x nLandmarks
+    LANDMARKS_AREA_EXPECTED, // float x nLandmarks
+    GT_POSES,           // double x DATASET_CACHE_POSE_SIZE x nRobots
+    GT_BALL_FOUND,      // uint8
+    GT_BALL_POSITION,   // double x 3
+    NUM_COLUMNS
+  };
+
+  /**
+   * @brief DatasetCache - constructor of an empty cache, to be filled with the
+   * add methods and written, or to open an existing file
+   * @param nRobots - number of robots, used for the ground truth poses
+   * @param nLandmarks - number of landmarks in each landmark message
+   */
+  DatasetCache(const uint nRobots = 0, const uint nLandmarks = 0);
+
+  /**
+   * @brief ~DatasetCache - unmaps the file if one was opened
+   */
+  ~DatasetCache();
+
+  void addOdometry(const ros::Time& time, const uint robot,
+                   const nav_msgs::Odometry& msg);
+
+  void addTarget(const ros::Time& time, const uint robot,
+                 const read_omni_dataset::BallData& msg);
+
+  void addLandmarks(const ros::Time& time, const uint robot,
+                    const read_omni_dataset::LRMLandmarksData& msg);
+
+  void addGroundTruth(const ros::Time& time,
+                      const read_omni_dataset::LRMGTData& msg);
+
+  /**
+   * @brief write - write the cache to a file, events must have been added in
+   * time order
+   * @return true if the file was written
+   */
+  bool write(const std::string& filename) const;
+
+  /**
+   * @brief open - memory-map a cache file, replacing the current contents
+   * @return false if the file can't be opened or isn't a cache of this version
+   */
+  bool open(const std::string& filename);
+
+  size_t numEvents() const { return nRows_[EVENT_TIME]; }
+  uint numRobots() const { return nRobots_; }
+  uint numLandmarks() const { return nLandmarks_; }
+
+  ros::Time time(const size_t e) const;
+  EventType type(const size_t e) const
+  {
+    return (EventType)get<uint8_t>(EVENT_TYPE)[e];
+  }
+
+  uint robot(const size_t e) const { return get<uint8_t>(EVENT_ROBOT)[e]; }
+
+  /**
+   * @brief odometry - rebuild the message of an odometry event
+   */
+  nav_msgs::Odometry::Ptr odometry(const size_t e) const;
+
+  /**
+   * @brief target - rebuild the message of a target event
+   */
+  read_omni_dataset::BallData::Ptr target(const size_t e) const;
+
+  /**
+   * @brief landmarks - rebuild the message of a landmarks event
+   */
+  read_omni_dataset::LRMLandmarksData::Ptr landmarks(const size_t e) const;
+
+  /**
+   * @brief groundTruth - rebuild the message of a ground truth event
+   */
+  read_omni_dataset::LRMGTData::Ptr groundTruth(const size_t e) const;
+
+private:
+  struct FileHeader
+  {
+    char magic[8];
+    uint32_t version, nRobots, nLandmarks, reserved;
+    uint64_t rows[NUM_COLUMNS];
+    uint64_t offsets[NUM_COLUMNS];
+  };
+
+  uint nRobots_, nLandmarks_;
+  uint64_t nRows_[NUM_COLUMNS];
+
+  // Columns being built, or pointers into the mapped file
+  std::vector<std::vector<char> > building_;
+  const char* columns_[NUM_COLUMNS];
+  void* map_;
+  size_t mapSize_;
+
+  /**
+   * @brief columnWidth - number of values in one row of a column
+   */
+  uint columnWidth(const Column c) const;
+
+  /**
+   * @brief valueSize - size of each value of a column in bytes
+   */
+  static size_t valueSize(const Column c);
+
+  template <typename T> const T* get(const Column c) const
+  {
+    return reinterpret_cast<const T*>(columns_[c]);
+  }
+
+  template <typename T> void append(const Column c, const T value)
+  {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    building_[c].insert(building_[c].end(), bytes, bytes + sizeof(T));
+    columns_[c] = &building_[c][0];
+  }
+
+  void appendEvent(const ros::Time& time, const std_msgs::Header& header,
+                   const EventType type, const uint robot, const Column table);
+
+  void appendPose(const Column c, const geometry_msgs::Pose& pose);
+
+  void readPose(const Column c, const size_t first,
+                geometry_msgs::Pose& pose) const;
+
+  void close();
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_CACHE_H
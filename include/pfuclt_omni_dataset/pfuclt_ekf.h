@@ -0,0 +1,118 @@
+#ifndef PFUCLT_EKF_H
+#define PFUCLT_EKF_H
+
+#include <vector>
+#include <sys/types.h>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/StdVector>
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The TeamEKF class - an extended Kalman filter over the poses of all
+ * robots and the target's position, using the same odometry and observation
+ * models as the particle filter. Each robot and the target keep their own
+ * mean and covariance
+ * @remark used by the hybrid mode of the ParticleFilter, once the particle
+ * sets have converged to a unimodal distribution
+ */
+class TeamEKF
+{
+public:
+  typedef Eigen::Vector3d RobotMean;
+  typedef Eigen::Matrix3d RobotCov;
+
+  /**
+   * @brief TeamEKF - constructor
+   * @param nRobots - number of robots
+   * @param nStatesPerTarget - target state dimension, 2 or 3
+   */
+  TeamEKF(const uint nRobots, const uint nStatesPerTarget);
+
+  /**
+   * @brief initRobot - set the belief of a robot
+   * @param r - the robot number [0,N]
+   * @param mean - {x,y,theta}
+   * @param cov - 3x3 covariance
+   */
+  void initRobot(const uint r, const RobotMean& mean, const RobotCov& cov);
+
+  /**
+   * @brief initTarget - set the belief of the target
+   * @param mean - {x,y} or {x,y,z}
+   * @param cov - covariance with matching dimensions
+   */
+  void initTarget(const Eigen::VectorXd& mean, const Eigen::MatrixXd& cov);
+
+  /**
+   * @brief predictRobot - propagate a robot's belief with the odometry motion
+   * model, linearized around the mean
+   * @param r - the robot number [0,N]
+   * @param deltaRot - first rotation
+   * @param deltaTrans - translation
+   * @param deltaFinalRot - final rotation
+   * @param alpha - the robot's NUM_ALPHAS odometry noise parameters
+   */
+  void predictRobot(const uint r, const double deltaRot,
+                    const double deltaTrans, const double deltaFinalRot,
+                    const std::vector<float>& alpha);
+
+  /**
+   * @brief predictTarget - propagate the target's belief with the random
+   * acceleration model
+   * @param dt - iteration time in seconds
+   * @param accelStddev - standard deviation of the random acceleration
+   */
+  void predictTarget(const double dt, const double accelStddev);
+
+  /**
+   * @brief updateLandmark - correct a robot's belief with the observation of a
+   * landmark in the robot frame
+   * @param r - the robot number [0,N]
+   * @param zx, zy - the observation in the robot frame
+   * @param covXX, covYY - the observation variances
+   * @param lmx, lmy - the landmark in the global frame
+   * @param gate - chi-square threshold on the squared Mahalanobis distance of
+   * the innovation
+   * @return false if the innovation was above the gate, in which case the
+   * belief is not changed
+   */
+  bool updateLandmark(const uint r, const double zx, const double zy,
+                      const double covXX, const double covYY,
+                      const double lmx, const double lmy, const double gate);
+
+  /**
+   * @brief updateTarget - correct the target's belief with an observation
+   * made by robot r, in that robot's frame. The robot's uncertainty is added
+   * to the observation noise
+   * @param r - the robot number [0,N]
+   * @param z - the observation in the robot frame, {x,y} or {x,y,z}
+   * @param covXX, covYY, covZZ - the observation variances
+   * @param gate - chi-square threshold on the squared Mahalanobis distance of
+   * the innovation
+   * @return false if the innovation was above the gate, in which case the
+   * belief is not changed
+   */
+  bool updateTarget(const uint r, const Eigen::VectorXd& z,
+                    const double covXX, const double covYY,
+                    const double covZZ, const double gate);
+
+  /**
+   * @brief robotSpread - sum of the standard deviations of a robot's belief,
+   * comparable to the spread used for the particle filter's confidence
+   */
+  double robotSpread(const uint r) const;
+
+  std::vector<RobotMean, Eigen::aligned_allocator<RobotMean> > robotMean;
+  std::vector<RobotCov, Eigen::aligned_allocator<RobotCov> > robotCov;
+  Eigen::VectorXd targetMean;
+  Eigen::MatrixXd targetCov;
+
+private:
+  const uint nStatesPerTarget_;
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_EKF_H
@@ -0,0 +1,174 @@
+#ifndef PFUCLT_LOGGER_H
+#define PFUCLT_LOGGER_H
+
+#include <ros/ros.h>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/variant.hpp>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Maximum messages waiting to be formatted, newer ones are dropped beyond it
+#define LOGGER_MAX_QUEUE 1000
+
+// Time between checks of the queue and the tallies by the logging thread
+#define LOGGER_POLL_MS 100
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The LogArgs class - the arguments of a log message, kept unformatted
+ * until the logging thread handles the message
+ * @remark use as LogArgs() << a << b
+ */
+class LogArgs
+{
+public:
+  typedef boost::variant<int, double, std::string> Value;
+
+  LogArgs& operator<<(const int v)
+  {
+    values_.push_back(v);
+    return *this;
+  }
+
+  LogArgs& operator<<(const uint v)
+  {
+    values_.push_back((int)v);
+    return *this;
+  }
+
+  LogArgs& operator<<(const double v)
+  {
+    values_.push_back(v);
+    return *this;
+  }
+
+  LogArgs& operator<<(const std::string& v)
+  {
+    values_.push_back(v);
+    return *this;
+  }
+
+  LogArgs& operator<<(const char* v)
+  {
+    values_.push_back(std::string(v));
+    return *this;
+  }
+
+  const std::vector<Value>& values() const { return values_; }
+
+private:
+  std::vector<Value> values_;
+};
+
+/**
+ * @brief The AsyncLogger class - logging out of the filter's thread. Messages
+ * are rate limited per call site and formatted and sent to rosconsole by a
+ * background thread
+ * @remark a call site is identified by its format string, which must be a
+ * string literal, and an optional instance number such as a robot number
+ */
+class AsyncLogger
+{
+public:
+  /**
+   * @brief AsyncLogger - constructor, starts the logging thread
+   * @param period - minimum seconds between two messages of the same site,
+   * and between the summaries of tallied events. 0 disables rate limiting
+   */
+  AsyncLogger(const double period);
+
+  /**
+   * @brief ~AsyncLogger - logs the pending messages and stops the thread
+   */
+  ~AsyncLogger();
+
+  /**
+   * @brief log - queue a message, unless the same site logged another one
+   * less than a period ago. The number of messages suppressed in between is
+   * appended to the next one
+   * @param level - the rosconsole level
+   * @param format - boost::format compatible format string literal
+   * @param args - the arguments to format
+   * @param instance - distinguishes sites sharing the same format
+   */
+  void log(const ros::console::levels::Level level, const char* format,
+           const LogArgs& args = LogArgs(), const int instance = 0);
+
+  /**
+   * @brief tally - count whether an event happened at a site, to be called
+   * once per iteration. Once per period, if it happened, a single message is
+   * logged such as "<format> in 412 of the last 500 iterations"
+   * @param level - the rosconsole level
+   * @param format - boost::format compatible format string literal
+   * @param happened - whether the event happened in this iteration
+   * @param args - the arguments to format, only copied if happened is true
+   * @param instance - distinguishes sites sharing the same format
+   */
+  void tally(const ros::console::levels::Level level, const char* format,
+             const bool happened, const LogArgs& args = LogArgs(),
+             const int instance = 0);
+
+  /**
+   * @brief setPeriod - change the rate limiting period
+   */
+  void setPeriod(const double period);
+
+private:
+  struct Record
+  {
+    ros::console::levels::Level level;
+    const char* format;
+    LogArgs args;
+    std::string suffix;
+
+    Record() : level(ros::console::levels::Info), format("") {}
+  };
+
+  struct Site
+  {
+    ros::WallTime last;
+    uint suppressed, hits, total;
+    Record latest;
+
+    Site() : suppressed(0), hits(0), total(0) {}
+  };
+
+  typedef std::pair<const char*, int> SiteKey;
+
+  double period_;
+  std::map<SiteKey, Site> sites_, tallies_;
+  std::deque<Record> queue_;
+  uint dropped_;
+  ros::WallTime lastSummary_;
+  bool stop_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+  boost::thread thread_;
+
+  /**
+   * @brief run - the logging thread's loop
+   */
+  void run();
+
+  /**
+   * @brief queueSummaries - queue one message for each tallied site where the
+   * event happened since the last summary, and restart counting
+   * @remark the mutex must be held
+   */
+  void queueSummaries();
+
+  /**
+   * @brief emit - format a message and send it to rosconsole
+   */
+  static void emit(const Record& record);
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_LOGGER_H
@@ -0,0 +1,207 @@
+#ifndef PFUCLT_METRICS_H
+#define PFUCLT_METRICS_H
+
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Number of latest observations used for the percentiles of a summary
+#define METRICS_SUMMARY_WINDOW 1000
+
+// Interval between stamps, in expected periods, above which messages are
+// considered missing when sequence numbers are not available
+#define GAP_TRACKER_PERIOD_FACTOR 1.5
+
+// Smoothing factor of the expected period between messages
+#define GAP_TRACKER_PERIOD_ALPHA 0.1
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The MetricsRegistry class - thread-safe store of the counters, gauges
+ * and summaries describing the filter's health and performance, which can be
+ * rendered in the Prometheus text format or as a diagnostic message
+ * @remark each metric is identified by its name and a label string such as
+ * robot="1",stage="fuseRobots", which can be empty
+ */
+class MetricsRegistry
+{
+public:
+  enum Type
+  {
+    COUNTER,
+    GAUGE,
+    SUMMARY
+  };
+
+  /**
+   * @brief MetricsRegistry - constructor
+   * @param window - number of latest observations kept by each summary
+   */
+  MetricsRegistry(const uint window = METRICS_SUMMARY_WINDOW);
+
+  /**
+   * @brief describe - declare a metric, should be done before using it
+   * @param name - the metric name, with the pfuclt_ prefix
+   * @param type - counter, gauge or summary
+   * @param help - description shown by the Prometheus endpoint
+   */
+  void describe(const std::string& name, const Type type,
+                const std::string& help);
+
+  /**
+   * @brief increment - add to a counter
+   */
+  void increment(const std::string& name, const std::string& labels = "",
+                 const double delta = 1.0);
+
+  /**
+   * @brief set - set the value of a gauge
+   */
+  void set(const std::string& name, const std::string& labels,
+           const double value);
+
+  /**
+   * @brief observe - add an observation to a summary
+   */
+  void observe(const std::string& name, const std::string& labels,
+               const double value);
+
+  /**
+   * @brief prometheusText - all the metrics in the Prometheus text exposition
+   * format, with the 0.5, 0.9 and 0.99 quantiles of each summary
+   */
+  std::string prometheusText() const;
+
+  /**
+   * @brief fillDiagnostics - add one key-value pair per metric to a
+   * diagnostic status
+   * @param status - the status to fill
+   */
+  void fillDiagnostics(diagnostic_msgs::DiagnosticStatus& status) const;
+
+  /**
+   * @brief label - format a single label, to be used as the labels argument
+   * @param key - the label key
+   * @param value - the label value
+   * @return key="value"
+   */
+  static std::string label(const std::string& key, const std::string& value);
+
+  /**
+   * @brief label - same as above, for an integer value such as a robot number
+   */
+  static std::string label(const std::string& key, const int value);
+
+private:
+  struct Series
+  {
+    double value, sum;
+    unsigned long count;
+    std::deque<double> window;
+
+    Series() : value(0.0), sum(0.0), count(0) {}
+  };
+
+  struct Family
+  {
+    Type type;
+    std::string help;
+    std::map<std::string, Series> series;
+  };
+
+  uint window_;
+  std::map<std::string, Family> families_;
+  mutable boost::mutex mutex_;
+
+  /**
+   * @brief quantile - the q quantile of the observations in a window
+   */
+  static double quantile(std::vector<double>& sorted, const double q);
+
+  /**
+   * @brief seriesName - name{labels}, or just name if there are no labels
+   */
+  static std::string seriesName(const std::string& name,
+                                const std::string& labels,
+                                const std::string& extraLabel = "");
+};
+
+/**
+ * @brief The MetricsServer class - serves a MetricsRegistry in the Prometheus
+ * text format over HTTP, on the loopback interface, from its own thread
+ */
+class MetricsServer
+{
+public:
+  /**
+   * @brief MetricsServer - constructor, starts serving immediately
+   * @param registry - the registry to serve, must outlive the server
+   * @param port - the TCP port on 127.0.0.1
+   */
+  MetricsServer(const MetricsRegistry& registry, const int port);
+
+  /**
+   * @brief ~MetricsServer - stops the server thread and closes the socket
+   */
+  ~MetricsServer();
+
+  /**
+   * @brief isRunning - check if the server is listening
+   */
+  bool isRunning() const { return socket_ >= 0; }
+
+private:
+  const MetricsRegistry& registry_;
+  int socket_;
+  volatile bool stop_;
+  boost::thread thread_;
+
+  /**
+   * @brief serve - accept connections until stopped
+   */
+  void serve();
+
+  /**
+   * @brief handle - answer a single connection with the current metrics
+   */
+  void handle(const int client);
+};
+
+/**
+ * @brief The MessageGapTracker class - detects messages of a topic which never
+ * reached its callback, either because they were dropped by a full subscriber
+ * queue or lost in transport
+ * @remark uses the header sequence numbers when the publisher fills them, and
+ * otherwise gaps in the header stamps larger than the usual period
+ */
+class MessageGapTracker
+{
+public:
+  MessageGapTracker();
+
+  /**
+   * @brief update - account for a newly received message
+   * @param seq - the message's header sequence number
+   * @param stamp - the message's header stamp
+   * @return the number of messages missing before this one, or -1 if this
+   * message is older than the previous one
+   */
+  int update(const uint32_t seq, const ros::Time& stamp);
+
+private:
+  bool started_;
+  uint32_t lastSeq_;
+  ros::Time lastStamp_;
+  double period_;
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_METRICS_H
@@ -7,6 +7,7 @@
 
 // ROS message definitions
 #include <ros/ros.h>
+#include <std_msgs/Header.h>
 #include <nav_msgs/Odometry.h>
 #include <read_omni_dataset/BallData.h>
 #include <read_omni_dataset/LRMLandmarksData.h>
@@ -22,6 +23,8 @@
 
 // Auxiliary libraries
 #include <pfuclt_omni_dataset/pfuclt_aux.h>
+#include <pfuclt_omni_dataset/pfuclt_cache.h>
+#include <pfuclt_omni_dataset/pfuclt_metrics.h>
 #include <pfuclt_omni_dataset/pfuclt_particles.h>
 #include <pfuclt_omni_dataset/pfuclt_publisher.h>
 
@@ -29,6 +32,9 @@ namespace pfuclt_omni_dataset
 {
 
 #define STATES_PER_ROBOT 3
+
+// Cache events replayed between two spins of the callback queue
+#define REPLAY_SPIN_EVENTS 100
 #define HEURISTICS_THRESH_DEFAULT                                              \
   {                                                                            \
     2.5, 2.5, 2.5, 2.5, FLT_MAX, FLT_MAX, 3.5, 3.5, FLT_MAX, FLT_MAX           \
@@ -65,10 +71,12 @@ public:
   RobotFactory(ros::NodeHandle& nh);
 
   /**
-   * @brief tryInitializeParticles - checks if every robot is started, and if
+   * @brief tryInitializeParticles - with INCREMENTAL_INIT, adds the robot to
+   * the particle filter. Otherwise, checks if every robot is started, and if
    * so, will initiate the particle filter
+   * @param robotNumber - the robot that has just reported
    */
-  void tryInitializeParticles();
+  void tryInitializeParticles(const uint robotNumber);
 
   /**
    * @brief initializeFixedLandmarks - will get a filename from the parameter
@@ -76,6 +84,14 @@ public:
    * landmarks vector
    */
   void initializeFixedLandmarks();
+
+  /**
+   * @brief replayCache - feed every event of a dataset cache to the robots'
+   * callbacks in time order, as fast as the filter processes them. The ROS
+   * time is set to each event's recorded time before its callback
+   * @param cache - an opened dataset cache
+   */
+  void replayCache(const DatasetCache& cache);
 };
 
 /**
@@ -93,12 +109,37 @@ protected:
   ros::Subscriber sOdom_, sBall_, sLandmark_;
   uint robotNumber_;
   Eigen::Isometry2d initPose_; // x y theta;
+  std::vector<MessageGapTracker> gapTrackers_; // one per message type
 
   /**
    * @brief startNow - starts the robot
    */
   void startNow();
 
+  /**
+   * @brief messageLabels - the metric labels of one of this robot's topics
+   * @param type - the message type
+   */
+  std::string messageLabels(const ParticleFilter::Sensor type);
+
+  /**
+   * @brief recordMessage - update the message metrics of this robot, including
+   * the messages dropped since the previous one of the same type, and start
+   * its latency chain
+   * @param type - the message type
+   * @param header - the message's header
+   */
+  void recordMessage(const ParticleFilter::Sensor type,
+                     const std_msgs::Header& header);
+
+  /**
+   * @brief recordCallback - record the time spent in a callback
+   * @param type - the message type
+   * @param start - when the callback started
+   */
+  void recordCallback(const ParticleFilter::Sensor type,
+                      const ros::WallTime& start);
+
 public:
   /**
    * @brief Robot - constructor, creates a new Robot instance
@@ -135,6 +176,12 @@ public:
    * @return
    */
   bool hasStarted() { return started_; }
+
+  /**
+   * @brief getRobotNumber
+   * @return the robot's number in the team, starting at 0
+   */
+  uint getRobotNumber() { return robotNumber_; }
 };
 
 // end of namespace pfuclt_omni_dataset
@@ -3,6 +3,13 @@
 
 #include <ros/ros.h>
 #include <pfuclt_omni_dataset/pfuclt_aux.h>
+#include <pfuclt_omni_dataset/pfuclt_tuner.h>
+#include <pfuclt_omni_dataset/pfuclt_ekf.h>
+#include <pfuclt_omni_dataset/pfuclt_qmc.h>
+#include <pfuclt_omni_dataset/pfuclt_metrics.h>
+#include <pfuclt_omni_dataset/pfuclt_logger.h>
+#include <pfuclt_omni_dataset/pfuclt_shard.h>
+#include <pfuclt_omni_dataset/pfuclt_belief.h>
 
 #include <vector>
 #include <algorithm>
@@ -21,8 +28,9 @@
 
 #define NUM_ALPHAS 4
 
-// ideally later this will be a parameter, when it makes sense to
-#define STATES_PER_TARGET 3
+// target state dimension - 3D {x,y,z} or 2D ground-plane {x,y}
+#define STATES_PER_TARGET_3D 3
+#define STATES_PER_TARGET_2D 2
 
 // offsets
 #define O_X (0)
@@ -31,9 +39,12 @@
 //#define O_TARGET (nRobots_ * nStatesPerRobot_)
 #define O_TX (0)
 #define O_TY (1)
-#define O_TZ (2)
+#define O_TZ (2) // only used if nStatesPerTarget_ is STATES_PER_TARGET_3D
 //#define O_WEIGHT (nSubParticleSets_ - 1)
 
+// target observation model - variance of the z residual in 3D mode
+#define TARGET_OBS_COV_ZZ 0.04
+
 // target motion model and estimator
 #define TARGET_RAND_MEAN 0
 #define TARGET_RAND_STDDEV_LOST 500.0
@@ -42,6 +53,25 @@
 #define TARGET_ITERATION_TIME_DEFAULT 0.0333
 #define TARGET_ITERATION_TIME_MAX (1)
 
+// initialization from landmarks
+#define LANDMARK_INIT_MIN_BASELINE 0.5 // meters between a pair of landmarks
+#define LANDMARK_INIT_MAX_SIGMAS 3.0 // accepted mismatch of a pair's distance
+
+// sensor resetting
+#define RECOVERY_MAX_RATIO 0.5 // maximum fraction of particles re-drawn
+
+// hybrid EKF - variance added to a singular covariance when re-spawning the
+// particles from it
+#define EKF_RESPAWN_MIN_VARIANCE 1e-4
+
+// large-scale target fusion - bands of ranked robot subparticles that are
+// each scored once against the remaining target subparticles
+#define FUSE_TARGET_RANKED_BANDS 16
+
+// target mixture proposal - robot subparticles of each observer the proposal
+// density is averaged over
+#define TARGET_PROPOSAL_DENSITY_SUBPARTICLES 32
+
 // others
 #define MIN_WEIGHTSUM 1e-10
 
@@ -89,10 +119,17 @@ class ParticleFilter
 {
 private:
   boost::mutex mutex_;
-  dynamic_reconfigure::Server<DynamicConfig>
+
+  // Only when running with a node handle
+  boost::shared_ptr<dynamic_reconfigure::Server<DynamicConfig> >
       dynamicServer_;
 
-protected:
+public:
+  /**
+   * @brief The dynamicVariables_s struct - the filter's parameters, read from
+   * the parameter server or given directly, some of which are updated at
+   * runtime by dynamic reconfigure
+   */
   struct dynamicVariables_s
   {
     bool firstCallback;
@@ -101,12 +138,86 @@ protected:
     double targetRandStddev;
     double oldTargetRandSTddev;
     std::vector<std::vector<float> > alpha;
+    bool auxiliaryPF;
+    double targetObsProposalRatio;
+    bool hybrid;
+    double hybridConfThreshold;
+    int hybridConvergedIterations;
+    double hybridInnovationGate;
+    double hybridDivergenceFactor;
+    bool sensorResetting;
+    double recoveryAlphaSlow;
+    double recoveryAlphaFast;
+    bool quasiRandom;
+    bool regularized;
+    bool factorized;
+    bool robotBudgets;
+    double robotBudgetRatio;
+    int robotMinParticles;
+    int metricsPort;
+    double diagnosticsPeriod;
+    double logPeriod;
+    int largeScaleThreshold;
+    double memoryBudgetMB;
+    int publishMaxParticles;
+    bool autotune;
+    int autotuneSamples;
+    int autotuneRetunePeriod;
+    std::string autotuneExportFile;
+    std::string recordFile;
+    bool recordParticles;
+    int recordParticlesPeriod;
+    bool recordParticlesCompressed;
+    int streamKeyframePeriod;
+    double streamPositionStep;
+    double streamAngleStep;
+    int shardCount;
+    int shardIndex;
+    std::string shardAddress;
+    double shardTimeout;
+    int shardExchangeParticles;
+    bool beliefExchange;
+    std::string beliefAddress;
+    std::string beliefPeers;
+    double beliefPeriod;
+    int beliefComponents;
+    double beliefMaxAge;
+    double beliefFusionWeight;
 
+    /**
+     * @brief dynamicVariables_s - read every parameter from the parameter
+     * server, assuming they exist
+     */
     dynamicVariables_s(ros::NodeHandle& nh, const uint nRobots);
 
+    /**
+     * @brief dynamicVariables_s - take every parameter from a configuration,
+     * e.g. DynamicConfig::__getDefault__(), without ROS. Robots without alpha
+     * values in the configuration get the same defaults as when reading from
+     * the parameter server
+     */
+    dynamicVariables_s(const DynamicConfig& config, const uint nRobots);
+
+    /**
+     * @brief shardParticles - this shard's part of a number of particles for
+     * the whole filter, which is all of it when not sharded
+     */
+    int shardParticles(const int particles) const
+    {
+      if (shardCount <= 1)
+        return particles;
+
+      int share = particles / shardCount;
+      if (shardIndex < particles % shardCount)
+        ++share;
+      return std::max(share, 1);
+    }
+
     void fill_alpha(const uint robot, const std::string& str);
+  };
 
-  } dynamicVariables_;
+protected:
+  dynamicVariables_s dynamicVariables_;
 
   /**
    * @brief The state_s struct - defines a structure to hold state information
@@ -115,6 +226,7 @@ protected:
   struct State
   {
     uint nStatesPerRobot;
+    uint nStatesPerTarget;
     uint nRobots;
 
     /**
@@ -139,8 +251,8 @@ protected:
       std::vector<pdata_t> pos;
       bool seen;
 
-      targetState_s()
-          : pos(STATES_PER_TARGET, 0.0), seen(false)
+      targetState_s(uint posSize)
+          : pos(posSize, 0.0), seen(false)
       {
       }
     } target;
@@ -148,8 +260,10 @@ protected:
     /**
      * @brief State - constructor
      */
-    State(const uint nStatesPerRobot, const uint nRobots)
-        : nStatesPerRobot(nStatesPerRobot), nRobots(nRobots)
+    State(const uint nStatesPerRobot, const uint nStatesPerTarget,
+          const uint nRobots)
+        : nStatesPerRobot(nStatesPerRobot), nStatesPerTarget(nStatesPerTarget),
+          nRobots(nRobots), target(nStatesPerTarget)
     {
       // Create and initialize the robots vector
       for (uint r = 0; r < nRobots; ++r)
@@ -157,6 +271,54 @@ protected:
     }
   };
 
+public:
+  /**
+   * @brief The Sensor enum - the types of messages received from each robot
+   */
+  enum Sensor
+  {
+    ODOMETRY,
+    TARGET,
+    LANDMARKS,
+    NUM_SENSORS
+  };
+
+  /**
+   * @brief sensorName - human readable name of a sensor, used in the metrics
+   */
+  static const char* sensorName(const Sensor sensor);
+
+  /**
+   * @brief The ObservationLatency struct - the latency chain of an
+   * observation, from its header stamp until the estimate it was fused in is
+   * published, with each stage in seconds
+   */
+  struct ObservationLatency
+  {
+    uint robot;
+    Sensor sensor;
+    ros::Time stamp;
+    ros::WallTime received;
+    double transport; // header stamp -> callback receipt
+    double queue;     // receipt -> start of the iteration fusing it
+    double compute;   // start of the iteration -> estimate computed
+    double publish;   // estimate computed -> estimate published
+    bool pending;     // received but not yet fused
+
+    ObservationLatency()
+        : robot(0), sensor(ODOMETRY), transport(0.0), queue(0.0),
+          compute(0.0), publish(0.0), pending(false)
+    {
+    }
+
+    double total() const { return transport + queue + compute + publish; }
+  };
+
+protected:
+  std::vector<std::vector<ObservationLatency> > latencies_; // [robot][sensor]
+  std::vector<ObservationLatency> fusedLatencies_; // fused in the last iteration
+  ros::WallTime estimateComputedTime_;
+
 public:
   /**
    * @brief The PFinitData struct - provides encapsulation to the initial data
@@ -164,8 +326,10 @@ public:
    */
   struct PFinitData
   {
-    ros::NodeHandle& nh;
-    const uint mainRobotID, nTargets, statesPerRobot, nRobots, nLandmarks;
+    ros::NodeHandle* nh; // NULL without ROS
+    const dynamicVariables_s* parameters; // NULL to read them with nh
+    const uint mainRobotID, nTargets, statesPerRobot, statesPerTarget, nRobots,
+        nLandmarks;
     const std::vector<bool>& robotsUsed;
     const std::vector<Landmark>& landmarksMap;
 
@@ -177,6 +341,8 @@ public:
      * OMNI1 is ID1
      * @param nTargets - the number of targets to consider
      * @param statesPerRobot - the state space dimension for each robot
+     * @param statesPerTarget - the state space dimension for each target,
+     * STATES_PER_TARGET_3D or STATES_PER_TARGET_2D for targets on the ground
      * @param nRobots - number of robots
      * @param nLandmarks - number of landmarks
      * @param robotsUsed - vector of bools mentioning if robots are being used,
@@ -186,11 +352,32 @@ public:
      * @param vector with values to be used in the RNG for the model sampling
      */
     PFinitData(ros::NodeHandle& nh, const uint mainRobotID, const uint nTargets,
-               const uint statesPerRobot, const uint nRobots,
+               const uint statesPerRobot, const uint statesPerTarget,
+               const uint nRobots, const uint nLandmarks,
+               const std::vector<bool>& robotsUsed,
+               const std::vector<Landmark>& landmarksMap)
+        : nh(&nh), parameters(NULL), mainRobotID(mainRobotID),
+          nTargets(nTargets), statesPerRobot(statesPerRobot),
+          statesPerTarget(statesPerTarget), nRobots(nRobots),
+          nLandmarks(nLandmarks), robotsUsed(robotsUsed),
+          landmarksMap(landmarksMap)
+    {
+    }
+
+    /**
+     * @brief PFinitData - without ROS: no parameter server, dynamic
+     * reconfigure or diagnostics topic, e.g. to drive the filter from Python
+     * @param parameters - the parameters, copied by the filter
+     * @remark the other parameters are the same as with a node handle
+     */
+    PFinitData(const dynamicVariables_s& parameters, const uint mainRobotID,
+               const uint nTargets, const uint statesPerRobot,
+               const uint statesPerTarget, const uint nRobots,
                const uint nLandmarks, const std::vector<bool>& robotsUsed,
                const std::vector<Landmark>& landmarksMap)
-        : nh(nh), mainRobotID(mainRobotID), nTargets(nTargets),
-          statesPerRobot(statesPerRobot), nRobots(nRobots),
+        : nh(NULL), parameters(&parameters), mainRobotID(mainRobotID),
+          nTargets(nTargets), statesPerRobot(statesPerRobot),
+          statesPerTarget(statesPerTarget), nRobots(nRobots),
           nLandmarks(nLandmarks), robotsUsed(robotsUsed),
           landmarksMap(landmarksMap)
     {
@@ -198,20 +385,68 @@ public:
   };
 
 protected:
-  ros::NodeHandle& nh_;
+  ros::NodeHandle* nh_; // NULL without ROS
   uint nParticles_;
   const uint mainRobotID_;
   const uint nTargets_;
   const uint nStatesPerRobot_;
+  const uint nStatesPerTarget_;
   const uint nRobots_;
   const uint nSubParticleSets_;
   const uint nLandmarks_;
   particles_t particles_;
   particles_t weightComponents_;
+  particles_t auxWeights_;
+  particles_t robotBlockWeights_;
+  subparticles_t targetProposalWeights_;
+  std::vector<bool> landmarkInitPending_;
+
+  // Number of distinct subparticles in each robot's block, the particles
+  // beyond it repeat them: particle p uses subparticle p mod robotParticles_[r]
+  std::vector<uint> robotParticles_;
+
+  /**
+   * @brief The LikelihoodAverage struct - short-term and long-term averages of
+   * the observation likelihood, used to decide how many particles to re-draw
+   * from the observations
+   */
+  struct LikelihoodAverage
+  {
+    double slow, fast;
+
+    LikelihoodAverage() : slow(0.0), fast(0.0) {}
+
+    void update(const double w, const double alphaSlow, const double alphaFast)
+    {
+      // Start from the first value instead of 0
+      if (slow == 0.0)
+        slow = fast = w;
+      else
+      {
+        slow += alphaSlow * (w - slow);
+        fast += alphaFast * (w - fast);
+      }
+    }
+
+    /**
+     * @brief ratio - fraction of particles to re-draw, grows as the recent
+     * likelihood drops below the long-term one
+     */
+    double ratio() const
+    {
+      if (slow <= 0.0)
+        return 0.0;
+      return std::min(RECOVERY_MAX_RATIO, std::max(0.0, 1.0 - fast / slow));
+    }
+
+    void reset() { fast = slow; }
+  };
+  std::vector<LikelihoodAverage> robotLikelihood_;
+  LikelihoodAverage targetLikelihood_;
   RNGType seed_;
   bool initialized_;
   const std::vector<Landmark>& landmarksMap_;
-  const std::vector<bool>& robotsUsed_;
+  std::vector<bool> robotsUsed_;
   std::vector<std::vector<LandmarkObservation> > bufLandmarkObservations_;
   std::vector<TargetObservation> bufTargetObservations_;
   TimeEval targetIterationTime_, odometryTime_;
@@ -222,6 +457,21 @@ protected:
   struct State state_;
   ros::Time latestObservationTime_, savedLatestObservationTime_;
   bool converged_;
+  TeamEKF ekf_;
+  bool ekfActive_;
+  uint convergedIterations_;
+  KernelTuner tuner_;
+  MetricsRegistry metrics_;
+  boost::shared_ptr<MetricsServer> metricsServer_;
+  ros::Publisher diagnosticsPublisher_;
+  ros::WallTime lastDiagnostics_;
+  AsyncLogger logger_;
+  boost::shared_ptr<ShardLink> shards_;
+  boost::shared_ptr<BeliefExchange> beliefs_;
+  std::vector<BeliefSummary> teammateBeliefs_; // the latest of each robot
+  std::vector<bool> newBeliefs_; // received since the last iteration
+  ros::Time lastBeliefSent_;
+  uint32_t beliefSequence_;
 
   /**
    * @brief copyParticle - copies a whole particle from one particle set to
@@ -269,10 +519,11 @@ protected:
    * particle in a sphere around center
    * @param particlesRatio - float between 0 and 1, corresponding to the
    * percentage of particles that will be spread
-   * @param center - center of the sphere [x,y,z]
+   * @param center - center of the sphere [x,y,z], or of the circle [x,y] for
+   * a 2D target
    * @param radius - in meters
    */
-  void spreadTargetParticlesSphere(float particlesRatio, pdata_t center[3],
+  void spreadTargetParticlesSphere(float particlesRatio, pdata_t center[],
                                    float radius);
 
   /**
@@ -281,6 +532,69 @@ protected:
    */
   void predictTarget();
 
+  /**
+   * @brief drawTargetFromObservations - mixture proposal for the target,
+   * replaces a fraction of the target subparticles with samples of the current
+   * target observations projected through random robot subparticles into the
+   * global frame
+   * @param ratio - fraction of the target subparticles to replace, [0,1]
+   * @remark every target subparticle, drawn or predicted, is corrected by
+   * p(x) / ((1-a)p(x) + a q(x)), where p is a gaussian approximation of the
+   * prediction, q the proposal density averaged over the observers and their
+   * robot subparticles, and a the ratio. The corrections are kept in
+   * targetProposalWeights_ and applied in fuseTarget()
+   */
+  void drawTargetFromObservations(const double ratio);
+
+  /**
+   * @brief seedRobotFromLandmarks - triangulate pose hypotheses from every
+   * pair of landmarks currently seen by a robot, and sample that robot's
+   * subparticles around them, proportionally to each hypothesis' likelihood
+   * @param r - the robot number [0,N]
+   * @param first - only the subparticles from this index onward are replaced,
+   * and the robot's state is only set when starting at 0
+   * @return false if the robot doesn't see at least 2 consistent landmarks
+   */
+  bool seedRobotFromLandmarks(const uint r, const uint first = 0);
+
+  /**
+   * @brief sensorResetting - replace part of the robot and target
+   * subparticles not kept by the resampler with samples drawn from the current
+   * observations. The fraction is given by comparing the short-term and
+   * long-term likelihood averages
+   * @param lost - if true, the weights collapsed and the maximum fraction is
+   * re-drawn
+   */
+  void sensorResetting(const bool lost);
+
+  /**
+   * @brief landmarkLikelihood - the landmark observation likelihood kernel,
+   * multiplies the likelihood of every landmark seen by robot r into
+   * probabilities
+   * @param r - the robot number [0,N]
+   * @param x, y, theta - the robot's pose subparticles to evaluate
+   * @param probabilities - output, one value per pose to evaluate
+   * @param cfg - the kernel variant to run with
+   * @return the number of landmarks seen by robot r
+   */
+  uint landmarkLikelihood(const uint r, const subparticles_t& x,
+                          const subparticles_t& y, const subparticles_t& theta,
+                          subparticles_t& probabilities,
+                          const KernelConfig& cfg);
+
+  /**
+   * @brief auxiliaryResample - auxiliary particle filter first stage, resamples
+   * robot r's subparticles according to the likelihood of their noiseless
+   * prediction under the latest landmark observations
+   * @param r - the robot number [0,N]
+   * @param deltaRot, deltaTrans, deltaFinalRot - the odometry motion
+   * @remark the first stage weights are multiplied into auxWeights_, over
+   * every prediction of the robot since the last iteration, and divided out of
+   * the likelihoods in fuseRobots()
+   */
+  void auxiliaryResample(const uint r, const pdata_t deltaRot,
+                         const pdata_t deltaTrans, const pdata_t deltaFinalRot);
+
   /**
    * @brief fuseRobots - fuse robot states step
    */
@@ -292,10 +606,138 @@ protected:
   void fuseTarget();
 
   /**
-   * @brief modifiedMultinomialResampler - a costly resampler that keeps 50% of
-   * the particles and implements the multinomial resampler on the rest
+   * @brief targetWeight - the weight contributed by target subparticle p when
+   * paired with the robot subparticles at index m
+   * @return the sum of the likelihoods of every robot's target observation,
+   * times the proposal correction of subparticle p
    */
-  void modifiedMultinomialResampler(uint startAt);
+  pdata_t targetWeight(const uint m, const uint p);
+
+  /**
+   * @brief fuseTargetRanked - large-scale replacement of the greedy search in
+   * fuseTarget(). The ranked robot subparticles are split in
+   * FUSE_TARGET_RANKED_BANDS bands, and each band takes the best remaining
+   * target subparticles, scored against the band's first robot subparticles,
+   * which is O(B N log N) instead of O(N^2)
+   * @remark an approximation of the greedy search, which scores against every
+   * robot subparticle, exact when the robot subparticles of a band agree
+   * @param cfg - the kernel configuration to use
+   * @return the sum of the weights contributed by the target subparticles
+   */
+  double fuseTargetRanked(const KernelConfig& cfg);
+
+  /**
+   * @brief modifiedMultinomialResampler - a costly resampler that keeps the
+   * top particles and implements the multinomial resampler on the rest
+   * @param startAt - fraction of the robot subparticles kept, [0,1]
+   * @param kernel - standard deviation of the gaussian jitter added to each
+   * state of the resampled particles, all zeros to resample without jitter
+   */
+  void modifiedMultinomialResampler(const double startAt,
+                                    const std::vector<double>& kernel);
+
+  /**
+   * @brief updateRobotBudgets - distribute the robot particle budget according
+   * to each robot's spread and the number of landmarks it sees
+   * @param spread - sum of the standard deviations of each robot's states
+   */
+  void updateRobotBudgets(const std::vector<double>& spread);
+
+  /**
+   * @brief replicateRobotBlock - repeat the distinct subparticles of robot r
+   * over the rest of its block
+   * @param r - the robot number [0,N]
+   */
+  void replicateRobotBlock(const uint r);
+
+  /**
+   * @brief factorizedResampler - resamples each robot's subparticle block from
+   * that robot's own weights, in parallel across robots, and the target block
+   * from the full particle weights
+   * @param startAt - same as in modifiedMultinomialResampler
+   * @param kernel - same as in modifiedMultinomialResampler
+   */
+  void factorizedResampler(const double startAt,
+                           const std::vector<double>& kernel);
+
+  /**
+   * @brief bytesPerParticle - memory used for each particle, including the
+   * temporary copies made during an iteration
+   * @param nSubParticleSets - number of subparticle sets, weights included
+   * @param nRobots - number of robots
+   */
+  static size_t bytesPerParticle(const uint nSubParticleSets,
+                                 const uint nRobots);
+
+  /**
+   * @brief particlesWithinBudget - bound a number of particles to a memory
+   * budget
+   * @param requested - the number of particles requested
+   * @param bytesPerParticle - from bytesPerParticle()
+   * @param budgetMB - the budget in MB, 0 for no limit
+   * @return the requested number, or the largest that fits in the budget
+   */
+  static uint particlesWithinBudget(const int requested,
+                                    const size_t bytesPerParticle,
+                                    const double budgetMB);
+
+  /**
+   * @brief initMetrics - describe the metrics, and start the HTTP endpoint and
+   * the diagnostics publisher if enabled
+   */
+  void initMetrics();
+
+  /**
+   * @brief observeStage - record the wall time of an iteration step
+   * @param stage - the step's name
+   * @param start - when the step started
+   * @return the current time, when the next step starts
+   */
+  ros::WallTime observeStage(const char* stage, const ros::WallTime& start);
+
+  /**
+   * @brief updateIterationMetrics - record the metrics of a whole iteration,
+   * and publish them as diagnostics when the period has elapsed
+   */
+  void updateIterationMetrics();
+
+  /**
+   * @brief collectFusedLatencies - at the start of an iteration, take every
+   * observation received since the previous one as fused in this iteration
+   */
+  void collectFusedLatencies();
+
+  /**
+   * @brief stampLatencies - set the time when the estimate with the fused
+   * observations was published
+   * @param published - the publishing time, or when the estimate was computed
+   * if it isn't published
+   */
+  void stampLatencies(const ros::WallTime& published);
+
+  /**
+   * @brief recordLatencyMetrics - add the latency chain of every fused
+   * observation to the metrics, per robot, sensor and stage
+   */
+  void recordLatencyMetrics();
+
+  /**
+   * @brief logMemoryFootprint - print the memory used for the current number
+   * of particles
+   */
+  void logMemoryFootprint();
+
+  /**
+   * @brief kernelBandwidth - scale of the optimal gaussian kernel for a
+   * regularized particle filter, relative to the particles' standard deviation
+   * @param dimensions - the dimension of the state being jittered
+   */
+  double kernelBandwidth(const uint dimensions)
+  {
+    double d = dimensions;
+    return pow(4.0 / (d + 2.0), 1.0 / (d + 4.0)) *
+           pow((double)nParticles_, -1.0 / (d + 4.0));
+  }
 
   /**
    * @brief resample - the resampling step
@@ -307,6 +749,56 @@ protected:
    */
   void estimate();
 
+  /**
+   * @brief exchangeShards - in sharded mode, send this shard's weight sums and
+   * best particles to the other shards, replace its worst particles with the
+   * ones imported from them, and estimate the state from every shard's
+   * weighted means
+   * @param stamp - the main robot's odometry stamp, which identifies the
+   * iteration in every shard
+   * @return true if the state was estimated, otherwise estimate() should be
+   * called after resampling
+   */
+  bool exchangeShards(const ros::Time& stamp);
+
+  /**
+   * @brief exchangeBeliefs - in decentralized mode, fuse the belief summaries
+   * received from the teammates and share this robot's own. A teammate's
+   * subparticles are drawn again from each new summary of its pose. The
+   * particles are weighted by the teammates' target beliefs, tempered by
+   * belief_fusion_weight so that what was shared back and forth isn't counted
+   * as new evidence, or the target is drawn from them if this robot doesn't
+   * see it
+   * @param stamp - the main robot's odometry stamp, which the age of the
+   * summaries is measured against
+   */
+  void exchangeBeliefs(const ros::Time& stamp);
+
+  /**
+   * @brief checkHybridSwitch - in hybrid mode, switch to the EKF once the
+   * particles have converged with enough confidence for a number of iterations
+   */
+  void checkHybridSwitch();
+
+  /**
+   * @brief initEKFFromParticles - set the EKF belief to the mean and
+   * covariance of the particle sets
+   */
+  void initEKFFromParticles();
+
+  /**
+   * @brief iterateEKF - perform one iteration with the EKF instead of the
+   * particles. If an innovation or divergence check fails, particles are
+   * re-spawned from the EKF and the particle filter takes over again
+   */
+  void iterateEKF();
+
+  /**
+   * @brief respawnParticlesFromEKF - sample all robot and target subparticles
+   * from the EKF's gaussian belief, with uniform weights
+   */
+  void respawnParticlesFromEKF();
+
   /**
    * @brief nextIteration - perform final steps before next iteration
    */
@@ -324,6 +816,15 @@ protected:
     for (uint r = 0; r < weightComponents_.size(); ++r)
       weightComponents_[r].resize(n);
 
+    // Pending auxiliary weights no longer match the particles
+    for (uint r = 0; r < auxWeights_.size(); ++r)
+    {
+      auxWeights_[r].assign(n, 1.0);
+      robotBlockWeights_[r].assign(n, 1.0);
+    }
+    robotParticles_.assign(robotParticles_.size(), n);
+    targetProposalWeights_.assign(n, 1.0);
+
     // Resize particles
     for (uint s = 0; s < particles_.size(); ++s)
       particles_[s].resize(n);
@@ -333,6 +834,9 @@ protected:
     // But if n is higher, it's better to resample
     if (n > old_size)
       resample();
+
+    // The fastest kernel variants depend on the number of particles
+    tuner_.reset(n);
   }
 
 public:
@@ -377,6 +881,33 @@ public:
    */
   ParticleFilter* getPFReference() { return this; }
 
+  /**
+   * @brief isDecentralized - whether the teammates are tracked from their
+   * belief summaries, instead of their sensor messages
+   */
+  bool isDecentralized() { return dynamicVariables_.beliefExchange; }
+
+  /**
+   * @brief getMetrics - the registry where the filter's metrics are stored
+   */
+  MetricsRegistry& getMetrics() { return metrics_; }
+
+  /**
+   * @brief getLastIterationStamp - stamp of the latest observation used by the
+   * last iteration
+   */
+  ros::Time getLastIterationStamp() { return savedLatestObservationTime_; }
+
+  /**
+   * @brief recordReceipt - call when a robot's message is received, to start
+   * its latency chain
+   * @param robotNumber - the robot number in the team
+   * @param sensor - the type of message
+   * @param stamp - the message's header stamp
+   */
+  void recordReceipt(const uint robotNumber, const Sensor sensor,
+                     const ros::Time& stamp);
+
   /**
    * @brief printWeights
    */
@@ -433,6 +964,30 @@ public:
   void init(const std::vector<double>& customRandInit,
             const std::vector<double>& customPosInit);
 
+  /**
+   * @brief initRobot - add a single robot to the filter, without waiting for
+   * the rest of the team. The first robot initializes the whole filter with
+   * init(), and only robots added this way are used in its iterations
+   * @param r - the robot number [0,N]
+   * @param customRandInit - same as in init()
+   * @param customPosInit - same as in init()
+   */
+  void initRobot(const uint r, const std::vector<double>& customRandInit,
+                 const std::vector<double>& customPosInit);
+
+  /**
+   * @brief initFromLandmarks - call after init() so that each robot's
+   * subparticles are re-seeded by triangulation the first time it sees at
+   * least two landmarks, instead of staying spread in the initial boxes
+   */
+  void initFromLandmarks();
+
+  /**
+   * @brief initFromLandmarks - same as above, for a single robot
+   * @param r - the robot number [0,N]
+   */
+  void initFromLandmarks(const uint r);
+
   /**
    * @brief predict - prediction step in the particle filter set with the
    * received odometry
@@ -451,6 +1006,20 @@ public:
    */
   bool isInitialized() { return initialized_; }
 
+  /**
+   * @brief isInitialized - check if a robot is taking part in the filter
+   * @param r - the robot number [0,N]
+   * @return true if the filter is initialized and robot r is used
+   */
+  bool isInitialized(const uint r) { return initialized_ && robotsUsed_[r]; }
+
+  /**
+   * @brief isEKFActive - in hybrid mode, check if the EKF is being used
+   * instead of the particles
+   * @return true if the particles are not being updated
+   */
+  bool isEKFActive() { return ekfActive_; }
+
   /**
    * @brief size - interface to the size of the particle filter
    * @return - the number of subparticle sets
@@ -514,12 +1083,13 @@ public:
 
       // Observation to global frame
       const ParticleFilter::State::RobotState& rs = state_.robots[robotNumber];
-      pdata_t ballGlobal[3];
+      pdata_t ballGlobal[STATES_PER_TARGET_3D];
       ballGlobal[O_TX] = rs.pose[O_X] + obs.x * cos(rs.pose[O_THETA]) -
                          obs.y * sin(rs.pose[O_THETA]);
       ballGlobal[O_TY] = rs.pose[O_Y] + obs.x * sin(rs.pose[O_THETA]) +
                          obs.y * cos(rs.pose[O_THETA]);
-      ballGlobal[O_TZ] = obs.z;
+      if (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+        ballGlobal[O_TZ] = obs.z;
 
       // Spread 50% of particles around ballGlobal in a sphere with 1.0 meter
       // radius
@@ -5,6 +5,9 @@
 #include <read_omni_dataset/RobotState.h>
 #include <read_omni_dataset/LRMGTData.h>
 #include <read_omni_dataset/Estimate.h>
+#include <pfuclt_omni_dataset/latencies.h>
+#include <pfuclt_omni_dataset/pfuclt_recorder.h>
+#include <pfuclt_omni_dataset/pfuclt_stream.h>
 
 #include <vector>
 #include <ros/ros.h>
@@ -49,10 +52,16 @@ public:
       ROS_INFO("Resizing particle message");
 
       // Resize particle message
-      msg_particles_.particles.resize(n);
-      for (uint p = 0; p < n; ++p) {
-        msg_particles_.particles[p].particle.resize(nSubParticleSets_);
-      }
+      resizeParticleMessage((n + publishStride() - 1) / publishStride());
+    }
+
+    /**
+     * @brief publishStride - particles are published one every publishStride,
+     * so that at most publish_max_particles are published
+     */
+    uint publishStride() {
+      uint max = std::max(dynamicVariables_.publishMaxParticles, 1);
+      return (nParticles_ + max - 1) / max;
     }
 
 private:
@@ -63,21 +72,67 @@ private:
     std::vector<ros::Publisher> robotGTPublishers_;
     std::vector<ros::Publisher> robotEstimatePublishers_;
     ros::Publisher targetObservationsPublisher_;
+    ros::Publisher latencyPublisher_;
+    ros::Publisher compressedParticlePublisher_;
 
     read_omni_dataset::LRMGTData msg_GT_;
     pfuclt_omni_dataset::particles msg_particles_;
     read_omni_dataset::Estimate msg_estimate_;
+    pfuclt_omni_dataset::latencies msg_latencies_;
+    pfuclt_omni_dataset::compressed_particles msg_compressed_particles_;
 
     std::vector<tf2_ros::TransformBroadcaster> robotBroadcasters;
 
+    ParticleStreamEncoder streamEncoder_;
+
+    boost::shared_ptr<ResultRecorder> recorder_;
+    uint iterationsSinceParticlesRecorded_;
+
     void publishParticles();
 
+    /**
+     * @brief resizeParticleMessage - resize the message with every particle
+     * @param n - the number of particles it will carry
+     */
+    void resizeParticleMessage(const uint n);
+
+    /**
+     * @brief streamBlockSizes - the blocks of the compressed particle stream,
+     * one per robot and per target, and the weights
+     */
+    std::vector<uint> streamBlockSizes();
+
+    /**
+     * @brief streamSteps - the quantization step of each subparticle set in
+     * the compressed particle stream
+     */
+    std::vector<float> streamSteps();
+
+    /**
+     * @brief publishCompressedParticles - encode the published particles in
+     * the compressed stream, if it's subscribed or recorded
+     * @param stride - only one every stride particles is encoded
+     */
+    void publishCompressedParticles(const uint stride);
+
+    /**
+     * @brief compressedParticlesConnected - new subscribers of the compressed
+     * stream start at a keyframe
+     */
+    void compressedParticlesConnected(const ros::SingleSubscriberPublisher &);
+
     void publishRobotStates();
 
     void publishTargetState();
 
     void publishEstimate();
 
+    /**
+     * @brief publishLatencies - publish the latency chain of every observation
+     * fused in the estimate, with the same stamp as the estimate
+     */
+    void publishLatencies();
+
     void publishGTData();
 
     void publishTargetObservations();
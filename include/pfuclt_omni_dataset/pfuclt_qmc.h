@@ -0,0 +1,76 @@
+#ifndef PFUCLT_QMC_H
+#define PFUCLT_QMC_H
+
+#include <vector>
+#include <sys/types.h>
+#include <boost/random.hpp>
+
+// Scrambling starts the sequence at a random index up to this value
+#define HALTON_MAX_OFFSET 4096
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The HaltonSequence class - a low-discrepancy sequence in the unit
+ * hypercube, which covers it more evenly than pseudo-random draws for the same
+ * number of points. Each dimension uses the radical inverse in a different
+ * prime base. Scrambling applies a random start index and a random shift
+ * modulo 1 (Cranley-Patterson rotation), so that repeated uses don't produce
+ * the same points while keeping the low discrepancy
+ */
+class HaltonSequence
+{
+public:
+  /**
+   * @brief HaltonSequence - constructor
+   * @param dimensions - number of dimensions, up to HaltonSequence::maxDimensions()
+   */
+  HaltonSequence(const uint dimensions);
+
+  /**
+   * @brief scramble - randomize the start index and shift of the sequence
+   * @param rng - the random number generator to use
+   */
+  template <typename RNG> void scramble(RNG& rng)
+  {
+    boost::random::uniform_real_distribution<> shift(0.0, 1.0);
+    boost::random::uniform_int_distribution<> offset(0, HALTON_MAX_OFFSET);
+
+    for (uint d = 0; d < shift_.size(); ++d)
+      shift_[d] = shift(rng);
+    offset_ = offset(rng);
+  }
+
+  /**
+   * @brief operator () - a coordinate of a point of the sequence
+   * @param index - the point's index
+   * @param dim - the dimension [0,dimensions)
+   * @return value in [0,1)
+   */
+  double operator()(const uint index, const uint dim) const
+  {
+    double v = radicalInverse(index + offset_, bases_[dim]) + shift_[dim];
+    return v >= 1.0 ? v - 1.0 : v;
+  }
+
+  /**
+   * @brief radicalInverse - mirror the digits of index in base around the
+   * decimal point
+   */
+  static double radicalInverse(unsigned long index, const uint base);
+
+  /**
+   * @brief maxDimensions - the number of prime bases available
+   */
+  static uint maxDimensions();
+
+private:
+  std::vector<uint> bases_;
+  std::vector<double> shift_;
+  uint offset_;
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_QMC_H
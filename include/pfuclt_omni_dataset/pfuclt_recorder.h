@@ -0,0 +1,119 @@
+#ifndef PFUCLT_RECORDER_H
+#define PFUCLT_RECORDER_H
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <string>
+
+// Maximum messages waiting to be written, the filter waits for the writer
+// beyond it so that no result is lost
+#define RECORDER_MAX_QUEUE 1000
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The ResultRecorder class - writes the filter's results to a bag from
+ * a background thread, without publishing them to another process first
+ * @remark messages are copied when recorded, and serialized and written by the
+ * writer thread
+ */
+class ResultRecorder
+{
+public:
+  /**
+   * @brief ResultRecorder - constructor, opens the bag and starts the writer
+   * thread
+   * @param filename - the bag to write, which is overwritten
+   */
+  ResultRecorder(const std::string& filename);
+
+  /**
+   * @brief ~ResultRecorder - writes the pending messages and closes the bag
+   */
+  ~ResultRecorder();
+
+  /**
+   * @brief isOpen
+   * @return true if the bag was opened and messages can be recorded
+   */
+  bool isOpen() const { return open_; }
+
+  /**
+   * @brief record - queue a copy of a message to be written to the bag
+   * @param topic - the topic it is written under
+   * @param time - the time it is written with, usually its stamp
+   * @param msg - the message
+   */
+  template <typename T>
+  void record(const std::string& topic, const ros::Time& time, const T& msg)
+  {
+    if (open_)
+      enqueue(Entry(topic, time, new TypedMessage<T>(msg)));
+  }
+
+private:
+  /**
+   * @brief The Message struct - a message of any type waiting to be written
+   */
+  struct Message
+  {
+    virtual ~Message() {}
+    virtual void write(rosbag::Bag& bag, const std::string& topic,
+                       const ros::Time& time) const = 0;
+  };
+
+  template <typename T> struct TypedMessage : public Message
+  {
+    T msg;
+
+    TypedMessage(const T& msg) : msg(msg) {}
+
+    void write(rosbag::Bag& bag, const std::string& topic,
+               const ros::Time& time) const
+    {
+      bag.write(topic, time, msg);
+    }
+  };
+
+  struct Entry
+  {
+    std::string topic;
+    ros::Time time;
+    boost::shared_ptr<Message> message;
+
+    Entry(const std::string& topic, const ros::Time& time, Message* message)
+        : topic(topic), time(time), message(message)
+    {
+    }
+  };
+
+  rosbag::Bag bag_;
+  std::string filename_;
+  bool open_;
+  uint written_, failed_;
+  std::deque<Entry> queue_;
+  bool stop_;
+  boost::mutex mutex_;
+  boost::condition_variable queued_, dequeued_;
+  boost::thread thread_;
+
+  /**
+   * @brief enqueue - add an entry to the queue, waiting while it is full
+   */
+  void enqueue(const Entry& entry);
+
+  /**
+   * @brief run - the writer thread's loop
+   */
+  void run();
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_RECORDER_H
@@ -0,0 +1,41 @@
+#ifndef PFUCLT_SERIALIZE_H
+#define PFUCLT_SERIALIZE_H
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+// Internal to the shard link and the belief exchange, which share their wire
+// encoding
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief put - append a value to a message, copied in the host's byte order
+ */
+template <typename T>
+inline void put(std::vector<uint8_t>& out, const T& value)
+{
+  const uint8_t* bytes = (const uint8_t*)&value;
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+/**
+ * @brief get - read a value put() in a message, and advance past it
+ * @return false if the message ends before the value
+ */
+template <typename T>
+inline bool get(const uint8_t*& in, const uint8_t* end, T& value)
+{
+  if ((size_t)(end - in) < sizeof(T))
+    return false;
+
+  memcpy(&value, in, sizeof(T));
+  in += sizeof(T);
+  return true;
+}
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_SERIALIZE_H
@@ -0,0 +1,174 @@
+#ifndef PFUCLT_SHARD_H
+#define PFUCLT_SHARD_H
+
+#include <ros/ros.h>
+#include <boost/random.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Start of every shard message, checked before its size is trusted
+#define SHARD_MAGIC 0x50465348
+
+// Larger messages are taken as corrupt and their connection is closed
+#define SHARD_MAX_MESSAGE_BYTES (64 << 20)
+
+// Seconds between two attempts of a worker to connect to the coordinator
+#define SHARD_RECONNECT_PERIOD 1.0
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The ShardMessage struct - sent by every shard at each iteration, and
+ * answered by the coordinator with the combined values
+ */
+struct ShardMessage
+{
+  // Stamp of the main robot's odometry, which identifies the iteration
+  ros::Time stamp;
+
+  // Particles of the shard, or of all shards in a reply
+  uint32_t nParticles;
+
+  // Sum of the weights, and the sums weighted by them used to estimate, of
+  // the shard or of all shards in a reply
+  double weightSum;
+  std::vector<double> weightedSums;
+
+  // One vector per subparticle set, weights last: the shard's best particles,
+  // or the particles it should import in a reply
+  std::vector<std::vector<float> > particles;
+
+  ShardMessage() : nParticles(0), weightSum(0.0) {}
+};
+
+/**
+ * @brief The ShardLink class - connects the shards of a filter whose particles
+ * are split across processes, over a Unix socket or TCP. Shard 0 is the
+ * coordinator, which every other shard connects to
+ * @remark messages are sent in the host's byte order, so shards on different
+ * machines must share the architecture
+ */
+class ShardLink
+{
+public:
+  typedef boost::random::mt19937 RNGType;
+
+  /**
+   * @brief ShardLink - constructor, listens on the address as the coordinator
+   * or connects to it as a worker
+   * @param index - this shard's index, 0 for the coordinator
+   * @param count - number of shards
+   * @param address - path of a Unix socket, or host:port for TCP
+   * @param timeout - seconds to wait for the other shards at each iteration
+   * @param maxImports - most particles a shard imports at each iteration
+   */
+  ShardLink(const uint index, const uint count, const std::string& address,
+            const double timeout, const uint maxImports);
+
+  /**
+   * @brief ~ShardLink - closes the connections, and the Unix socket
+   */
+  ~ShardLink();
+
+  bool isCoordinator() const { return index_ == 0; }
+
+  /**
+   * @brief shardsCombined - number of shards combined in the last exchange
+   */
+  uint shardsCombined() const { return shardsCombined_; }
+
+  /**
+   * @brief exchange - exchange this shard's message of an iteration. A worker
+   * sends it and waits for the reply, the coordinator waits for the workers'
+   * messages of the same iteration and answers them
+   * @param local - this shard's message
+   * @param reply - output, the combined values and the particles to import
+   * @return false if nothing was combined, e.g. on a timeout or when not
+   * connected, and the shard should continue on its own
+   */
+  bool exchange(const ShardMessage& local, ShardMessage& reply);
+
+  /**
+   * @brief combine - sum the messages of an iteration, and choose the
+   * particles each shard imports. A shard with less weight than its share of
+   * the particles imports up to maxImports of the other shards' particles,
+   * drawn according to their weights. The imports keep their weights, which
+   * the importing shard replaces with a uniform one
+   * @param messages - the messages, which must have the same sizes
+   * @param maxImports - most particles imported by each shard
+   * @param rng - the generator used to draw the particles
+   * @param replies - output, one for each message
+   */
+  static void combine(const std::vector<const ShardMessage*>& messages,
+                      const uint maxImports, RNGType& rng,
+                      std::vector<ShardMessage>& replies);
+
+private:
+  /**
+   * @brief The Connection struct - a worker's connection to the coordinator,
+   * or the coordinator's to a worker, with the bytes not yet parsed
+   */
+  struct Connection
+  {
+    int socket;
+    std::vector<uint8_t> received;
+
+    // A message of a later iteration, kept until that iteration
+    bool hasPending;
+    ShardMessage pending;
+
+    Connection(const int socket) : socket(socket), hasPending(false) {}
+  };
+
+  const uint index_, count_;
+  const std::string address_;
+  const double timeout_;
+  const uint maxImports_;
+  int listener_;
+  std::vector<Connection> connections_;
+  ros::WallTime lastConnectAttempt_;
+  uint shardsCombined_;
+  RNGType rng_;
+
+  /**
+   * @brief connect - as a worker, connect to the coordinator
+   */
+  bool connect();
+
+  /**
+   * @brief acceptPending - as the coordinator, accept every waiting worker
+   */
+  void acceptPending();
+
+  /**
+   * @brief send - send a message on a connection, closing it on failure
+   */
+  bool send(Connection& connection, const ShardMessage& msg);
+
+  /**
+   * @brief receive - wait for the next message on a connection, closing it
+   * on failure
+   * @param deadline - when to give up
+   */
+  bool receive(Connection& connection, const ros::WallTime& deadline,
+               ShardMessage& msg);
+
+  /**
+   * @brief receiveIteration - wait for a connection's message of an
+   * iteration, dropping older ones and keeping a newer one for later
+   */
+  bool receiveIteration(Connection& connection, const ros::Time& stamp,
+                        const ros::WallTime& deadline, ShardMessage& msg);
+
+  /**
+   * @brief closeConnection - close the socket, the connection is removed
+   * after the exchange
+   */
+  void closeConnection(Connection& connection);
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_SHARD_H
@@ -0,0 +1,105 @@
+#ifndef PFUCLT_STREAM_H
+#define PFUCLT_STREAM_H
+
+#include <pfuclt_omni_dataset/compressed_particles.h>
+#include <stdint.h>
+#include <vector>
+
+// Previous particles with the closest first state that are tried as the
+// reference of a block, on each side
+#define STREAM_SEARCH_WINDOW 4
+
+// Sets with a step of 0 are quantized to this many levels of their largest
+// absolute value in each frame, e.g. the weights
+#define STREAM_RELATIVE_LEVELS 65535
+
+// zlib level of the entropy coding, favouring speed as it runs in the filter
+#define STREAM_COMPRESSION_LEVEL 1
+
+namespace pfuclt_omni_dataset
+{
+typedef std::vector<std::vector<float> > stream_particles_t;
+
+/**
+ * @brief The ParticleStreamEncoder class - encodes the particles of each
+ * iteration as a compressed_particles frame. Values are quantized, and each
+ * block of a particle, such as a robot's pose, is coded as the difference to
+ * a reference: a similar particle of the previous frame, which is often its
+ * ancestor, or the previous particle of the same frame. Keyframes only use the
+ * latter, so a decoder can start at any of them
+ * @remark the error of each decoded value is at most half its step, and does
+ * not accumulate over delta frames
+ */
+class ParticleStreamEncoder
+{
+public:
+  /**
+   * @brief ParticleStreamEncoder - constructor
+   * @param blockSizes - number of consecutive subparticle sets in each block,
+   * adding up to the number of sets
+   * @param steps - quantization step of each set, 0 for a step relative to
+   * the largest value of the set in each frame
+   * @param keyframePeriod - frames between two keyframes, 1 for keyframes only
+   * @param level - zlib compression level
+   */
+  ParticleStreamEncoder(const std::vector<uint>& blockSizes,
+                        const std::vector<float>& steps,
+                        const uint keyframePeriod,
+                        const int level = STREAM_COMPRESSION_LEVEL);
+
+  /**
+   * @brief encode - encode a frame
+   * @param particles - one vector per subparticle set
+   * @param stride - only one every stride particles is encoded
+   * @param msg - the frame, whose header is left to the caller
+   */
+  void encode(const stream_particles_t& particles, const uint stride,
+              compressed_particles& msg);
+
+  /**
+   * @brief forceKeyframe - make the next frame a keyframe, e.g. for a new
+   * subscriber
+   */
+  void forceKeyframe() { framesSinceKeyframe_ = keyframePeriod_; }
+
+private:
+  std::vector<uint> blockSizes_;
+  std::vector<float> steps_;
+  uint keyframePeriod_, framesSinceKeyframe_;
+  int level_;
+  uint32_t sequence_;
+
+  // Quantized values of the previous frame, as the decoder has them
+  std::vector<std::vector<int32_t> > previous_;
+  std::vector<std::vector<int32_t> > current_;
+};
+
+/**
+ * @brief The ParticleStreamDecoder class - decodes the frames of a
+ * ParticleStreamEncoder, which must be given in order from a keyframe on
+ */
+class ParticleStreamDecoder
+{
+public:
+  ParticleStreamDecoder();
+
+  /**
+   * @brief decode - decode a frame
+   * @param msg - the frame
+   * @param particles - one vector per subparticle set
+   * @return false if the frame is malformed, or is a delta frame that doesn't
+   * follow the last one decoded. Decoding resumes at the next keyframe
+   */
+  bool decode(const compressed_particles& msg, stream_particles_t& particles);
+
+private:
+  bool valid_;
+  uint32_t sequence_;
+  std::vector<std::vector<int32_t> > previous_;
+  std::vector<std::vector<int32_t> > current_;
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_STREAM_H
@@ -0,0 +1,141 @@
+#ifndef PFUCLT_TUNER_H
+#define PFUCLT_TUNER_H
+
+#include <ros/ros.h>
+#include <vector>
+#include <string>
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The KernelConfig struct - one variant of a parallelizable kernel,
+ * defined by the number of OpenMP threads and the static schedule chunk size
+ * @remark nThreads == 1 corresponds to the serial variant
+ */
+typedef struct kernelConfig_s
+{
+  uint nThreads;
+  uint chunkSize;
+
+  kernelConfig_s(uint nThreads = 1, uint chunkSize = 1)
+      : nThreads(nThreads), chunkSize(chunkSize)
+  {
+  }
+} KernelConfig;
+
+/**
+ * @brief The KernelTuner class - times the available variants of each kernel
+ * at the current problem size during the filter's own iterations and selects
+ * the fastest one
+ */
+class KernelTuner
+{
+public:
+  /**
+   * @brief The Kernel enum - the kernels that can be tuned
+   */
+  enum Kernel
+  {
+    FUSE_ROBOTS,
+    FUSE_TARGET,
+    NUM_KERNELS
+  };
+
+  /**
+   * @brief KernelTuner - constructor
+   * @param enabled - if false, the default configuration (all threads) is
+   * always used and no timing is performed
+   * @param samples - number of timed runs of each variant before deciding
+   * @param retunePeriod - number of iterations after which tuning restarts, 0
+   * to tune only at startup and when the problem size changes
+   * @param exportFile - CSV file where the tuning results are written, empty
+   * to disable exporting
+   */
+  KernelTuner(bool enabled, uint samples, uint retunePeriod,
+              const std::string& exportFile);
+
+  /**
+   * @brief reset - generate the variants for a new problem size and restart
+   * tuning
+   * @param nParticles - the number of particles
+   */
+  void reset(const uint nParticles);
+
+  /**
+   * @brief begin - call before running a kernel
+   * @param k - the kernel about to run
+   * @return the configuration the kernel should run with
+   */
+  const KernelConfig& begin(const Kernel k);
+
+  /**
+   * @brief end - call after running a kernel, to record the time taken
+   * @param k - the kernel that finished running
+   */
+  void end(const Kernel k);
+
+  /**
+   * @brief config - the configuration a kernel is currently running with,
+   * without timing it
+   * @param k - the kernel
+   */
+  const KernelConfig& config(const Kernel k) const;
+
+  /**
+   * @brief isTuning - check if any kernel is still being tuned
+   * @return true if at least one kernel has not chosen its variant yet
+   */
+  bool isTuning() const;
+
+  /**
+   * @brief logConfiguration - print the chosen configuration of all kernels
+   */
+  void logConfiguration() const;
+
+  /**
+   * @brief exportCSV - write the timings of every variant to a CSV file with
+   * the format kernel,particles,threads,chunk,samples,mean_ms,chosen
+   * @param filename - the CSV file
+   * @return true if the file was written
+   */
+  bool exportCSV(const std::string& filename) const;
+
+  /**
+   * @brief kernelName - human readable name of a kernel
+   */
+  static const char* kernelName(const Kernel k);
+
+private:
+  struct KernelState
+  {
+    std::vector<KernelConfig> candidates;
+    std::vector<double> timeSums;
+    std::vector<uint> counts;
+    uint current;
+    uint chosen;
+    uint iterationsSinceTuned;
+    bool tuning;
+    ros::WallTime start;
+  };
+
+  bool enabled_;
+  uint samples_, retunePeriod_, nParticles_, maxThreads_;
+  std::string exportFile_;
+  KernelConfig defaultConfig_;
+  std::vector<KernelState> kernels_;
+
+  /**
+   * @brief restart - clear the timings of a kernel and start tuning it again
+   */
+  void restart(KernelState& ks);
+
+  /**
+   * @brief choose - select the variant with the lowest mean time
+   */
+  void choose(const Kernel k);
+};
+
+// end of namespace pfuclt_omni_dataset
+}
+
+#endif // PFUCLT_TUNER_H
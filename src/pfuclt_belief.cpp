@@ -0,0 +1,545 @@
+#include <pfuclt_omni_dataset/pfuclt_belief.h>
+#include <pfuclt_omni_dataset/pfuclt_serialize.h>
+#include <angles/angles.h>
+#include <eigen3/Eigen/Cholesky>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+namespace pfuclt_omni_dataset
+{
+
+/**
+ * @brief difference - x - c, wrapped for the angular state
+ */
+static inline double difference(const double x, const double c,
+                                const int s, const int angular)
+{
+  return s == angular ? angles::normalize_angle(x - c) : x - c;
+}
+
+bool GaussianMixture::fit(const std::vector<const std::vector<float>*>& states,
+                          const std::vector<float>& weights,
+                          const uint maxComponents, const int angular)
+{
+  const uint d = states.size();
+  const uint n = weights.size();
+
+  dimensions = d;
+  this->angular = angular;
+  components.clear();
+
+  double weightSum = 0.0;
+  for (uint p = 0; p < n; ++p)
+    weightSum += weights[p];
+
+  if (weightSum <= 0.0 || d == 0 || d > BELIEF_MAX_DIMENSIONS ||
+      maxComponents == 0)
+    return false;
+
+  // The heaviest particle is the first center, then the ones farthest from
+  // the centers, in proportion to their weight so that outliers aren't chosen
+  std::vector<std::vector<double> > centers;
+  std::vector<double> minDistances(n, std::numeric_limits<double>::max());
+  uint next = std::max_element(weights.begin(), weights.end()) -
+              weights.begin();
+
+  while (centers.size() < maxComponents)
+  {
+    std::vector<double> center(d);
+    for (uint s = 0; s < d; ++s)
+      center[s] = (*states[s])[next];
+    centers.push_back(center);
+
+    double farthest = 0.0;
+    for (uint p = 0; p < n; ++p)
+    {
+      double d2 = 0.0;
+      for (uint s = 0; s < d; ++s)
+        d2 += pow(difference((*states[s])[p], center[s], s, angular), 2);
+
+      minDistances[p] = std::min(minDistances[p], d2);
+      if (weights[p] * minDistances[p] > farthest)
+      {
+        farthest = weights[p] * minDistances[p];
+        next = p;
+      }
+    }
+
+    // Every particle is on a center already
+    if (farthest <= 0.0)
+      break;
+  }
+
+  // Weighted k-means, a last assignment follows the iterations
+  const uint k = centers.size();
+  std::vector<uint> cluster(n, 0);
+
+  for (uint it = 0; it <= BELIEF_FIT_ITERATIONS; ++it)
+  {
+    for (uint p = 0; p < n; ++p)
+    {
+      double best = std::numeric_limits<double>::max();
+      for (uint c = 0; c < k; ++c)
+      {
+        double d2 = 0.0;
+        for (uint s = 0; s < d && d2 < best; ++s)
+          d2 += pow(difference((*states[s])[p], centers[c][s], s, angular), 2);
+
+        if (d2 < best)
+        {
+          best = d2;
+          cluster[p] = c;
+        }
+      }
+    }
+
+    if (it == BELIEF_FIT_ITERATIONS)
+      break;
+
+    // Move each center to the weighted mean of its particles, the circular
+    // mean for the angle
+    std::vector<std::vector<double> > sums(k, std::vector<double>(d + 1, 0.0));
+    std::vector<double> clusterWeights(k, 0.0);
+
+    for (uint p = 0; p < n; ++p)
+    {
+      const uint c = cluster[p];
+      clusterWeights[c] += weights[p];
+      for (uint s = 0; s < d; ++s)
+      {
+        if ((int)s == angular)
+        {
+          sums[c][s] += weights[p] * cos((*states[s])[p]);
+          sums[c][d] += weights[p] * sin((*states[s])[p]);
+        }
+        else
+          sums[c][s] += weights[p] * (*states[s])[p];
+      }
+    }
+
+    for (uint c = 0; c < k; ++c)
+    {
+      if (clusterWeights[c] <= 0.0)
+        continue;
+
+      for (uint s = 0; s < d; ++s)
+        centers[c][s] = (int)s == angular ? atan2(sums[c][d], sums[c][s])
+                                          : sums[c][s] / clusterWeights[c];
+    }
+  }
+
+  // A component for each cluster with weight, around its center
+  components.resize(k);
+  for (uint c = 0; c < k; ++c)
+  {
+    components[c].mean = centers[c];
+    components[c].covariance.assign(d * d, 0.0);
+  }
+
+  for (uint p = 0; p < n; ++p)
+  {
+    Component& component = components[cluster[p]];
+    component.weight += weights[p];
+
+    for (uint i = 0; i < d; ++i)
+    {
+      double di = difference((*states[i])[p], component.mean[i], i, angular);
+      for (uint j = 0; j <= i; ++j)
+        component.covariance[i * d + j] +=
+            weights[p] * di *
+            difference((*states[j])[p], component.mean[j], j, angular);
+    }
+  }
+
+  std::vector<Component> kept;
+  for (uint c = 0; c < k; ++c)
+  {
+    Component& component = components[c];
+    if (component.weight <= 0.0)
+      continue;
+
+    for (uint i = 0; i < d; ++i)
+    {
+      for (uint j = 0; j <= i; ++j)
+      {
+        component.covariance[i * d + j] /= component.weight;
+        component.covariance[j * d + i] = component.covariance[i * d + j];
+      }
+      component.covariance[i * d + i] += BELIEF_MIN_VARIANCE;
+    }
+
+    component.weight /= weightSum;
+    kept.push_back(component);
+  }
+
+  components.swap(kept);
+  return prepare();
+}
+
+bool GaussianMixture::prepare()
+{
+  const uint d = dimensions;
+
+  double weightSum = 0.0;
+  for (uint c = 0; c < components.size(); ++c)
+  {
+    const Component& component = components[c];
+    if (!(component.weight > 0.0) || component.mean.size() != d ||
+        component.covariance.size() != d * d)
+      return false;
+
+    weightSum += component.weight;
+  }
+
+  for (uint c = 0; c < components.size(); ++c)
+  {
+    Component& component = components[c];
+    component.weight /= weightSum;
+
+    Eigen::MatrixXd covariance(d, d);
+    for (uint i = 0; i < d; ++i)
+      for (uint j = 0; j < d; ++j)
+        covariance(i, j) = component.covariance[i * d + j];
+
+    Eigen::LLT<Eigen::MatrixXd> llt(covariance);
+    if (llt.info() != Eigen::Success)
+      return false;
+
+    Eigen::MatrixXd L = llt.matrixL();
+    Eigen::MatrixXd inverse = llt.solve(Eigen::MatrixXd::Identity(d, d));
+
+    component.cholesky.resize(d * d);
+    component.inverse.resize(d * d);
+    double logDeterminant = 0.0;
+    for (uint i = 0; i < d; ++i)
+    {
+      logDeterminant += 2 * log(L(i, i));
+      for (uint j = 0; j < d; ++j)
+      {
+        component.cholesky[i * d + j] = L(i, j);
+        component.inverse[i * d + j] = inverse(i, j);
+      }
+    }
+
+    component.logNormalizer = log(component.weight) -
+                              0.5 * (d * log(2 * M_PI) + logDeterminant);
+  }
+
+  return true;
+}
+
+double GaussianMixture::logDensity(const double* x) const
+{
+  const uint d = dimensions;
+  double delta[BELIEF_MAX_DIMENSIONS];
+
+  // Log-sum-exp kept as it goes, so that far away particles don't all
+  // underflow to 0
+  double maxLog = -std::numeric_limits<double>::infinity();
+  double sum = 0.0;
+
+  for (uint c = 0; c < components.size(); ++c)
+  {
+    const Component& component = components[c];
+    for (uint s = 0; s < d; ++s)
+      delta[s] = difference(x[s], component.mean[s], s, angular);
+
+    double mahalanobis = 0.0;
+    for (uint i = 0; i < d; ++i)
+      for (uint j = 0; j < d; ++j)
+        mahalanobis += delta[i] * component.inverse[i * d + j] * delta[j];
+
+    double logC = component.logNormalizer - 0.5 * mahalanobis;
+    if (logC > maxLog)
+    {
+      sum = sum * exp(maxLog - logC) + 1.0;
+      maxLog = logC;
+    }
+    else
+      sum += exp(logC - maxLog);
+  }
+
+  return components.empty() ? maxLog : maxLog + log(sum);
+}
+
+void GaussianMixture::sample(RNGType& rng, double* x) const
+{
+  const uint d = dimensions;
+  if (components.empty())
+    return;
+
+  boost::random::uniform_real_distribution<> pick(0.0, 1.0);
+  boost::random::normal_distribution<> normal(0.0, 1.0);
+
+  double u = pick(rng);
+  uint c = 0;
+  while (c + 1 < components.size() && u > components[c].weight)
+    u -= components[c++].weight;
+
+  const Component& component = components[c];
+  double z[BELIEF_MAX_DIMENSIONS];
+  for (uint s = 0; s < d; ++s)
+    z[s] = normal(rng);
+
+  for (uint i = 0; i < d; ++i)
+  {
+    x[i] = component.mean[i];
+    for (uint j = 0; j <= i; ++j)
+      x[i] += component.cholesky[i * d + j] * z[j];
+
+    if ((int)i == angular)
+      x[i] = angles::normalize_angle(x[i]);
+  }
+}
+
+/**
+ * @brief serialize - a mixture as single precision values, and only the lower
+ * triangle of each covariance
+ */
+static void serialize(const GaussianMixture& mixture, std::vector<uint8_t>& out)
+{
+  const uint d = mixture.dimensions;
+  put<uint32_t>(out, d);
+  put<int32_t>(out, mixture.angular);
+  put<uint32_t>(out, mixture.components.size());
+
+  for (uint c = 0; c < mixture.components.size(); ++c)
+  {
+    const GaussianMixture::Component& component = mixture.components[c];
+    put<float>(out, component.weight);
+    for (uint i = 0; i < d; ++i)
+      put<float>(out, component.mean[i]);
+    for (uint i = 0; i < d; ++i)
+      for (uint j = 0; j <= i; ++j)
+        put<float>(out, component.covariance[i * d + j]);
+  }
+}
+
+static bool deserialize(const uint8_t*& in, const uint8_t* end,
+                        GaussianMixture& mixture)
+{
+  uint32_t d, nComponents;
+  int32_t angular;
+  if (!get(in, end, d) || !get(in, end, angular) ||
+      !get(in, end, nComponents) || d > BELIEF_MAX_DIMENSIONS ||
+      angular >= (int32_t)d)
+    return false;
+
+  const size_t componentBytes = (1 + d + d * (d + 1) / 2) * sizeof(float);
+  if (nComponents > (size_t)(end - in) / componentBytes)
+    return false;
+
+  mixture.dimensions = d;
+  mixture.angular = angular < 0 ? -1 : angular;
+  mixture.components.assign(nComponents, GaussianMixture::Component());
+
+  for (uint c = 0; c < nComponents; ++c)
+  {
+    GaussianMixture::Component& component = mixture.components[c];
+    component.mean.resize(d);
+    component.covariance.resize(d * d);
+
+    float value;
+    get(in, end, value);
+    component.weight = value;
+    for (uint i = 0; i < d; ++i)
+    {
+      get(in, end, value);
+      component.mean[i] = value;
+    }
+    for (uint i = 0; i < d; ++i)
+    {
+      for (uint j = 0; j <= i; ++j)
+      {
+        get(in, end, value);
+        component.covariance[i * d + j] = component.covariance[j * d + i] =
+            value;
+      }
+    }
+  }
+
+  return true;
+}
+
+static void serialize(const BeliefSummary& summary, std::vector<uint8_t>& out)
+{
+  out.clear();
+  put<uint32_t>(out, BELIEF_MAGIC);
+  put<uint32_t>(out, summary.robot);
+  put<uint32_t>(out, summary.sequence);
+  put<uint32_t>(out, summary.stamp.sec);
+  put<uint32_t>(out, summary.stamp.nsec);
+  serialize(summary.pose, out);
+  serialize(summary.target, out);
+}
+
+/**
+ * @brief deserialize - a whole datagram
+ * @return false if the summary is malformed
+ */
+static bool deserialize(const uint8_t* in, const uint8_t* end,
+                        BeliefSummary& summary)
+{
+  uint32_t magic, sec, nsec;
+  if (!get(in, end, magic) || magic != BELIEF_MAGIC ||
+      !get(in, end, summary.robot) || !get(in, end, summary.sequence) ||
+      !get(in, end, sec) || !get(in, end, nsec) ||
+      !deserialize(in, end, summary.pose) ||
+      !deserialize(in, end, summary.target))
+    return false;
+
+  summary.stamp = ros::Time(sec, nsec);
+  return in == end && summary.pose.prepare() && summary.target.prepare();
+}
+
+/**
+ * @brief resolve - the addresses of host:port for UDP
+ * @param family - AF_UNSPEC, or the family of the socket they're used with
+ * @return NULL if it doesn't resolve, else to be freed with freeaddrinfo
+ */
+static struct addrinfo* resolve(const std::string& address, const int family,
+                                const bool passive)
+{
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos)
+    return NULL;
+
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+
+  // Brackets of an IPv6 address, e.g. [::1]:9200
+  if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')
+    host = host.substr(1, host.size() - 2);
+
+  struct addrinfo hints, *result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+  if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints,
+                  &result) != 0)
+    return NULL;
+
+  return result;
+}
+
+BeliefExchange::BeliefExchange(const std::string& address,
+                               const std::string& peers)
+    : socket_(-1), family_(AF_UNSPEC), buffer_(BELIEF_MAX_DATAGRAM_BYTES)
+{
+  struct addrinfo* result = resolve(address, AF_UNSPEC, true);
+  for (struct addrinfo* ai = result; ai != NULL && socket_ < 0;
+       ai = ai->ai_next)
+  {
+    socket_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (socket_ < 0)
+      continue;
+
+    if (bind(socket_, ai->ai_addr, ai->ai_addrlen) != 0)
+    {
+      close(socket_);
+      socket_ = -1;
+    }
+    else
+      family_ = ai->ai_family;
+  }
+
+  if (result != NULL)
+    freeaddrinfo(result);
+
+  if (socket_ < 0)
+  {
+    ROS_ERROR("Belief exchange: couldn't bind to \"%s\", no summaries will be "
+              "sent or received",
+              address.c_str());
+    return;
+  }
+
+  // Tokenize the comma-separated peers
+  std::istringstream iss(peers);
+  std::string peer;
+  while (std::getline(iss, peer, ','))
+  {
+    peer.erase(0, peer.find_first_not_of(" \t"));
+    peer.erase(peer.find_last_not_of(" \t") + 1);
+    if (peer.empty())
+      continue;
+
+    struct addrinfo* ai = resolve(peer, family_, false);
+    if (ai == NULL)
+    {
+      ROS_WARN("Belief exchange: couldn't resolve the peer \"%s\"",
+               peer.c_str());
+      continue;
+    }
+
+    const uint8_t* bytes = (const uint8_t*)ai->ai_addr;
+    peers_.push_back(std::vector<uint8_t>(bytes, bytes + ai->ai_addrlen));
+    freeaddrinfo(ai);
+  }
+
+  ROS_INFO("Belief exchange: receiving on \"%s\", sending to %d peer(s)",
+           address.c_str(), (int)peers_.size());
+}
+
+BeliefExchange::~BeliefExchange()
+{
+  if (socket_ >= 0)
+    close(socket_);
+}
+
+size_t BeliefExchange::send(const BeliefSummary& summary)
+{
+  if (socket_ < 0)
+    return 0;
+
+  std::vector<uint8_t> out;
+  serialize(summary, out);
+  if (out.size() > BELIEF_MAX_DATAGRAM_BYTES)
+  {
+    ROS_ERROR("Belief exchange: a summary of %d bytes doesn't fit a datagram",
+              (int)out.size());
+    return 0;
+  }
+
+  size_t sent = 0;
+  for (uint i = 0; i < peers_.size(); ++i)
+  {
+    if (sendto(socket_, &out[0], out.size(), MSG_DONTWAIT,
+               (const struct sockaddr*)&peers_[i][0],
+               peers_[i].size()) == (ssize_t)out.size())
+      sent += out.size();
+  }
+
+  return sent;
+}
+
+bool BeliefExchange::receive(BeliefSummary& summary)
+{
+  if (socket_ < 0)
+    return false;
+
+  while (true)
+  {
+    ssize_t n =
+        recvfrom(socket_, &buffer_[0], buffer_.size(), MSG_DONTWAIT, NULL, NULL);
+    if (n < 0)
+      return false;
+
+    if (deserialize(&buffer_[0], &buffer_[0] + n, summary))
+      return true;
+
+    ROS_WARN("Belief exchange: ignoring a malformed summary of %d bytes",
+             (int)n);
+  }
+}
+
+// end of namespace pfuclt_omni_dataset
+}
@@ -0,0 +1,413 @@
+#include <pfuclt_omni_dataset/pfuclt_cache.h>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Columns start at multiples of this, so that every value is aligned
+#define DATASET_CACHE_ALIGNMENT 8
+
+namespace pfuclt_omni_dataset
+{
+
+DatasetCache::DatasetCache(const uint nRobots, const uint nLandmarks)
+    : nRobots_(nRobots), nLandmarks_(nLandmarks), building_(NUM_COLUMNS),
+      map_(NULL), mapSize_(0)
+{
+  for (uint c = 0; c < NUM_COLUMNS; ++c)
+  {
+    nRows_[c] = 0;
+    columns_[c] = NULL;
+  }
+}
+
+DatasetCache::~DatasetCache() { close(); }
+
+void DatasetCache::close()
+{
+  if (map_ != NULL)
+    munmap(map_, mapSize_);
+
+  map_ = NULL;
+  mapSize_ = 0;
+}
+
+uint DatasetCache::columnWidth(const Column c) const
+{
+  switch (c)
+  {
+  case ODOMETRY_POSE:
+    return DATASET_CACHE_POSE_SIZE;
+  case TARGET_POSITION:
+  case GT_BALL_POSITION:
+    return 3;
+  case LANDMARKS_FOUND:
+  case LANDMARKS_X:
+  case LANDMARKS_Y:
+  case LANDMARKS_AREA_ACTUAL:
+  case LANDMARKS_AREA_EXPECTED:
+    return nLandmarks_;
+  case GT_POSES:
+    return DATASET_CACHE_POSE_SIZE * nRobots_;
+  default:
+    return 1;
+  }
+}
+
+size_t DatasetCache::valueSize(const Column c)
+{
+  switch (c)
+  {
+  case EVENT_TIME:
+  case EVENT_STAMP:
+    return sizeof(int64_t);
+  case EVENT_SEQ:
+  case EVENT_ROW:
+    return sizeof(uint32_t);
+  case EVENT_TYPE:
+  case EVENT_ROBOT:
+  case TARGET_FOUND:
+  case LANDMARKS_FOUND:
+  case GT_BALL_FOUND:
+    return sizeof(uint8_t);
+  case LANDMARKS_X:
+  case LANDMARKS_Y:
+  case LANDMARKS_AREA_ACTUAL:
+  case LANDMARKS_AREA_EXPECTED:
+    return sizeof(float);
+  default:
+    return sizeof(double);
+  }
+}
+
+void DatasetCache::appendEvent(const ros::Time& time,
+                               const std_msgs::Header& header,
+                               const EventType type, const uint robot,
+                               const Column table)
+{
+  append<int64_t>(EVENT_TIME, time.toNSec());
+  append<int64_t>(EVENT_STAMP, header.stamp.toNSec());
+  append<uint32_t>(EVENT_SEQ, header.seq);
+  append<uint8_t>(EVENT_TYPE, type);
+  append<uint8_t>(EVENT_ROBOT, robot);
+  append<uint32_t>(EVENT_ROW, nRows_[table]);
+
+  for (uint c = EVENT_TIME; c <= EVENT_ROW; ++c)
+    ++nRows_[c];
+}
+
+void DatasetCache::appendPose(const Column c, const geometry_msgs::Pose& pose)
+{
+  append<double>(c, pose.position.x);
+  append<double>(c, pose.position.y);
+  append<double>(c, pose.position.z);
+  append<double>(c, pose.orientation.x);
+  append<double>(c, pose.orientation.y);
+  append<double>(c, pose.orientation.z);
+  append<double>(c, pose.orientation.w);
+}
+
+void DatasetCache::readPose(const Column c, const size_t first,
+                            geometry_msgs::Pose& pose) const
+{
+  const double* v = get<double>(c) + first;
+
+  pose.position.x = v[0];
+  pose.position.y = v[1];
+  pose.position.z = v[2];
+  pose.orientation.x = v[3];
+  pose.orientation.y = v[4];
+  pose.orientation.z = v[5];
+  pose.orientation.w = v[6];
+}
+
+void DatasetCache::addOdometry(const ros::Time& time, const uint robot,
+                               const nav_msgs::Odometry& msg)
+{
+  appendEvent(time, msg.header, ODOMETRY, robot, ODOMETRY_POSE);
+
+  appendPose(ODOMETRY_POSE, msg.pose.pose);
+  ++nRows_[ODOMETRY_POSE];
+}
+
+void DatasetCache::addTarget(const ros::Time& time, const uint robot,
+                             const read_omni_dataset::BallData& msg)
+{
+  appendEvent(time, msg.header, TARGET, robot, TARGET_FOUND);
+
+  append<uint8_t>(TARGET_FOUND, msg.found);
+  append<double>(TARGET_POSITION, msg.x);
+  append<double>(TARGET_POSITION, msg.y);
+  append<double>(TARGET_POSITION, msg.z);
+  append<double>(TARGET_MISMATCH, msg.mismatchFactor);
+
+  for (uint c = TARGET_FOUND; c <= TARGET_MISMATCH; ++c)
+    ++nRows_[c];
+}
+
+void DatasetCache::addLandmarks(const ros::Time& time, const uint robot,
+                                const read_omni_dataset::LRMLandmarksData& msg)
+{
+  appendEvent(time, msg.header, LANDMARKS, robot, LANDMARKS_FOUND);
+
+  // Messages with a different number of landmarks are padded or cut
+  for (uint l = 0; l < nLandmarks_; ++l)
+  {
+    bool inMsg = l < msg.found.size();
+    append<uint8_t>(LANDMARKS_FOUND, inMsg ? msg.found[l] : 0);
+    append<float>(LANDMARKS_X, inMsg ? msg.x[l] : 0.0f);
+    append<float>(LANDMARKS_Y, inMsg ? msg.y[l] : 0.0f);
+    append<float>(LANDMARKS_AREA_ACTUAL,
+                  inMsg ? msg.AreaLandMarkActualinPixels[l] : 0.0f);
+    append<float>(LANDMARKS_AREA_EXPECTED,
+                  inMsg ? msg.AreaLandMarkExpectedinPixels[l] : 1.0f);
+  }
+
+  for (uint c = LANDMARKS_FOUND; c <= LANDMARKS_AREA_EXPECTED; ++c)
+    ++nRows_[c];
+}
+
+void DatasetCache::addGroundTruth(const ros::Time& time,
+                                  const read_omni_dataset::LRMGTData& msg)
+{
+  appendEvent(time, msg.header, GROUND_TRUTH, 0, GT_POSES);
+
+  std::vector<geometry_msgs::Pose> poses(nRobots_);
+  for (uint r = 0; r < nRobots_; ++r)
+    poses[r].orientation.w = 1.0;
+
+#ifdef USE_NEWER_READ_OMNI_PACKAGE
+  for (uint r = 0; r < nRobots_ && r < msg.poseOMNI.size(); ++r)
+    poses[r] = msg.poseOMNI[r].pose;
+#else
+  // The original dataset has no OMNI2
+  if (nRobots_ >= 5)
+  {
+    poses[0] = msg.poseOMNI1.pose;
+    poses[2] = msg.poseOMNI3.pose;
+    poses[3] = msg.poseOMNI4.pose;
+    poses[4] = msg.poseOMNI5.pose;
+  }
+#endif
+
+  for (uint r = 0; r < nRobots_; ++r)
+    appendPose(GT_POSES, poses[r]);
+
+  append<uint8_t>(GT_BALL_FOUND, msg.orangeBall3DGTposition.found);
+  append<double>(GT_BALL_POSITION, msg.orangeBall3DGTposition.x);
+  append<double>(GT_BALL_POSITION, msg.orangeBall3DGTposition.y);
+  append<double>(GT_BALL_POSITION, msg.orangeBall3DGTposition.z);
+
+  for (uint c = GT_POSES; c <= GT_BALL_POSITION; ++c)
+    ++nRows_[c];
+}
+
+bool DatasetCache::write(const std::string& filename) const
+{
+  std::ofstream os(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (!os.is_open())
+  {
+    ROS_ERROR("Couldn't open file \"%s\"", filename.c_str());
+    return false;
+  }
+
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DATASET_CACHE_MAGIC, sizeof(header.magic));
+  header.version = DATASET_CACHE_VERSION;
+  header.nRobots = nRobots_;
+  header.nLandmarks = nLandmarks_;
+
+  uint64_t offset = sizeof(FileHeader);
+  for (uint c = 0; c < NUM_COLUMNS; ++c)
+  {
+    offset = (offset + DATASET_CACHE_ALIGNMENT - 1) /
+             DATASET_CACHE_ALIGNMENT * DATASET_CACHE_ALIGNMENT;
+    header.rows[c] = nRows_[c];
+    header.offsets[c] = offset;
+    offset += building_[c].size();
+  }
+
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  static const char padding[DATASET_CACHE_ALIGNMENT] = { 0 };
+  for (uint c = 0; c < NUM_COLUMNS; ++c)
+  {
+    os.write(padding, header.offsets[c] - os.tellp());
+    if (!building_[c].empty())
+      os.write(&building_[c][0], building_[c].size());
+  }
+
+  return os.good();
+}
+
+bool DatasetCache::open(const std::string& filename)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    ROS_ERROR("Couldn't open file \"%s\"", filename.c_str());
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FileHeader))
+  {
+    ROS_ERROR("\"%s\" is not a dataset cache", filename.c_str());
+    ::close(fd);
+    return false;
+  }
+
+  mapSize_ = st.st_size;
+  map_ = mmap(NULL, mapSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+
+  if (map_ == MAP_FAILED)
+  {
+    ROS_ERROR("Couldn't map file \"%s\"", filename.c_str());
+    map_ = NULL;
+    return false;
+  }
+
+  const FileHeader* header = static_cast<const FileHeader*>(map_);
+  if (memcmp(header->magic, DATASET_CACHE_MAGIC, sizeof(header->magic)) ||
+      header->version != DATASET_CACHE_VERSION)
+  {
+    ROS_ERROR("\"%s\" is not a dataset cache of version %d", filename.c_str(),
+              DATASET_CACHE_VERSION);
+    close();
+    return false;
+  }
+
+  nRobots_ = header->nRobots;
+  nLandmarks_ = header->nLandmarks;
+
+  for (uint c = 0; c < NUM_COLUMNS; ++c)
+  {
+    size_t size = header->rows[c] * columnWidth((Column)c) * valueSize((Column)c);
+    if (header->offsets[c] + size > mapSize_)
+    {
+      ROS_ERROR("Dataset cache \"%s\" is truncated", filename.c_str());
+      close();
+      return false;
+    }
+
+    nRows_[c] = header->rows[c];
+    columns_[c] = static_cast<const char*>(map_) + header->offsets[c];
+  }
+
+  building_.assign(NUM_COLUMNS, std::vector<char>());
+
+  // Replay reads the file sequentially
+  madvise(map_, mapSize_, MADV_SEQUENTIAL);
+
+  ROS_INFO("Dataset cache \"%s\" opened with %lu events", filename.c_str(),
+           (unsigned long)numEvents());
+  return true;
+}
+
+ros::Time DatasetCache::time(const size_t e) const
+{
+  ros::Time t;
+  t.fromNSec(get<int64_t>(EVENT_TIME)[e]);
+  return t;
+}
+
+static void fillHeader(const int64_t stamp, const uint32_t seq,
+                       std_msgs::Header& header)
+{
+  header.stamp.fromNSec(stamp);
+  header.seq = seq;
+}
+
+nav_msgs::Odometry::Ptr DatasetCache::odometry(const size_t e) const
+{
+  nav_msgs::Odometry::Ptr msg(new nav_msgs::Odometry);
+  fillHeader(get<int64_t>(EVENT_STAMP)[e], get<uint32_t>(EVENT_SEQ)[e],
+             msg->header);
+
+  readPose(ODOMETRY_POSE,
+           get<uint32_t>(EVENT_ROW)[e] * DATASET_CACHE_POSE_SIZE,
+           msg->pose.pose);
+  return msg;
+}
+
+read_omni_dataset::BallData::Ptr DatasetCache::target(const size_t e) const
+{
+  read_omni_dataset::BallData::Ptr msg(new read_omni_dataset::BallData);
+  fillHeader(get<int64_t>(EVENT_STAMP)[e], get<uint32_t>(EVENT_SEQ)[e],
+             msg->header);
+
+  const uint32_t row = get<uint32_t>(EVENT_ROW)[e];
+  const double* position = get<double>(TARGET_POSITION) + 3 * row;
+
+  msg->found = get<uint8_t>(TARGET_FOUND)[row];
+  msg->x = position[0];
+  msg->y = position[1];
+  msg->z = position[2];
+  msg->mismatchFactor = get<double>(TARGET_MISMATCH)[row];
+  return msg;
+}
+
+read_omni_dataset::LRMLandmarksData::Ptr
+DatasetCache::landmarks(const size_t e) const
+{
+  read_omni_dataset::LRMLandmarksData::Ptr msg(
+      new read_omni_dataset::LRMLandmarksData);
+  fillHeader(get<int64_t>(EVENT_STAMP)[e], get<uint32_t>(EVENT_SEQ)[e],
+             msg->header);
+
+  const size_t first = get<uint32_t>(EVENT_ROW)[e] * nLandmarks_;
+  const size_t last = first + nLandmarks_;
+
+  msg->found.assign(get<uint8_t>(LANDMARKS_FOUND) + first,
+                    get<uint8_t>(LANDMARKS_FOUND) + last);
+  msg->x.assign(get<float>(LANDMARKS_X) + first, get<float>(LANDMARKS_X) + last);
+  msg->y.assign(get<float>(LANDMARKS_Y) + first, get<float>(LANDMARKS_Y) + last);
+  msg->AreaLandMarkActualinPixels.assign(
+      get<float>(LANDMARKS_AREA_ACTUAL) + first,
+      get<float>(LANDMARKS_AREA_ACTUAL) + last);
+  msg->AreaLandMarkExpectedinPixels.assign(
+      get<float>(LANDMARKS_AREA_EXPECTED) + first,
+      get<float>(LANDMARKS_AREA_EXPECTED) + last);
+  return msg;
+}
+
+read_omni_dataset::LRMGTData::Ptr DatasetCache::groundTruth(const size_t e) const
+{
+  read_omni_dataset::LRMGTData::Ptr msg(new read_omni_dataset::LRMGTData);
+  fillHeader(get<int64_t>(EVENT_STAMP)[e], get<uint32_t>(EVENT_SEQ)[e],
+             msg->header);
+
+  const uint32_t row = get<uint32_t>(EVENT_ROW)[e];
+  const size_t first = row * DATASET_CACHE_POSE_SIZE * nRobots_;
+
+#ifdef USE_NEWER_READ_OMNI_PACKAGE
+  msg->poseOMNI.resize(nRobots_);
+  for (uint r = 0; r < nRobots_; ++r)
+    readPose(GT_POSES, first + r * DATASET_CACHE_POSE_SIZE,
+             msg->poseOMNI[r].pose);
+#else
+  if (nRobots_ >= 5)
+  {
+    readPose(GT_POSES, first, msg->poseOMNI1.pose);
+    readPose(GT_POSES, first + 2 * DATASET_CACHE_POSE_SIZE, msg->poseOMNI3.pose);
+    readPose(GT_POSES, first + 3 * DATASET_CACHE_POSE_SIZE, msg->poseOMNI4.pose);
+    readPose(GT_POSES, first + 4 * DATASET_CACHE_POSE_SIZE, msg->poseOMNI5.pose);
+  }
+#endif
+
+  const double* ball = get<double>(GT_BALL_POSITION) + 3 * row;
+  msg->orangeBall3DGTposition.found = get<uint8_t>(GT_BALL_FOUND)[row];
+  msg->orangeBall3DGTposition.x = ball[0];
+  msg->orangeBall3DGTposition.y = ball[1];
+  msg->orangeBall3DGTposition.z = ball[2];
+  return msg;
+}
+
+// end of namespace pfuclt_omni_dataset
+}
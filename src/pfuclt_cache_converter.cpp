@@ -0,0 +1,137 @@
+// Converts the dataset bags to a DatasetCache file, which the node can replay
+// with the DATASET_CACHE parameter
+
+#include <pfuclt_omni_dataset/pfuclt_cache.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+
+// Robots in the dataset, OMNI2 being absent
+#define CONVERTER_NUM_ROBOTS 5
+
+#define CONVERTER_GT_TOPIC "/gtData_4robotExp"
+
+/**
+ * @brief parseTopic - get the robot number, starting at 0, and the topic name
+ * out of a robot topic such as /omni3/odometry
+ * @return false if this isn't a robot topic
+ */
+static bool parseTopic(const std::string& topic, uint& robot, std::string& name)
+{
+  uint number;
+  char buffer[64];
+  if (sscanf(topic.c_str(), "/omni%u/%63s", &number, buffer) != 2 ||
+      number < 1 || number > CONVERTER_NUM_ROBOTS)
+    return false;
+
+  robot = number - 1;
+  name = buffer;
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  using namespace pfuclt_omni_dataset;
+
+  if (argc < 3)
+  {
+    std::cout << "Usage: pfuclt_cache_converter output.cache input1.bag "
+                 "[input2.bag ...]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ros::Time::init();
+
+  std::vector<std::string> topics;
+  topics.push_back(CONVERTER_GT_TOPIC);
+  for (uint r = 1; r <= CONVERTER_NUM_ROBOTS; ++r)
+  {
+    std::string ns("/omni" + boost::lexical_cast<std::string>(r));
+    topics.push_back(ns + "/odometry");
+    topics.push_back(ns + "/orangeball3Dposition");
+    topics.push_back(ns + "/landmarkspositions");
+  }
+
+  std::vector<boost::shared_ptr<rosbag::Bag> > bags;
+  rosbag::View view;
+  try
+  {
+    for (int i = 2; i < argc; ++i)
+    {
+      bags.push_back(boost::shared_ptr<rosbag::Bag>(new rosbag::Bag));
+      bags.back()->open(argv[i], rosbag::bagmode::Read);
+      view.addQuery(*bags.back(), rosbag::TopicQuery(topics));
+    }
+  }
+  catch (rosbag::BagException& e)
+  {
+    ROS_ERROR("Couldn't open bag: %s", e.what());
+    return EXIT_FAILURE;
+  }
+
+  // The landmark columns have the size of the first landmark message
+  uint nLandmarks = 0;
+  BOOST_FOREACH (const rosbag::MessageInstance& m, view)
+  {
+    read_omni_dataset::LRMLandmarksData::ConstPtr msg =
+        m.instantiate<read_omni_dataset::LRMLandmarksData>();
+    if (msg != NULL)
+    {
+      nLandmarks = msg->found.size();
+      break;
+    }
+  }
+
+  DatasetCache cache(CONVERTER_NUM_ROBOTS, nLandmarks);
+
+  // The view merges the bags in time order
+  BOOST_FOREACH (const rosbag::MessageInstance& m, view)
+  {
+    if (m.getTopic() == CONVERTER_GT_TOPIC)
+    {
+      read_omni_dataset::LRMGTData::ConstPtr msg =
+          m.instantiate<read_omni_dataset::LRMGTData>();
+      if (msg != NULL)
+        cache.addGroundTruth(m.getTime(), *msg);
+      continue;
+    }
+
+    uint robot;
+    std::string name;
+    if (!parseTopic(m.getTopic(), robot, name))
+      continue;
+
+    if (name == "odometry")
+    {
+      nav_msgs::Odometry::ConstPtr msg = m.instantiate<nav_msgs::Odometry>();
+      if (msg != NULL)
+        cache.addOdometry(m.getTime(), robot, *msg);
+    }
+    else if (name == "orangeball3Dposition")
+    {
+      read_omni_dataset::BallData::ConstPtr msg =
+          m.instantiate<read_omni_dataset::BallData>();
+      if (msg != NULL)
+        cache.addTarget(m.getTime(), robot, *msg);
+    }
+    else if (name == "landmarkspositions")
+    {
+      read_omni_dataset::LRMLandmarksData::ConstPtr msg =
+          m.instantiate<read_omni_dataset::LRMLandmarksData>();
+      if (msg != NULL)
+        cache.addLandmarks(m.getTime(), robot, *msg);
+    }
+  }
+
+  for (uint i = 0; i < bags.size(); ++i)
+    bags[i]->close();
+
+  if (!cache.write(argv[1]))
+    return EXIT_FAILURE;
+
+  std::cout << "Wrote " << cache.numEvents() << " events with " << nLandmarks
+            << " landmarks to " << argv[1] << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+#include <pfuclt_omni_dataset/pfuclt_ekf.h>
+#include <eigen3/Eigen/Dense>
+#include <angles/angles.h>
+#include <cmath>
+
+namespace pfuclt_omni_dataset
+{
+
+TeamEKF::TeamEKF(const uint nRobots, const uint nStatesPerTarget)
+    : robotMean(nRobots, RobotMean::Zero()),
+      robotCov(nRobots, RobotCov::Identity()),
+      targetMean(Eigen::VectorXd::Zero(nStatesPerTarget)),
+      targetCov(Eigen::MatrixXd::Identity(nStatesPerTarget, nStatesPerTarget)),
+      nStatesPerTarget_(nStatesPerTarget)
+{
+}
+
+void TeamEKF::initRobot(const uint r, const RobotMean& mean,
+                        const RobotCov& cov)
+{
+  robotMean[r] = mean;
+  robotCov[r] = cov;
+}
+
+void TeamEKF::initTarget(const Eigen::VectorXd& mean,
+                         const Eigen::MatrixXd& cov)
+{
+  targetMean = mean;
+  targetCov = cov;
+}
+
+void TeamEKF::predictRobot(const uint r, const double deltaRot,
+                           const double deltaTrans, const double deltaFinalRot,
+                           const std::vector<float>& alpha)
+{
+  RobotMean& mu = robotMean[r];
+  RobotCov& P = robotCov[r];
+
+  const double heading = mu(2) + deltaRot;
+  const double c = cos(heading), s = sin(heading);
+
+  // Jacobian of the motion model w.r.t. the state
+  Eigen::Matrix3d G = Eigen::Matrix3d::Identity();
+  G(0, 2) = -deltaTrans * s;
+  G(1, 2) = deltaTrans * c;
+
+  // Jacobian of the motion model w.r.t. {deltaRot, deltaTrans, deltaFinalRot}
+  Eigen::Matrix3d V;
+  V << -deltaTrans * s, c, 0, deltaTrans * c, s, 0, 1, 0, 1;
+
+  // Same standard deviations as the particle filter's sampling in predict()
+  Eigen::Vector3d stddev(
+      alpha[0] * fabs(deltaRot) + alpha[1] * deltaTrans,
+      alpha[2] * deltaTrans + alpha[3] * fabs(deltaRot + deltaFinalRot),
+      alpha[0] * fabs(deltaFinalRot) + alpha[1] * deltaTrans);
+  Eigen::Matrix3d M = stddev.cwiseProduct(stddev).asDiagonal();
+
+  mu(0) += deltaTrans * c;
+  mu(1) += deltaTrans * s;
+  mu(2) = angles::normalize_angle(heading + deltaFinalRot);
+
+  P = G * P * G.transpose() + V * M * V.transpose();
+}
+
+void TeamEKF::predictTarget(const double dt, const double accelStddev)
+{
+  // Displacement caused by a random acceleration during dt
+  const double q = pow(0.5 * accelStddev * dt * dt, 2);
+
+  targetCov +=
+      q * Eigen::MatrixXd::Identity(nStatesPerTarget_, nStatesPerTarget_);
+}
+
+bool TeamEKF::updateLandmark(const uint r, const double zx, const double zy,
+                             const double covXX, const double covYY,
+                             const double lmx, const double lmy,
+                             const double gate)
+{
+  RobotMean& mu = robotMean[r];
+  RobotCov& P = robotCov[r];
+
+  const double c = cos(mu(2)), s = sin(mu(2));
+  const double dx = lmx - mu(0), dy = lmy - mu(1);
+
+  // Landmark in the robot frame
+  Eigen::Vector2d h(c * dx + s * dy, -s * dx + c * dy);
+
+  Eigen::Matrix<double, 2, 3> H;
+  H << -c, -s, h(1), s, -c, -h(0);
+
+  Eigen::Matrix2d R = Eigen::Vector2d(covXX, covYY).asDiagonal();
+  Eigen::Vector2d innovation = Eigen::Vector2d(zx, zy) - h;
+  Eigen::Matrix2d S = H * P * H.transpose() + R;
+  Eigen::Matrix2d Sinv = S.inverse();
+
+  if (innovation.dot(Sinv * innovation) > gate)
+    return false;
+
+  Eigen::Matrix<double, 3, 2> K = P * H.transpose() * Sinv;
+
+  mu += K * innovation;
+  mu(2) = angles::normalize_angle(mu(2));
+  P = (Eigen::Matrix3d::Identity() - K * H) * P;
+
+  return true;
+}
+
+bool TeamEKF::updateTarget(const uint r, const Eigen::VectorXd& z,
+                           const double covXX, const double covYY,
+                           const double covZZ, const double gate)
+{
+  const RobotMean& rob = robotMean[r];
+  const uint n = nStatesPerTarget_;
+
+  const double c = cos(rob(2)), s = sin(rob(2));
+  const double dx = targetMean(0) - rob(0), dy = targetMean(1) - rob(1);
+
+  // Target in the robot frame
+  Eigen::VectorXd h(n);
+  h(0) = c * dx + s * dy;
+  h(1) = -s * dx + c * dy;
+  if (n > 2)
+    h(2) = targetMean(2);
+
+  // Jacobians w.r.t. the target and the observing robot
+  Eigen::MatrixXd Ht = Eigen::MatrixXd::Identity(n, n);
+  Ht.topLeftCorner(2, 2) << c, s, -s, c;
+
+  Eigen::MatrixXd Hr = Eigen::MatrixXd::Zero(n, 3);
+  Hr.topRows(2) << -c, -s, h(1), s, -c, -h(0);
+
+  Eigen::MatrixXd R = Eigen::MatrixXd::Zero(n, n);
+  R(0, 0) = covXX;
+  R(1, 1) = covYY;
+  if (n > 2)
+    R(2, 2) = covZZ;
+
+  Eigen::VectorXd innovation = z.head(n) - h;
+  Eigen::MatrixXd S = Ht * targetCov * Ht.transpose() +
+                      Hr * robotCov[r] * Hr.transpose() + R;
+  Eigen::MatrixXd Sinv = S.inverse();
+
+  if (innovation.dot(Sinv * innovation) > gate)
+    return false;
+
+  Eigen::MatrixXd K = targetCov * Ht.transpose() * Sinv;
+
+  targetMean += K * innovation;
+  targetCov = (Eigen::MatrixXd::Identity(n, n) - K * Ht) * targetCov;
+
+  return true;
+}
+
+double TeamEKF::robotSpread(const uint r) const
+{
+  const RobotCov& P = robotCov[r];
+  return sqrt(P(0, 0)) + sqrt(P(1, 1)) + sqrt(P(2, 2));
+}
+
+// end of namespace pfuclt_omni_dataset
+}
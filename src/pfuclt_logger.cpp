@@ -0,0 +1,184 @@
+#include <pfuclt_omni_dataset/pfuclt_logger.h>
+#include <boost/format.hpp>
+#include <sstream>
+
+namespace pfuclt_omni_dataset
+{
+
+/**
+ * @brief The FormatFeeder struct - feeds a LogArgs value to boost::format with
+ * its own type, so that specifiers such as %d and %.2f apply correctly
+ */
+struct FormatFeeder : public boost::static_visitor<>
+{
+  boost::format& fmt;
+
+  FormatFeeder(boost::format& fmt) : fmt(fmt) {}
+
+  template <typename T> void operator()(const T& value) const { fmt % value; }
+};
+
+AsyncLogger::AsyncLogger(const double period)
+    : period_(period), dropped_(0), lastSummary_(ros::WallTime::now()),
+      stop_(false)
+{
+  thread_ = boost::thread(boost::bind(&AsyncLogger::run, this));
+}
+
+AsyncLogger::~AsyncLogger()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+
+  condition_.notify_one();
+  thread_.join();
+}
+
+void AsyncLogger::log(const ros::console::levels::Level level,
+                      const char* format, const LogArgs& args,
+                      const int instance)
+{
+  ros::WallTime now = ros::WallTime::now();
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Site& site = sites_[SiteKey(format, instance)];
+  if (period_ > 0 && !site.last.isZero() &&
+      (now - site.last).toSec() < period_)
+  {
+    ++site.suppressed;
+    return;
+  }
+
+  if (queue_.size() >= LOGGER_MAX_QUEUE)
+  {
+    ++dropped_;
+    return;
+  }
+
+  site.last = now;
+
+  Record record;
+  record.level = level;
+  record.format = format;
+  record.args = args;
+
+  if (site.suppressed > 0)
+  {
+    std::ostringstream oss;
+    oss << " (" << site.suppressed << " similar messages suppressed)";
+    record.suffix = oss.str();
+    site.suppressed = 0;
+  }
+
+  queue_.push_back(record);
+  condition_.notify_one();
+}
+
+void AsyncLogger::tally(const ros::console::levels::Level level,
+                        const char* format, const bool happened,
+                        const LogArgs& args, const int instance)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Site& site = tallies_[SiteKey(format, instance)];
+  ++site.total;
+
+  if (!happened)
+    return;
+
+  ++site.hits;
+  site.latest.level = level;
+  site.latest.format = format;
+  site.latest.args = args;
+}
+
+void AsyncLogger::setPeriod(const double period)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  period_ = period;
+}
+
+void AsyncLogger::queueSummaries()
+{
+  for (std::map<SiteKey, Site>::iterator it = tallies_.begin();
+       it != tallies_.end(); ++it)
+  {
+    Site& site = it->second;
+
+    if (site.hits > 0)
+    {
+      std::ostringstream oss;
+      oss << " in " << site.hits << " of the last " << site.total
+          << " iterations";
+
+      Record record = site.latest;
+      record.suffix = oss.str();
+      queue_.push_back(record);
+    }
+
+    site.hits = site.total = 0;
+  }
+
+  if (dropped_ > 0)
+  {
+    Record record;
+    record.level = ros::console::levels::Warn;
+    record.format = "Logger queue full, %d messages were dropped";
+    record.args << dropped_;
+    queue_.push_back(record);
+    dropped_ = 0;
+  }
+}
+
+void AsyncLogger::run()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (true)
+  {
+    if (!stop_)
+      condition_.timed_wait(lock,
+                            boost::posix_time::milliseconds(LOGGER_POLL_MS));
+
+    ros::WallTime now = ros::WallTime::now();
+    if (stop_ || (now - lastSummary_).toSec() >= period_)
+    {
+      queueSummaries();
+      lastSummary_ = now;
+    }
+
+    // Format and send without holding the lock, so the filter never waits
+    std::deque<Record> records;
+    records.swap(queue_);
+    bool stopping = stop_;
+
+    lock.unlock();
+    for (std::deque<Record>::const_iterator it = records.begin();
+         it != records.end(); ++it)
+      emit(*it);
+    lock.lock();
+
+    if (stopping)
+      break;
+  }
+}
+
+void AsyncLogger::emit(const Record& record)
+{
+  boost::format fmt(record.format);
+
+  // A wrong number of arguments shouldn't take the logging thread down
+  fmt.exceptions(boost::io::no_error_bits);
+
+  const std::vector<LogArgs::Value>& values = record.args.values();
+  for (uint i = 0; i < values.size(); ++i)
+    boost::apply_visitor(FormatFeeder(fmt), values[i]);
+
+  std::string message = fmt.str() + record.suffix;
+  ROS_LOG(record.level, ROSCONSOLE_DEFAULT_NAME, "%s", message.c_str());
+}
+
+// end of namespace pfuclt_omni_dataset
+}
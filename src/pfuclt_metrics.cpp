@@ -0,0 +1,338 @@
+#include <pfuclt_omni_dataset/pfuclt_metrics.h>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+// Time between checks of the stop flag while waiting for connections
+#define METRICS_SERVER_POLL_MS 200
+
+// Longest wait for a client's request, and for each send of the response
+#define METRICS_CLIENT_TIMEOUT_MS 2000
+
+namespace pfuclt_omni_dataset
+{
+
+MetricsRegistry::MetricsRegistry(const uint window)
+    : window_(window > 0 ? window : 1)
+{
+}
+
+void MetricsRegistry::describe(const std::string& name, const Type type,
+                               const std::string& help)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Family& family = families_[name];
+  family.type = type;
+  family.help = help;
+}
+
+void MetricsRegistry::increment(const std::string& name,
+                                const std::string& labels, const double delta)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  families_[name].series[labels].value += delta;
+}
+
+void MetricsRegistry::set(const std::string& name, const std::string& labels,
+                          const double value)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  families_[name].series[labels].value = value;
+}
+
+void MetricsRegistry::observe(const std::string& name,
+                              const std::string& labels, const double value)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Series& series = families_[name].series[labels];
+  series.sum += value;
+  ++series.count;
+
+  series.window.push_back(value);
+  if (series.window.size() > window_)
+    series.window.pop_front();
+}
+
+std::string MetricsRegistry::label(const std::string& key,
+                                   const std::string& value)
+{
+  return key + "=\"" + value + "\"";
+}
+
+std::string MetricsRegistry::label(const std::string& key, const int value)
+{
+  std::ostringstream oss;
+  oss << value;
+  return label(key, oss.str());
+}
+
+double MetricsRegistry::quantile(std::vector<double>& sorted, const double q)
+{
+  if (sorted.empty())
+    return 0.0;
+
+  return sorted[std::min((size_t)(q * sorted.size()), sorted.size() - 1)];
+}
+
+std::string MetricsRegistry::seriesName(const std::string& name,
+                                        const std::string& labels,
+                                        const std::string& extraLabel)
+{
+  std::string all = labels;
+  if (!extraLabel.empty())
+    all += (all.empty() ? "" : ",") + extraLabel;
+
+  return all.empty() ? name : name + "{" + all + "}";
+}
+
+std::string MetricsRegistry::prometheusText() const
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99 };
+  static const char* typeNames[] = { "counter", "gauge", "summary" };
+
+  boost::mutex::scoped_lock lock(mutex_);
+  std::ostringstream oss;
+
+  for (std::map<std::string, Family>::const_iterator f = families_.begin();
+       f != families_.end(); ++f)
+  {
+    oss << "# HELP " << f->first << " " << f->second.help << "\n";
+    oss << "# TYPE " << f->first << " " << typeNames[f->second.type] << "\n";
+
+    for (std::map<std::string, Series>::const_iterator s =
+             f->second.series.begin();
+         s != f->second.series.end(); ++s)
+    {
+      if (f->second.type != SUMMARY)
+      {
+        oss << seriesName(f->first, s->first) << " " << s->second.value
+            << "\n";
+        continue;
+      }
+
+      std::vector<double> sorted(s->second.window.begin(),
+                                 s->second.window.end());
+      std::sort(sorted.begin(), sorted.end());
+
+      for (uint q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+      {
+        std::ostringstream quantileLabel;
+        quantileLabel << "quantile=\"" << quantiles[q] << "\"";
+        oss << seriesName(f->first, s->first, quantileLabel.str()) << " "
+            << quantile(sorted, quantiles[q]) << "\n";
+      }
+
+      oss << seriesName(f->first + "_sum", s->first) << " " << s->second.sum
+          << "\n";
+      oss << seriesName(f->first + "_count", s->first) << " "
+          << s->second.count << "\n";
+    }
+  }
+
+  return oss.str();
+}
+
+void MetricsRegistry::fillDiagnostics(
+    diagnostic_msgs::DiagnosticStatus& status) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (std::map<std::string, Family>::const_iterator f = families_.begin();
+       f != families_.end(); ++f)
+  {
+    for (std::map<std::string, Series>::const_iterator s =
+             f->second.series.begin();
+         s != f->second.series.end(); ++s)
+    {
+      diagnostic_msgs::KeyValue kv;
+      kv.key = seriesName(f->first, s->first);
+
+      std::ostringstream oss;
+      if (f->second.type == SUMMARY)
+      {
+        std::vector<double> sorted(s->second.window.begin(),
+                                   s->second.window.end());
+        std::sort(sorted.begin(), sorted.end());
+        oss << "p50=" << quantile(sorted, 0.5)
+            << " p90=" << quantile(sorted, 0.9)
+            << " p99=" << quantile(sorted, 0.99)
+            << " count=" << s->second.count;
+      }
+      else
+        oss << s->second.value;
+
+      kv.value = oss.str();
+      status.values.push_back(kv);
+    }
+  }
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry& registry, const int port)
+    : registry_(registry), socket_(-1), stop_(false)
+{
+  socket_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (socket_ < 0)
+  {
+    ROS_ERROR("Metrics server: couldn't create socket");
+    return;
+  }
+
+  int reuse = 1;
+  setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  // Only local scrapers are served
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  if (bind(socket_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(socket_, 4) < 0)
+  {
+    ROS_ERROR("Metrics server: couldn't listen on 127.0.0.1:%d", port);
+    close(socket_);
+    socket_ = -1;
+    return;
+  }
+
+  thread_ = boost::thread(boost::bind(&MetricsServer::serve, this));
+  ROS_INFO("Metrics served at http://127.0.0.1:%d/metrics", port);
+}
+
+MetricsServer::~MetricsServer()
+{
+  stop_ = true;
+  thread_.join();
+
+  if (socket_ >= 0)
+    close(socket_);
+}
+
+void MetricsServer::serve()
+{
+  while (!stop_)
+  {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(socket_, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = METRICS_SERVER_POLL_MS * 1000;
+
+    if (select(socket_ + 1, &fds, NULL, NULL, &timeout) <= 0)
+      continue;
+
+    int client = accept(socket_, NULL, NULL);
+    if (client < 0)
+      continue;
+
+    handle(client);
+    close(client);
+  }
+}
+
+void MetricsServer::handle(const int client)
+{
+  // A client that never sends its request, or never reads the response,
+  // must not hold the server thread, which also has to notice stop_
+  struct timeval sendTimeout;
+  sendTimeout.tv_sec = METRICS_CLIENT_TIMEOUT_MS / 1000;
+  sendTimeout.tv_usec = (METRICS_CLIENT_TIMEOUT_MS % 1000) * 1000;
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout,
+             sizeof(sendTimeout));
+
+  bool ready = false;
+  for (int waited = 0; !stop_ && !ready && waited < METRICS_CLIENT_TIMEOUT_MS;
+       waited += METRICS_SERVER_POLL_MS)
+  {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(client, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = METRICS_SERVER_POLL_MS * 1000;
+
+    ready = select(client + 1, &fds, NULL, NULL, &timeout) > 0;
+  }
+
+  // The request itself doesn't matter, every path returns the metrics
+  char request[1024];
+  if (!ready || recv(client, request, sizeof(request), MSG_DONTWAIT) <= 0)
+    return;
+
+  std::string body = registry_.prometheusText();
+  std::ostringstream response;
+  response << "HTTP/1.0 200 OK\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n"
+           << body;
+
+  std::string str = response.str();
+  size_t sent = 0;
+  while (sent < str.size() && !stop_)
+  {
+    ssize_t n = send(client, str.data() + sent, str.size() - sent, 0);
+    if (n <= 0)
+      break;
+    sent += n;
+  }
+}
+
+MessageGapTracker::MessageGapTracker()
+    : started_(false), lastSeq_(0), period_(0.0)
+{
+}
+
+int MessageGapTracker::update(const uint32_t seq, const ros::Time& stamp)
+{
+  if (!started_)
+  {
+    started_ = true;
+    lastSeq_ = seq;
+    lastStamp_ = stamp;
+    return 0;
+  }
+
+  int missing = 0;
+
+  // Sequence numbers are used if the publisher fills them
+  if (seq != 0 || lastSeq_ != 0)
+  {
+    if (seq <= lastSeq_)
+      return -1;
+
+    missing = (int)(seq - lastSeq_ - 1);
+  }
+
+  double dt = (stamp - lastStamp_).toSec();
+  if (dt < 0)
+    return -1;
+
+  if (seq == 0 && lastSeq_ == 0 && period_ > 0 &&
+      dt > GAP_TRACKER_PERIOD_FACTOR * period_)
+    missing = (int)(dt / period_ + 0.5) - 1;
+
+  // Only intervals without missing messages tell the usual period
+  if (missing == 0 && dt > 0)
+    period_ = period_ > 0 ? (1 - GAP_TRACKER_PERIOD_ALPHA) * period_ +
+                                GAP_TRACKER_PERIOD_ALPHA * dt
+                          : dt;
+
+  lastSeq_ = seq;
+  lastStamp_ = stamp;
+  return missing;
+}
+
+// end of namespace pfuclt_omni_dataset
+}
@@ -10,6 +10,7 @@ namespace pfuclt_omni_dataset
 int MY_ID;
 int MAX_ROBOTS;
 int NUM_TARGETS;
+int STATES_PER_TARGET = STATES_PER_TARGET_3D; // Set to 2 via the parameter server for targets on the ground plane
 int NUM_LANDMARKS;
 std::vector<bool> PLAYING_ROBOTS;
 float K1, K2; // coefficients for landmark observation covariance
@@ -19,6 +20,15 @@ std::vector<double> POS_INIT;
 
 bool USE_CUSTOM_VALUES = false; // If set to true via the parameter server, the custom values will be used
 std::vector<double> CUSTOM_PARTICLE_INIT; // Used to set custom values when initiating the particle filter set (will still be a uniform distribution)
+bool INCREMENTAL_INIT = true; // If set to false via the parameter server, the particle filter only starts when every playing robot has reported
+bool INIT_FROM_LANDMARKS = false; // If set to true via the parameter server, robot particles are seeded by triangulating the first landmarks seen
+
+// Subscriber queue sizes - when full, the oldest message is dropped, and 0 means unbounded
+int ODOMETRY_QUEUE_SIZE = 0; // lossless, every odometry message is integrated in predict
+int TARGET_QUEUE_SIZE = 10;
+int LANDMARKS_QUEUE_SIZE = 1; // latest-only, older landmark observations are overwritten anyway
+
+std::string DATASET_CACHE; // If set via the parameter server, this dataset cache is replayed instead of subscribing to the bags
 
 bool DEBUG;
 bool PUBLISH;
@@ -32,8 +42,8 @@ ros::Time timeInit;
 RobotFactory::RobotFactory(ros::NodeHandle& nh) : nh_(nh)
 {
   ParticleFilter::PFinitData initData(nh, MY_ID, NUM_TARGETS, STATES_PER_ROBOT,
-                                      MAX_ROBOTS, NUM_LANDMARKS, PLAYING_ROBOTS,
-                                      landmarks);
+                                      STATES_PER_TARGET, MAX_ROBOTS,
+                                      NUM_LANDMARKS, PLAYING_ROBOTS, landmarks);
 
   if (PUBLISH)
     pf = boost::shared_ptr<PFPublisher>(
@@ -46,7 +56,9 @@ RobotFactory::RobotFactory(ros::NodeHandle& nh) : nh_(nh)
 
   for (int rn = 0; rn < MAX_ROBOTS; rn++)
   {
-    if (PLAYING_ROBOTS[rn])
+    // In decentralized mode, the teammates' topics are left to their own
+    // filters, which send their beliefs instead
+    if (PLAYING_ROBOTS[rn] && (!pf->isDecentralized() || rn + 1 == MY_ID))
     {
       robots_.push_back(
           Robot_ptr(new Robot(nh_, this, pf->getPFReference(), rn)));
@@ -54,12 +66,77 @@ RobotFactory::RobotFactory(ros::NodeHandle& nh) : nh_(nh)
   }
 }
 
-void RobotFactory::tryInitializeParticles()
+void RobotFactory::replayCache(const DatasetCache& cache)
 {
+  std::vector<Robot*> robotsByNumber(MAX_ROBOTS, (Robot*)NULL);
+  for (uint i = 0; i < robots_.size(); ++i)
+    robotsByNumber[robots_[i]->getRobotNumber()] = robots_[i].get();
+
+  boost::shared_ptr<PFPublisher> publisher =
+      boost::dynamic_pointer_cast<PFPublisher>(pf);
+
+  ros::WallTime start = ros::WallTime::now();
+
+  for (size_t e = 0; e < cache.numEvents() && ros::ok(); ++e)
+  {
+    ros::Time::setNow(cache.time(e));
+
+    if (cache.type(e) == DatasetCache::GROUND_TRUTH)
+    {
+      if (publisher)
+        publisher->gtDataCallback(cache.groundTruth(e));
+    }
+    else if (cache.robot(e) < robotsByNumber.size() &&
+             robotsByNumber[cache.robot(e)] != NULL)
+    {
+      Robot* robot = robotsByNumber[cache.robot(e)];
+
+      switch (cache.type(e))
+      {
+      case DatasetCache::ODOMETRY:
+        robot->odometryCallback(cache.odometry(e));
+        break;
+      case DatasetCache::TARGET:
+        robot->targetCallback(cache.target(e));
+        break;
+      case DatasetCache::LANDMARKS:
+        robot->landmarkDataCallback(cache.landmarks(e));
+        break;
+      default:
+        break;
+      }
+    }
+
+    // Serve dynamic reconfigure and the other callbacks now and then
+    if (e % REPLAY_SPIN_EVENTS == 0)
+      ros::spinOnce();
+  }
+
+  ROS_INFO("Replayed %lu events in %f seconds",
+           (unsigned long)cache.numEvents(),
+           (ros::WallTime::now() - start).toSec());
+}
+
+void RobotFactory::tryInitializeParticles(const uint robotNumber)
+{
+  // Each robot joins the filter as soon as it reports
+  if (INCREMENTAL_INIT)
+  {
+    pf->initRobot(robotNumber, CUSTOM_PARTICLE_INIT, POS_INIT);
+
+    if (INIT_FROM_LANDMARKS)
+      pf->initFromLandmarks(robotNumber);
+
+    return;
+  }
+
   if (!areAllRobotsActive())
     return;
 
   pf->init(CUSTOM_PARTICLE_INIT, POS_INIT);
+
+  if (INIT_FROM_LANDMARKS)
+    pf->initFromLandmarks();
 }
 
 void RobotFactory::initializeFixedLandmarks()
@@ -108,36 +185,90 @@ void Robot::startNow()
            ROS_TDIFF(timeStarted_));
 }
 
+std::string Robot::messageLabels(const ParticleFilter::Sensor type)
+{
+  return MetricsRegistry::label("robot", robotNumber_ + 1) + "," +
+         MetricsRegistry::label("type", ParticleFilter::sensorName(type));
+}
+
+void Robot::recordMessage(const ParticleFilter::Sensor type,
+                          const std_msgs::Header& header)
+{
+  MetricsRegistry& metrics = pf_->getMetrics();
+  std::string labels = messageLabels(type);
+  const ros::Time& stamp = header.stamp;
+
+  pf_->recordReceipt(robotNumber_, type, stamp);
+  metrics.increment("pfuclt_messages_total", labels);
+
+  int missing = gapTrackers_[type].update(header.seq, stamp);
+  if (missing > 0)
+  {
+    metrics.increment("pfuclt_dropped_messages_total", labels, missing);
+    ROS_DEBUG("OMNI%d missed %d %s message(s)", robotNumber_ + 1, missing,
+              ParticleFilter::sensorName(type));
+  }
+  else if (missing < 0)
+    metrics.increment("pfuclt_out_of_order_messages_total", labels);
+
+  metrics.observe("pfuclt_message_age_seconds", labels,
+                  (ros::Time::now() - stamp).toSec());
+
+  // Arrived after an iteration that already used newer observations
+  if (stamp < pf_->getLastIterationStamp())
+    metrics.increment("pfuclt_late_messages_total", labels);
+}
+
+void Robot::recordCallback(const ParticleFilter::Sensor type,
+                           const ros::WallTime& start)
+{
+  pf_->getMetrics().observe("pfuclt_callback_seconds", messageLabels(type),
+                            (ros::WallTime::now() - start).toNSec() * 1e-9);
+}
+
 Robot::Robot(ros::NodeHandle& nh, RobotFactory* parent, ParticleFilter* pf,
              uint robotNumber)
-    : parent_(parent), pf_(pf), started_(false), robotNumber_(robotNumber)
+    : parent_(parent), pf_(pf), started_(false), robotNumber_(robotNumber),
+      gapTrackers_(ParticleFilter::NUM_SENSORS)
 {
   std::string robotNamespace("/omni" +
                              boost::lexical_cast<std::string>(robotNumber + 1));
 
   // Subscribe to topics
   sOdom_ = nh.subscribe<nav_msgs::Odometry>(
-      robotNamespace + "/odometry", 10,
+      robotNamespace + "/odometry", ODOMETRY_QUEUE_SIZE,
       boost::bind(&Robot::odometryCallback, this, _1));
 
   sBall_ = nh.subscribe<read_omni_dataset::BallData>(
-      robotNamespace + "/orangeball3Dposition", 10,
+      robotNamespace + "/orangeball3Dposition", TARGET_QUEUE_SIZE,
       boost::bind(&Robot::targetCallback, this, _1));
 
   sLandmark_ = nh.subscribe<read_omni_dataset::LRMLandmarksData>(
-      robotNamespace + "/landmarkspositions", 10,
+      robotNamespace + "/landmarkspositions", LANDMARKS_QUEUE_SIZE,
       boost::bind(&Robot::landmarkDataCallback, this, _1));
 
+  MetricsRegistry& metrics = pf_->getMetrics();
+  metrics.set("pfuclt_subscriber_queue_size", messageLabels(ParticleFilter::ODOMETRY),
+              ODOMETRY_QUEUE_SIZE);
+  metrics.set("pfuclt_subscriber_queue_size", messageLabels(ParticleFilter::TARGET),
+              TARGET_QUEUE_SIZE);
+  metrics.set("pfuclt_subscriber_queue_size", messageLabels(ParticleFilter::LANDMARKS),
+              LANDMARKS_QUEUE_SIZE);
+
   ROS_INFO("Created robot OMNI%d", robotNumber + 1);
 }
 
 void Robot::odometryCallback(const nav_msgs::Odometry::ConstPtr& odometry)
 {
+  ros::WallTime start = ros::WallTime::now();
+
   if (!started_)
     startNow();
 
-  if (!pf_->isInitialized())
-    parent_->tryInitializeParticles();
+  recordMessage(ParticleFilter::ODOMETRY, odometry->header);
+
+  if (!pf_->isInitialized(robotNumber_))
+    parent_->tryInitializeParticles(robotNumber_);
 
   Odometry odomStruct;
   odomStruct.x = odometry->pose.pose.position.x;
@@ -150,13 +281,19 @@ void Robot::odometryCallback(const nav_msgs::Odometry::ConstPtr& odometry)
 
   // Call the particle filter predict step for this robot
   pf_->predict(robotNumber_, odomStruct, odometry->header.stamp);
+
+  recordCallback(ParticleFilter::ODOMETRY, start);
 }
 
 void Robot::targetCallback(const read_omni_dataset::BallData::ConstPtr& target)
 {
+  ros::WallTime start = ros::WallTime::now();
+
   if (!started_)
     startNow();
 
+  recordMessage(ParticleFilter::TARGET, target->header);
+
   // If needed, modify here to if(true) to go over the target occlusion from the dataset
   if (target->found)
   {
@@ -214,6 +351,8 @@ void Robot::targetCallback(const read_omni_dataset::BallData::ConstPtr& target)
   // If this is the "self robot", update the iteration time
   if (MY_ID == (int)robotNumber_ + 1)
     pf_->updateTargetIterationTime(target->header.stamp);
+
+  recordCallback(ParticleFilter::TARGET, start);
 }
 
 void Robot::landmarkDataCallback(
@@ -222,6 +361,9 @@ void Robot::landmarkDataCallback(
   //  ROS_DEBUG("OMNI%d landmark data at time %d", robotNumber_ + 1,
   //            landmarkData->header.stamp.sec);
 
+  ros::WallTime start = ros::WallTime::now();
+  recordMessage(ParticleFilter::LANDMARKS, landmarkData->header);
+
   bool heuristicsFound[NUM_LANDMARKS];
   for (int i = 0; i < NUM_LANDMARKS; i++)
     heuristicsFound[i] = landmarkData->found[i];
@@ -342,6 +484,8 @@ void Robot::landmarkDataCallback(
   }
 
   pf_->saveAllLandmarkMeasurementsDone(robotNumber_);
+
+  recordCallback(ParticleFilter::LANDMARKS, start);
 }
 
 // end of namespace pfuclt_omni_dataset
@@ -393,6 +537,14 @@ int main(int argc, char* argv[])
   readParam<int>(nh, "MAX_ROBOTS", MAX_ROBOTS);
   readParam<float>(nh, "ROB_HT", ROB_HT);
   readParam<int>(nh, "NUM_TARGETS", NUM_TARGETS);
+  readParam<int>(nh, "STATES_PER_TARGET", STATES_PER_TARGET);
+  if (STATES_PER_TARGET != STATES_PER_TARGET_3D &&
+      STATES_PER_TARGET != STATES_PER_TARGET_2D)
+  {
+    ROS_ERROR("STATES_PER_TARGET should be %d or %d, using %d",
+              STATES_PER_TARGET_3D, STATES_PER_TARGET_2D, STATES_PER_TARGET_3D);
+    STATES_PER_TARGET = STATES_PER_TARGET_3D;
+  }
   readParam<int>(nh, "NUM_LANDMARKS", NUM_LANDMARKS);
   readParam<float>(nh, "LANDMARK_COV/K1", K1);
   readParam<float>(nh, "LANDMARK_COV/K2", K2);
@@ -402,7 +554,13 @@ int main(int argc, char* argv[])
   readParam<bool>(nh, "PLAYING_ROBOTS", PLAYING_ROBOTS);
   readParam<double>(nh, "POS_INIT", POS_INIT);
   readParam<bool>(nh, "USE_CUSTOM_VALUES", USE_CUSTOM_VALUES);
+  readParam<bool>(nh, "INCREMENTAL_INIT", INCREMENTAL_INIT);
+  readParam<bool>(nh, "INIT_FROM_LANDMARKS", INIT_FROM_LANDMARKS);
+  readParam<int>(nh, "ODOMETRY_QUEUE_SIZE", ODOMETRY_QUEUE_SIZE);
+  readParam<int>(nh, "TARGET_QUEUE_SIZE", TARGET_QUEUE_SIZE);
+  readParam<int>(nh, "LANDMARKS_QUEUE_SIZE", LANDMARKS_QUEUE_SIZE);
   readParam<int>(nh, "MY_ID", MY_ID);
+  readParam<std::string>(nh, "DATASET_CACHE", DATASET_CACHE);
 
   uint total_size = (uint)MAX_ROBOTS * STATES_PER_ROBOT + NUM_TARGETS * STATES_PER_TARGET;
 
@@ -414,9 +572,21 @@ int main(int argc, char* argv[])
               total_size * 2, (int)CUSTOM_PARTICLE_INIT.size());
   }
 
-  ROS_INFO("Waiting for /clock");
-  ros::Time::waitForValid();
-  ROS_INFO("/clock message received");
+  DatasetCache cache;
+  if (!DATASET_CACHE.empty())
+  {
+    if (!cache.open(DATASET_CACHE) || cache.numEvents() == 0)
+      return EXIT_FAILURE;
+
+    // The cache provides the time instead of /clock
+    ros::Time::setNow(cache.time(0));
+  }
+  else
+  {
+    ROS_INFO("Waiting for /clock");
+    ros::Time::waitForValid();
+    ROS_INFO("/clock message received");
+  }
 
   pfuclt_omni_dataset::RobotFactory Factory(nh);
 
@@ -428,6 +598,12 @@ int main(int argc, char* argv[])
 
   Factory.initializeFixedLandmarks();
 
+  if (!DATASET_CACHE.empty())
+  {
+    Factory.replayCache(cache);
+    return EXIT_SUCCESS;
+  }
+
   ros::spin();
   return EXIT_SUCCESS;
 }
@@ -1,6 +1,9 @@
 #include <pfuclt_omni_dataset/pfuclt_particles.h>
 #include <boost/foreach.hpp>
 #include <angles/angles.h>
+#include <eigen3/Eigen/Cholesky>
+#include <fstream>
+#include <unistd.h>
 
 //#define RECONFIGURE_ALPHAS true
 
@@ -8,13 +11,29 @@ namespace pfuclt_omni_dataset
 {
 
 ParticleFilter::ParticleFilter(struct PFinitData& data)
-    : dynamicVariables_(data.nh, data.nRobots),
-      nh_(data.nh), nParticles_((uint)dynamicVariables_.nParticles), mainRobotID_(data.mainRobotID - 1),
-      nTargets_(data.nTargets), nStatesPerRobot_(data.statesPerRobot), nRobots_(data.nRobots),
-      nSubParticleSets_(data.nTargets * STATES_PER_TARGET + data.nRobots * data.statesPerRobot + 1),
+    : dynamicVariables_(data.parameters
+                            ? *data.parameters
+                            : dynamicVariables_s(*data.nh, data.nRobots)),
+      nh_(data.nh),
+      nParticles_(particlesWithinBudget(
+          dynamicVariables_.nParticles,
+          bytesPerParticle(data.nTargets * data.statesPerTarget +
+                               data.nRobots * data.statesPerRobot + 1,
+                           data.nRobots),
+          dynamicVariables_.memoryBudgetMB)),
+      mainRobotID_(data.mainRobotID - 1),
+      nTargets_(data.nTargets), nStatesPerRobot_(data.statesPerRobot),
+      nStatesPerTarget_(data.statesPerTarget), nRobots_(data.nRobots),
+      nSubParticleSets_(data.nTargets * data.statesPerTarget + data.nRobots * data.statesPerRobot + 1),
       nLandmarks_(data.nLandmarks),
       particles_(nSubParticleSets_, subparticles_t(nParticles_)),
       weightComponents_(data.nRobots, subparticles_t(nParticles_, 0.0)),
+      auxWeights_(data.nRobots, subparticles_t(nParticles_, 1.0)),
+      robotBlockWeights_(data.nRobots, subparticles_t(nParticles_, 1.0)),
+      targetProposalWeights_(nParticles_, 1.0),
+      landmarkInitPending_(data.nRobots, false),
+      robotParticles_(data.nRobots, nParticles_),
+      robotLikelihood_(data.nRobots),
       seed_(time(0)), initialized_(false),
       landmarksMap_(data.landmarksMap),
       robotsUsed_(data.robotsUsed),
@@ -22,7 +41,16 @@ ParticleFilter::ParticleFilter(struct PFinitData& data)
       bufTargetObservations_(data.nRobots),
       durationSum(ros::WallDuration(0)),
       numberIterations(0),
-      state_(data.statesPerRobot, data.nRobots),
+      state_(data.statesPerRobot, data.statesPerTarget, data.nRobots),
+      ekf_(data.nRobots, data.statesPerTarget), ekfActive_(false),
+      convergedIterations_(0),
+      tuner_(dynamicVariables_.autotune,
+             (uint)dynamicVariables_.autotuneSamples,
+             (uint)dynamicVariables_.autotuneRetunePeriod,
+             dynamicVariables_.autotuneExportFile),
+      logger_(dynamicVariables_.logPeriod),
+      teammateBeliefs_(data.nRobots), newBeliefs_(data.nRobots, false),
+      beliefSequence_(0),
       iteration_oss(new std::ostringstream("")),
       O_TARGET(data.nRobots * data.statesPerRobot),
       O_WEIGHT(nSubParticleSets_ - 1)
@@ -30,11 +58,59 @@ ParticleFilter::ParticleFilter(struct PFinitData& data)
   ROS_INFO("Created particle filter with dimensions %d, %d",
            (int)particles_.size(), (int)particles_[0].size());
 
-  // Bind dynamic reconfigure callback
-  dynamic_reconfigure::Server<DynamicConfig>::CallbackType
-      callback;
-  callback = boost::bind(&ParticleFilter::dynamicReconfigureCallback, this, _1);
-  dynamicServer_.setCallback(callback);
+  // The number of particles may have been reduced to fit the memory budget
+  dynamicVariables_.nParticles = nParticles_;
+  logMemoryFootprint();
+
+  // One latency chain per robot and sensor
+  latencies_.assign(nRobots_, std::vector<ObservationLatency>(NUM_SENSORS));
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    for (uint s = 0; s < NUM_SENSORS; ++s)
+    {
+      latencies_[r][s].robot = r;
+      latencies_[r][s].sensor = (Sensor)s;
+    }
+  }
+
+  initMetrics();
+
+  // Sharded mode - this process holds a part of the particles
+  if (dynamicVariables_.shardCount > 1)
+  {
+    // Shards started at the same time would otherwise draw the same particles
+    seed_.seed(time(0) + 7919 * dynamicVariables_.shardIndex);
+
+    shards_.reset(new ShardLink(dynamicVariables_.shardIndex,
+                                dynamicVariables_.shardCount,
+                                dynamicVariables_.shardAddress,
+                                dynamicVariables_.shardTimeout,
+                                dynamicVariables_.shardExchangeParticles));
+  }
+
+  // Decentralized mode - the teammates join from their belief summaries
+  if (dynamicVariables_.beliefExchange)
+  {
+    for (uint r = 0; r < nRobots_; ++r)
+      robotsUsed_[r] = robotsUsed_[r] && r == mainRobotID_;
+
+    beliefs_.reset(new BeliefExchange(dynamicVariables_.beliefAddress,
+                                      dynamicVariables_.beliefPeers));
+  }
+
+  // Prepare the kernel variants for this number of particles
+  tuner_.reset(nParticles_);
+
+  // Bind dynamic reconfigure callback, only when running with ROS
+  if (nh_)
+  {
+    dynamicServer_.reset(new dynamic_reconfigure::Server<DynamicConfig>());
+
+    dynamic_reconfigure::Server<DynamicConfig>::CallbackType callback;
+    callback =
+        boost::bind(&ParticleFilter::dynamicReconfigureCallback, this, _1);
+    dynamicServer_->setCallback(callback);
+  }
 }
 
 void ParticleFilter::dynamicReconfigureCallback(DynamicConfig& config)
@@ -62,22 +138,61 @@ void ParticleFilter::dynamicReconfigureCallback(DynamicConfig& config)
            config.groups.alphas.OMNI4_alpha.c_str(),
            config.groups.alphas.OMNI5_alpha.c_str());
 
+  // Keep the requested number of particles within the memory budget, which
+  // in sharded mode applies to this shard's part
+  int particles = particlesWithinBudget(
+      dynamicVariables_.shardParticles(config.particles),
+      bytesPerParticle(nSubParticleSets_, nRobots_),
+      dynamicVariables_.memoryBudgetMB);
+  if (!shards_)
+    config.particles = particles;
+
   // Resize particles and re-initialize the pf if value changed
-  if (dynamicVariables_.nParticles != config.particles)
+  if (dynamicVariables_.nParticles != particles)
   {
-    ROS_INFO("Resizing particles to %d and re-initializing the pf",
-             config.particles);
+    ROS_INFO("Resizing particles to %d and re-initializing the pf", particles);
 
-    resize_particles(config.particles);
-    nParticles_ = config.particles;
+    resize_particles(particles);
+    nParticles_ = particles;
+    logMemoryFootprint();
   }
 
   // Update with desired values
-  dynamicVariables_.nParticles = config.particles;
+  dynamicVariables_.nParticles = particles;
   dynamicVariables_.resamplingPercentageToKeep =
       config.groups.resampling.percentage_to_keep;
   dynamicVariables_.targetRandStddev =
       config.groups.target.predict_model_stddev;
+  dynamicVariables_.auxiliaryPF = config.groups.proposal.auxiliary_pf;
+  dynamicVariables_.targetObsProposalRatio =
+      config.groups.proposal.target_observation_proposal;
+  dynamicVariables_.hybrid = config.groups.hybrid.hybrid_ekf;
+  dynamicVariables_.hybridConfThreshold =
+      config.groups.hybrid.hybrid_conf_threshold;
+  dynamicVariables_.hybridConvergedIterations =
+      config.groups.hybrid.hybrid_converged_iterations;
+  dynamicVariables_.hybridInnovationGate =
+      config.groups.hybrid.hybrid_innovation_gate;
+  dynamicVariables_.hybridDivergenceFactor =
+      config.groups.hybrid.hybrid_divergence_factor;
+  dynamicVariables_.sensorResetting = config.groups.recovery.sensor_resetting;
+  dynamicVariables_.recoveryAlphaSlow =
+      config.groups.recovery.recovery_alpha_slow;
+  dynamicVariables_.recoveryAlphaFast =
+      config.groups.recovery.recovery_alpha_fast;
+  dynamicVariables_.quasiRandom = config.groups.sampling.quasi_random;
+  dynamicVariables_.regularized = config.groups.resampling.regularized;
+  dynamicVariables_.factorized = config.groups.resampling.factorized;
+  dynamicVariables_.robotBudgets = config.groups.budgets.robot_budgets;
+  dynamicVariables_.robotBudgetRatio = config.groups.budgets.robot_budget_ratio;
+  dynamicVariables_.robotMinParticles =
+      config.groups.budgets.robot_min_particles;
+  dynamicVariables_.largeScaleThreshold =
+      config.groups.largescale.large_scale_threshold;
+  dynamicVariables_.publishMaxParticles =
+      config.groups.largescale.publish_max_particles;
+  dynamicVariables_.logPeriod = config.groups.logging.log_period;
+  logger_.setPeriod(dynamicVariables_.logPeriod);
 
 // Alpha values updated only if using the original dataset
 #ifdef RECONFIGURE_ALPHAS
@@ -89,17 +204,22 @@ void ParticleFilter::dynamicReconfigureCallback(DynamicConfig& config)
 }
 
 void ParticleFilter::spreadTargetParticlesSphere(float particlesRatio,
-                                                 pdata_t center[3],
+                                                 pdata_t center[],
                                                  float radius)
 {
   uint particlesToSpread = nParticles_ * particlesRatio;
 
   boost::random::uniform_real_distribution<> dist(-radius, radius);
+  HaltonSequence halton(nStatesPerTarget_);
+  halton.scramble(seed_);
 
   for (uint p = 0; p < particlesToSpread; ++p)
   {
-    for (uint s = 0; s < STATES_PER_TARGET; ++s)
-      particles_[O_TARGET + s][p] = center[s] + dist(seed_);
+    for (uint s = 0; s < nStatesPerTarget_; ++s)
+      particles_[O_TARGET + s][p] =
+          center[s] + (dynamicVariables_.quasiRandom
+                           ? radius * (2 * halton(p, s) - 1)
+                           : dist(seed_));
   }
 }
 
@@ -115,17 +235,313 @@ void ParticleFilter::predictTarget()
 
   for (uint p = 0; p < nParticles_; p++)
   {
-    // Get random accelerations
-    pdata_t accel[STATES_PER_TARGET] = { (pdata_t)targetAcceleration(seed_),
-                                         (pdata_t)targetAcceleration(seed_),
-                                         (pdata_t)targetAcceleration(seed_) };
+    // Use random acceleration model, with a random acceleration for each
+    // dimension of the target
+    for (uint s = 0; s < nStatesPerTarget_; ++s)
+    {
+      pdata_t accel = (pdata_t)targetAcceleration(seed_);
+      particles_[O_TARGET + s][p] += 0.5 * accel * pow(targetIterationTime_.diff, 2);
+    }
+  }
+
+  // Mixture proposal - part of the target subparticles are drawn from the
+  // current observations instead
+  targetProposalWeights_.assign(nParticles_, 1.0);
+  if (dynamicVariables_.targetObsProposalRatio > 0.0)
+    drawTargetFromObservations(dynamicVariables_.targetObsProposalRatio);
+}
+
+void ParticleFilter::drawTargetFromObservations(const double ratio)
+{
+  using namespace boost::random;
+
+  // Robots currently observing the target
+  std::vector<uint> observers;
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (robotsUsed_[r] && bufTargetObservations_[r].found)
+      observers.push_back(r);
+  }
+
+  uint nDraws = nParticles_ * ratio;
+  if (observers.empty() || 0 == nDraws)
+    return;
+
+  // Gaussian approximation of the predicted target subparticles, used as the
+  // prior density of the drawn samples
+  std::vector<double> mean(nStatesPerTarget_), var(nStatesPerTarget_);
+  for (uint s = 0; s < nStatesPerTarget_; ++s)
+  {
+    subparticles_t& sub = particles_[O_TARGET + s];
+    mean[s] = std::accumulate(sub.begin(), sub.end(), 0.0) / nParticles_;
+    double stddev = calc_stdDev<pdata_t>(sub);
+    var[s] = std::max(stddev * stddev, MIN_WEIGHTSUM);
+  }
+
+  // Observation covariance of each observer, in its own frame
+  std::vector<std::vector<double> > obsVar(observers.size());
+  for (uint k = 0; k < observers.size(); ++k)
+  {
+    const TargetObservation& obs = bufTargetObservations_[observers[k]];
+    obsVar[k].push_back(obs.covXX);
+    obsVar[k].push_back(obs.covYY);
+    obsVar[k].push_back(TARGET_OBS_COV_ZZ);
+  }
+
+  normal_distribution<> normal(0.0, 1.0);
+  uniform_int_distribution<> pickObserver(0, observers.size() - 1);
+  uniform_int_distribution<> pickParticle(0, nParticles_ - 1);
+
+  // This runs after resample(), when every particle has the same weight, so
+  // which ones are replaced doesn't matter - the last ones are
+  uint first = nParticles_ - nDraws;
+
+  for (uint p = first; p < nParticles_; ++p)
+  {
+    uint k = pickObserver(seed_);
+    uint o_robot = observers[k] * nStatesPerRobot_;
+    uint j = pickParticle(seed_);
+    const TargetObservation& obs = bufTargetObservations_[observers[k]];
+
+    // Observation noise in the robot frame
+    double ox = obs.x + sqrt(obsVar[k][O_TX]) * normal(seed_);
+    double oy = obs.y + sqrt(obsVar[k][O_TY]) * normal(seed_);
+
+    // Project through robot subparticle j into the global frame
+    pdata_t theta = particles_[o_robot + O_THETA][j];
+    particles_[O_TARGET + O_TX][p] =
+        particles_[o_robot + O_X][j] + ox * cos(theta) - oy * sin(theta);
+    particles_[O_TARGET + O_TY][p] =
+        particles_[o_robot + O_Y][j] + ox * sin(theta) + oy * cos(theta);
+
+    if (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+      particles_[O_TARGET + O_TZ][p] =
+          obs.z + sqrt(obsVar[k][O_TZ]) * normal(seed_);
+  }
+
+  // The proposal density q(x) is the average, over the observers and their
+  // robot subparticles, of the observation projected through each of them. A
+  // fixed stride of the robot subparticles keeps it affordable, and their
+  // frames are computed once for every target subparticle
+  uint stride =
+      std::max(nParticles_ / TARGET_PROPOSAL_DENSITY_SUBPARTICLES, 1u);
+
+  std::vector<uint> termObserver;
+  std::vector<double> frameX, frameY, frameCos, frameSin;
+  for (uint k = 0; k < observers.size(); ++k)
+  {
+    uint o_robot = observers[k] * nStatesPerRobot_;
+    for (uint j = 0; j < nParticles_; j += stride)
+    {
+      pdata_t theta = particles_[o_robot + O_THETA][j];
+      termObserver.push_back(k);
+      frameX.push_back(particles_[o_robot + O_X][j]);
+      frameY.push_back(particles_[o_robot + O_Y][j]);
+      frameCos.push_back(cos(theta));
+      frameSin.push_back(sin(theta));
+    }
+  }
+
+  const uint nTerms = termObserver.size();
+
+  // Log of the normalizer of each observer's observation density
+  std::vector<double> logNormalizer(observers.size());
+  for (uint k = 0; k < observers.size(); ++k)
+  {
+    logNormalizer[k] = -0.5 * log(obsVar[k][O_TX] * obsVar[k][O_TY]);
+    if (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+      logNormalizer[k] += -0.5 * log(obsVar[k][O_TZ]);
+  }
+
+  // Every target subparticle came from the mixture (1-a)p(x) + a q(x), so
+  // each one is corrected by p(x) / ((1-a)p(x) + a q(x)). The densities share
+  // the same constants, which cancel
+  double alpha = (double)nDraws / nParticles_;
+  double sum = 0.0;
+
+  // Log of each term of q(x), summed with the largest factored out
+  std::vector<double> logTerms(nTerms);
+
+  for (uint p = 0; p < nParticles_; ++p)
+  {
+    double logPrior = 0.0;
+    for (uint s = 0; s < nStatesPerTarget_; ++s)
+      logPrior += -0.5 * pow(particles_[O_TARGET + s][p] - mean[s], 2) /
+                      var[s] -
+                  0.5 * log(var[s]);
+
+    const double tx = particles_[O_TARGET + O_TX][p];
+    const double ty = particles_[O_TARGET + O_TY][p];
+
+    for (uint t = 0; t < nTerms; ++t)
+    {
+      const uint k = termObserver[t];
+      const TargetObservation& obs = bufTargetObservations_[observers[k]];
+
+      // The target subparticle in the frame of the robot subparticle
+      double dx = tx - frameX[t];
+      double dy = ty - frameY[t];
+      double rx = dx * frameCos[t] + dy * frameSin[t] - obs.x;
+      double ry = -dx * frameSin[t] + dy * frameCos[t] - obs.y;
+
+      double logTerm = -0.5 * (rx * rx / obsVar[k][O_TX] +
+                               ry * ry / obsVar[k][O_TY]) +
+                       logNormalizer[k];
+
+      if (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+        logTerm += -0.5 * pow(particles_[O_TARGET + O_TZ][p] - obs.z, 2) /
+                   obsVar[k][O_TZ];
+
+      logTerms[t] = logTerm;
+    }
+
+    double maxLog = *std::max_element(logTerms.begin(), logTerms.end());
+    double termSum = 0.0;
+    for (uint i = 0; i < logTerms.size(); ++i)
+      termSum += exp(logTerms[i] - maxLog);
+    double logProposal = maxLog + log(termSum / logTerms.size());
+
+    // p / ((1-a)p + a q), with p factored out of the denominator
+    double correction =
+        1.0 / ((1.0 - alpha) + alpha * exp(logProposal - logPrior));
+
+    targetProposalWeights_[p] = correction;
+    sum += correction;
+  }
+
+  // Normalized to a mean of 1, so that the total weight is unchanged
+  if (sum > MIN_WEIGHTSUM)
+  {
+    for (uint p = 0; p < nParticles_; ++p)
+      targetProposalWeights_[p] *= nParticles_ / sum;
+  }
+  else
+    targetProposalWeights_.assign(nParticles_, 1.0);
+}
+
+uint ParticleFilter::landmarkLikelihood(const uint r, const subparticles_t& x,
+                                        const subparticles_t& y,
+                                        const subparticles_t& theta,
+                                        subparticles_t& probabilities,
+                                        const KernelConfig& cfg)
+{
+  uint landmarksSeen = 0;
+  const uint n = probabilities.size();
+
+  // For every landmark
+  for (uint l = 0; l < nLandmarks_; ++l)
+  {
+    // If landmark not seen, skip
+    if (false == bufLandmarkObservations_[r][l].found)
+      continue;
+    else
+      ++landmarksSeen;
+
+    // Reference to the observation for easier access
+    LandmarkObservation& m = bufLandmarkObservations_[r][l];
 
-    // Use random acceleration model
-    for (uint s = 0; s < STATES_PER_TARGET; ++s)
+    // Observation in robot frame
+    Eigen::Matrix<pdata_t, 2, 1> Zrobot(m.x, m.y);
+
+    // Landmark in global frame
+    Eigen::Matrix<pdata_t, 2, 1> LMglobal(landmarksMap_[l].x,
+                                          landmarksMap_[l].y);
+
+#pragma omp parallel for num_threads(cfg.nThreads)                             \
+    schedule(static, cfg.chunkSize) if (cfg.nThreads > 1)
+    for (uint p = 0; p < n; ++p)
     {
-      particles_[O_TARGET + s][p] += 0.5 * accel[s] * pow(targetIterationTime_.diff, 2);
+
+      // Robot pose <=> frame
+      Eigen::Rotation2D<pdata_t> Rrobot(-theta[p]);
+      Eigen::Matrix<pdata_t, 2, 1> Srobot(x[p], y[p]);
+
+      // Landmark to robot frame
+      Eigen::Matrix<pdata_t, 2, 1> LMrobot = Rrobot * (LMglobal - Srobot);
+
+      // Error in observation
+      Eigen::Matrix<pdata_t, 2, 1> Zerr = LMrobot - Zrobot;
+
+      // The values of interest to the particle weights
+      // Note: using Eigen wasn't of particular interest here since it does
+      // not allow for transposing a non-dynamic matrix
+      float expArg = -0.5 * (Zerr(O_X) * Zerr(O_X) / m.covXX +
+                             Zerr(O_Y) * Zerr(O_Y) / m.covYY);
+      float detValue = 1.0; // pow((2 * M_PI * m.covXX * m.covYY), -0.5);
+
+      /*
+      ROS_DEBUG_COND(
+          p == 0,
+          "OMNI%d's particle 0 is at {%f;%f;%f}, sees landmark %d with "
+          "certainty %f%%, and error {%f;%f}",
+          r + 1, x[p], y[p], theta[p], l, 100 * (detValue * exp(expArg)),
+          Zerr(0), Zerr(1));
+      */
+
+      // Update weight component for this robot and particular particle
+      probabilities[p] *= detValue * exp(expArg);
     }
   }
+
+  return landmarksSeen;
+}
+
+void ParticleFilter::auxiliaryResample(const uint r, const pdata_t deltaRot,
+                                       const pdata_t deltaTrans,
+                                       const pdata_t deltaFinalRot)
+{
+  uint o_robot = r * nStatesPerRobot_;
+  const uint n = robotParticles_[r];
+
+  // Poses predicted with the noiseless odometry model
+  particles_t predicted(nStatesPerRobot_, subparticles_t(n));
+  for (uint p = 0; p < n; ++p)
+  {
+    pdata_t heading = particles_[o_robot + O_THETA][p] + deltaRot;
+    predicted[O_X][p] = particles_[o_robot + O_X][p] + deltaTrans * cos(heading);
+    predicted[O_Y][p] = particles_[o_robot + O_Y][p] + deltaTrans * sin(heading);
+    predicted[O_THETA][p] = heading + deltaFinalRot;
+  }
+
+  // First stage weights - likelihood of the predicted poses
+  subparticles_t firstStage(n, 1.0);
+  if (0 == landmarkLikelihood(r, predicted[O_X], predicted[O_Y],
+                              predicted[O_THETA], firstStage,
+                              tuner_.config(KernelTuner::FUSE_ROBOTS)))
+    return;
+
+  double sum = std::accumulate(firstStage.begin(), firstStage.end(), 0.0);
+  if (sum < MIN_WEIGHTSUM)
+    return;
+
+  // Systematic resampling of this robot's ancestors
+  particles_t ancestors(particles_.begin() + o_robot,
+                        particles_.begin() + o_robot + nStatesPerRobot_);
+
+  // A teammate may be predicted several times per iteration, against the same
+  // landmarks, so its first stages since the last iteration are accumulated
+  subparticles_t ancestorAuxWeights(auxWeights_[r].begin(),
+                                    auxWeights_[r].begin() + n);
+
+  boost::random::uniform_real_distribution<> dist(0, sum / n);
+  double u = dist(seed_);
+  double cumulative = firstStage[0];
+  uint a = 0;
+
+  for (uint p = 0; p < n; ++p)
+  {
+    while (u > cumulative && a < n - 1)
+      cumulative += firstStage[++a];
+
+    for (uint s = 0; s < nStatesPerRobot_; ++s)
+      particles_[o_robot + s][p] = ancestors[s][a];
+
+    // Saved normalized to a mean of 1, times the ancestor's earlier stages,
+    // to be divided out in fuseRobots()
+    auxWeights_[r][p] = ancestorAuxWeights[a] * firstStage[a] * n / sum;
+
+    u += sum / n;
+  }
 }
 
 void ParticleFilter::fuseRobots()
@@ -139,9 +555,13 @@ void ParticleFilter::fuseRobots()
   std::vector<uint> landmarksSeen(nRobots_, 0);
 
   // Will track the probability propagation based on the landmark observations
-  // for each robot
-  std::vector<subparticles_t> probabilities(nRobots_,
-                                            subparticles_t(nParticles_, 1.0));
+  // for each robot, only for the distinct subparticles of its budget
+  std::vector<subparticles_t> probabilities(nRobots_);
+  for (uint r = 0; r < nRobots_; ++r)
+    probabilities[r].assign(robotParticles_[r], 1.0);
+
+  // Variant chosen by the autotuner for the landmark likelihood kernel
+  const KernelConfig& cfg = tuner_.begin(KernelTuner::FUSE_ROBOTS);
 
   // For every robot
   for (uint r = 0; r < nRobots_; ++r)
@@ -153,63 +573,24 @@ void ParticleFilter::fuseRobots()
     // Index offset for this robot in the particles vector
     uint o_robot = r * nStatesPerRobot_;
 
-    // For every landmark
-    for (uint l = 0; l < nLandmarks_; ++l)
-    {
-      // If landmark not seen, skip
-      if (false == bufLandmarkObservations_[r][l].found)
-        continue;
-      else
-        ++(landmarksSeen[r]);
-
-      // Reference to the observation for easier access
-      LandmarkObservation& m = bufLandmarkObservations_[r][l];
-
-      // Observation in robot frame
-      Eigen::Matrix<pdata_t, 2, 1> Zrobot(m.x, m.y);
-
-      // Landmark in global frame
-      Eigen::Matrix<pdata_t, 2, 1> LMglobal(landmarksMap_[l].x,
-                                            landmarksMap_[l].y);
-
-#pragma omp parallel for
-      for (uint p = 0; p < nParticles_; ++p)
-      {
+    landmarksSeen[r] = landmarkLikelihood(
+        r, particles_[o_robot + O_X], particles_[o_robot + O_Y],
+        particles_[o_robot + O_THETA], probabilities[r], cfg);
 
-        // Robot pose <=> frame
-        Eigen::Rotation2D<pdata_t> Rrobot(-particles_[o_robot + O_THETA][p]);
-        Eigen::Matrix<pdata_t, 2, 1> Srobot(particles_[o_robot + O_X][p],
-                                            particles_[o_robot + O_Y][p]);
-
-        // Landmark to robot frame
-        Eigen::Matrix<pdata_t, 2, 1> LMrobot = Rrobot * (LMglobal - Srobot);
-
-        // Error in observation
-        Eigen::Matrix<pdata_t, 2, 1> Zerr = LMrobot - Zrobot;
-
-        // The values of interest to the particle weights
-        // Note: using Eigen wasn't of particular interest here since it does
-        // not allow for transposing a non-dynamic matrix
-        float expArg = -0.5 * (Zerr(O_X) * Zerr(O_X) / m.covXX +
-                               Zerr(O_Y) * Zerr(O_Y) / m.covYY);
-        float detValue = 1.0; // pow((2 * M_PI * m.covXX * m.covYY), -0.5);
-
-        /*
-        ROS_DEBUG_COND(
-            p == 0,
-            "OMNI%d's particle 0 is at {%f;%f;%f}, sees landmark %d with "
-            "certainty %f%%, and error {%f;%f}",
-            r + 1, particles_[o_robot + O_X][p], particles_[o_robot + O_Y][p],
-            particles_[o_robot + O_THETA][p], l, 100 * (detValue * exp(expArg)),
-            Zerr(0), Zerr(1));
-        */
-
-        // Update weight component for this robot and particular particle
-        probabilities[r][p] *= detValue * exp(expArg);
-      }
+    // Auxiliary particle filter - correct for the first stage weights used
+    // when this robot's particles were predicted
+    if (dynamicVariables_.auxiliaryPF)
+    {
+      for (uint p = 0; p < robotParticles_[r]; ++p)
+        probabilities[r][p] /= auxWeights_[r][p];
     }
+
+    // The next iteration's first stages start over
+    auxWeights_[r].assign(nParticles_, 1.0);
   }
 
+  tuner_.end(KernelTuner::FUSE_ROBOTS);
+
   // Reset weights, later will be multiplied by weightComponents of each robot
   resetWeights(1.0);
 
@@ -225,30 +606,49 @@ void ParticleFilter::fuseRobots()
     // Check that at least one landmark was seen, if not send warning
     // If seen use probabilities vector, if not keep using the previous
     // weightComponents for this robot
-    if (0 == landmarksSeen[r])
-    {
-      ROS_WARN("In this iteration, OMNI%d didn't see any landmarks", r + 1);
+    metrics_.set("pfuclt_landmarks_seen",
+                 MetricsRegistry::label("robot", r + 1), landmarksSeen[r]);
 
-      // weightComponent stays from previous iteration
-    }
+    // Aggregated, instead of a warning in every iteration
+    // Teammates tracked from their belief summaries see none here
+    logger_.tally(ros::console::levels::Warn, "OMNI%d saw no landmarks",
+                  0 == landmarksSeen[r] && (!beliefs_ || r == mainRobotID_),
+                  LogArgs() << (int)r + 1, r);
 
-    else
+    // If none were seen, weightComponent stays from previous iteration
+    if (0 != landmarksSeen[r])
     {
-      weightComponents_[r] = probabilities[r];
+      // Repeated over the particles beyond this robot's budget
+      for (uint p = 0; p < nParticles_; ++p)
+        weightComponents_[r][p] = probabilities[r][p % robotParticles_[r]];
+
+      // Average likelihood per landmark, so that it doesn't depend on how
+      // many landmarks were seen
+      double mean = std::accumulate(probabilities[r].begin(),
+                                    probabilities[r].end(), 0.0) /
+                    probabilities[r].size();
+      robotLikelihood_[r].update(pow(mean, 1.0 / landmarksSeen[r]),
+                                 dynamicVariables_.recoveryAlphaSlow,
+                                 dynamicVariables_.recoveryAlphaFast);
     }
 
     // Index offset for this robot in the particles vector
     uint o_robot = r * nStatesPerRobot_;
 
     // Create a vector of indexes according to a descending order of the weights
-    // components of robot r
-    std::vector<uint> sorted = order_index<pdata_t>(weightComponents_[r], DESC);
+    // components of robot r, only over its distinct subparticles
+    const uint n = robotParticles_[r];
+    std::vector<uint> sorted = order_index<pdata_t>(
+        subparticles_t(weightComponents_[r].begin(),
+                       weightComponents_[r].begin() + n),
+        DESC);
 
     // For every particle
     for (uint p = 0; p < nParticles_; ++p)
     {
-      // Re-order the particle subsets of this robot
-      uint sort_index = sorted[p];
+      // Re-order the particle subsets of this robot, particle p uses the
+      // (p mod n)th best subparticle
+      uint sort_index = sorted[p % n];
 
       // Copy this sub-particle set from dupParticles' sort_index particle
       copyParticle(particles_, dupParticles, p, sort_index, o_robot,
@@ -257,8 +657,52 @@ void ParticleFilter::fuseRobots()
       // Update the particle weight (will get multiplied nRobots times and get a
       // lower value)
       particles_[O_WEIGHT][p] *= weightComponents_[r][sort_index];
+
+      // This robot's own weight of the subparticle now at p
+      robotBlockWeights_[r][p] = weightComponents_[r][sort_index];
+    }
+  }
+}
+
+pdata_t ParticleFilter::targetWeight(const uint m, const uint p)
+{
+  pdata_t totalWeight = 0.0;
+  float expArg, Z_Zcap[3];
+
+  // Observations of the target by all robots, a robot that hasn't seen the
+  // ball contributes with 0.0
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r] || false == bufTargetObservations_[r].found)
+      continue;
+
+    // Usefull variables
+    const TargetObservation& obs = bufTargetObservations_[r];
+    uint o_robot = r * nStatesPerRobot_;
+    pdata_t theta = particles_[o_robot + O_THETA][m];
+    pdata_t dx = particles_[O_TARGET + O_TX][p] - particles_[o_robot + O_X][m];
+    pdata_t dy = particles_[O_TARGET + O_TY][p] - particles_[o_robot + O_Y][m];
+
+    // Observation model
+    Z_Zcap[0] = obs.x - (dx * cos(theta) + dy * sin(theta));
+    Z_Zcap[1] = obs.y - (-dx * sin(theta) + dy * cos(theta));
+
+    expArg = -0.5 * (Z_Zcap[0] * Z_Zcap[0] / obs.covXX +
+                     Z_Zcap[1] * Z_Zcap[1] / obs.covYY);
+
+    // The height is only part of the state for 3D targets
+    if (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+    {
+      Z_Zcap[2] = obs.z - particles_[O_TARGET + O_TZ][p];
+      expArg += -0.5 * (Z_Zcap[2] * Z_Zcap[2] / TARGET_OBS_COV_ZZ);
     }
+
+    // Probability value for this robot and this particle
+    // detValue = pow((2 * M_PI * obs.covXX * obs.covYY * 10.0), -0.5);
+    totalWeight += exp(expArg);
   }
+
+  return totalWeight * targetProposalWeights_[p];
 }
 
 void ParticleFilter::fuseTarget()
@@ -289,112 +733,179 @@ void ParticleFilter::fuseTarget()
   }
   // If program is here, at least one robot saw the ball
 
-  // Instance variables to be worked in the loops
-  pdata_t maxTargetSubParticleWeight, totalWeight;
-  uint m, p, mStar, r, o_robot;
-  float expArg, detValue, Z[3], Zcap[3], Z_Zcap[3];
-  TargetObservation* obs;
+  // Variant chosen by the autotuner for the target search kernel
+  const KernelConfig& cfg = tuner_.begin(KernelTuner::FUSE_TARGET);
 
-  // For every particle m in the particle set [1:M]
-  for (m = 0; m < nParticles_; ++m)
+  double targetWeightSum = 0.0;
+
+  if (nParticles_ >= (uint)dynamicVariables_.largeScaleThreshold)
+    targetWeightSum = fuseTargetRanked(cfg);
+  else
   {
-    // Keep track of the maximum contributed weight and that particle's index
-    maxTargetSubParticleWeight = -1.0f;
-    mStar = m;
+    // For every particle m in the particle set [1:M]
+    for (uint m = 0; m < nParticles_; ++m)
+    {
+      // Keep track of the maximum contributed weight and that particle's
+      // index
+      pdata_t maxTargetSubParticleWeight = -1.0f;
+      uint mStar = m;
 
 // Find the particle m* in the set [m:M] for which the weight contribution
 // by the target subparticle to the full weight is maximum
-#pragma omp parallel for private(p, r, o_robot, obs, expArg, detValue, Z,      \
-                                 Zcap, Z_Zcap)
-    for (p = m; p < nParticles_; ++p)
-    {
-      // Vector with probabilities for each robot, starting at 0.0 in case the
-      // robot hasn't seen the ball
-      std::vector<pdata_t> probabilities(nRobots_, 0.0);
-
-      // Observations of the target by all robots
-      for (r = 0; r < nRobots_; ++r)
+#pragma omp parallel for num_threads(cfg.nThreads)                             \
+    schedule(static, cfg.chunkSize) if (cfg.nThreads > 1)
+      for (uint p = m; p < nParticles_; ++p)
       {
-        if (false == robotsUsed_[r] || false == bufTargetObservations_[r].found)
-          continue;
-
-        // Usefull variables
-        obs = &bufTargetObservations_[r];
-        o_robot = r * nStatesPerRobot_;
-
-        // Observation model
-        Z[0] = obs->x;
-        Z[1] = obs->y;
-        Z[2] = obs->z;
-        Zcap[0] =
-            (particles_[O_TARGET + O_TX][p] - particles_[o_robot + O_X][m]) *
-                (cos(particles_[o_robot + O_THETA][m])) +
-            (particles_[O_TARGET + O_TY][p] - particles_[o_robot + O_Y][m]) *
-                (sin(particles_[o_robot + O_THETA][m]));
-        Zcap[1] =
-            -(particles_[O_TARGET + O_TX][p] - particles_[o_robot + O_X][m]) *
-                (sin(particles_[o_robot + O_THETA][m])) +
-            (particles_[O_TARGET + O_TY][p] - particles_[o_robot + O_Y][m]) *
-                (cos(particles_[o_robot + O_THETA][m]));
-        Zcap[2] = particles_[O_TARGET + O_TZ][p];
-        Z_Zcap[0] = Z[0] - Zcap[0];
-        Z_Zcap[1] = Z[1] - Zcap[1];
-        Z_Zcap[2] = Z[2] - Zcap[2];
-
-        expArg = -0.5 * (Z_Zcap[0] * Z_Zcap[0] / obs->covXX +
-                         Z_Zcap[1] * Z_Zcap[1] / obs->covYY +
-                         Z_Zcap[2] * Z_Zcap[2] / .04);
-        detValue =
-            1.0; // pow((2 * M_PI * obs->covXX * obs->covYY * 10.0), -0.5);
-
-        // Probability value for this robot and this particle
-        probabilities[r] = detValue * exp(expArg);
-      }
-
-      // Total weight contributed by this particle
-      totalWeight =
-          std::accumulate(probabilities.begin(), probabilities.end(), 0.0);
+        // Total weight contributed by this particle
+        pdata_t totalWeight = targetWeight(m, p);
 
-      // If the weight is the maximum as of now, update the maximum and set
-      // particle p as mStar
-      if (totalWeight > maxTargetSubParticleWeight)
-      {
+        // If the weight is the maximum as of now, update the maximum and set
+        // particle p as mStar
+        if (totalWeight > maxTargetSubParticleWeight)
+        {
 // Swap particle m with m* so that the most relevant (in terms of
 // weight)
 // target subparticle is at the lowest indexes
 #pragma omp critical
-        {
-          if (totalWeight > maxTargetSubParticleWeight)
           {
-            maxTargetSubParticleWeight = totalWeight;
-            mStar = p;
+            if (totalWeight > maxTargetSubParticleWeight)
+            {
+              maxTargetSubParticleWeight = totalWeight;
+              mStar = p;
+            }
           }
         }
       }
+
+      // Particle m* has been found, let's swap the subparticles
+      for (uint i = 0; i < nStatesPerTarget_; ++i)
+        std::swap(particles_[O_TARGET + i][m],
+                  particles_[O_TARGET + i][mStar]);
+      std::swap(targetProposalWeights_[m], targetProposalWeights_[mStar]);
+
+      // Update the weight of this particle
+      particles_[O_WEIGHT][m] *= maxTargetSubParticleWeight;
+      targetWeightSum += maxTargetSubParticleWeight;
+
+      // The target subparticles are now reordered according to their weight
+      // contribution
+
+      // printWeights("After fuseTarget(): ");
     }
+  }
 
-    // Particle m* has been found, let's swap the subparticles
-    for (uint i = 0; i < STATES_PER_TARGET; ++i)
-      std::swap(particles_[O_TARGET + i][m], particles_[O_TARGET + i][mStar]);
+  tuner_.end(KernelTuner::FUSE_TARGET);
 
-    // Update the weight of this particle
-    particles_[O_WEIGHT][m] *= maxTargetSubParticleWeight;
+  // Average likelihood per observing robot
+  uint observers = 0;
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (robotsUsed_[r] && bufTargetObservations_[r].found)
+      ++observers;
+  }
+
+  if (observers > 0)
+    targetLikelihood_.update(targetWeightSum / (nParticles_ * observers),
+                             dynamicVariables_.recoveryAlphaSlow,
+                             dynamicVariables_.recoveryAlphaFast);
+}
+
+double ParticleFilter::fuseTargetRanked(const KernelConfig& cfg)
+{
+  // fuseRobots() left the robot subparticles ranked, the most likely at index
+  // 0. The particles are split in bands of consecutive ranks, and each band
+  // takes the best of the remaining target subparticles, scored against the
+  // band's first robot subparticles. A band per particle is the greedy search
+  uint bands = std::min(nParticles_, (uint)FUSE_TARGET_RANKED_BANDS);
+
+  std::vector<uint> remaining(nParticles_);
+  for (uint p = 0; p < nParticles_; ++p)
+    remaining[p] = p;
+
+  // Target subparticle paired with each particle
+  std::vector<uint> assigned;
+  assigned.reserve(nParticles_);
+
+  for (uint b = 0; b < bands; ++b)
+  {
+    uint first = b * nParticles_ / bands;
+    uint last = (b + 1) * nParticles_ / bands;
+
+    subparticles_t scores(remaining.size());
+
+#pragma omp parallel for num_threads(cfg.nThreads)                             \
+    schedule(static, cfg.chunkSize) if (cfg.nThreads > 1)
+    for (uint i = 0; i < remaining.size(); ++i)
+      scores[i] = targetWeight(first, remaining[i]);
+
+    std::vector<uint> sorted = order_index<pdata_t>(scores, DESC);
+
+    for (uint i = 0; i < last - first; ++i)
+      assigned.push_back(remaining[sorted[i]]);
 
-    // The target subparticles are now reordered according to their weight
-    // contribution
+    std::vector<uint> left;
+    left.reserve(remaining.size() - (last - first));
+    for (uint i = last - first; i < sorted.size(); ++i)
+      left.push_back(remaining[sorted[i]]);
+    remaining.swap(left);
+  }
+
+  // Copied back rather than swapped, so that the subparticle sets keep their
+  // buffers, which the Python bindings may be viewing
+  subparticles_t reordered(nParticles_);
+  for (uint i = 0; i < nStatesPerTarget_; ++i)
+  {
+    for (uint m = 0; m < nParticles_; ++m)
+      reordered[m] = particles_[O_TARGET + i][assigned[m]];
+    std::copy(reordered.begin(), reordered.end(),
+              particles_[O_TARGET + i].begin());
+  }
 
-    // printWeights("After fuseTarget(): ");
+  for (uint m = 0; m < nParticles_; ++m)
+    reordered[m] = targetProposalWeights_[assigned[m]];
+  std::copy(reordered.begin(), reordered.end(),
+            targetProposalWeights_.begin());
+
+  // Weigh each particle with its own pair of robot and target subparticles
+  double targetWeightSum = 0.0;
+
+#pragma omp parallel for num_threads(cfg.nThreads)                             \
+    schedule(static, cfg.chunkSize) if (cfg.nThreads > 1)                      \
+        reduction(+ : targetWeightSum)
+  for (uint m = 0; m < nParticles_; ++m)
+  {
+    pdata_t w = targetWeight(m, m);
+    particles_[O_WEIGHT][m] *= w;
+    targetWeightSum += w;
   }
+
+  return targetWeightSum;
 }
 
-void ParticleFilter::modifiedMultinomialResampler(uint startAt)
+/**
+ * @brief drawAncestor - the first index whose cumulative weight reaches u
+ */
+static uint drawAncestor(const std::vector<double>& cumulativeWeights,
+                         const double u)
+{
+  uint m = std::lower_bound(cumulativeWeights.begin(), cumulativeWeights.end(),
+                            u) -
+           cumulativeWeights.begin();
+  return std::min(m, (uint)cumulativeWeights.size() - 1);
+}
+
+void ParticleFilter::modifiedMultinomialResampler(
+    const double startAt, const std::vector<double>& kernel)
 {
   // Implementing a very basic resampler... a particle gets selected
-  // proportional to its weight and startAt% of the top particles are kept
+  // proportional to its weight and a startAt fraction of the top particles
+  // are kept
 
   particles_t duplicate(particles_);
+  boost::random::normal_distribution<> normal(0.0, 1.0);
 
-  std::vector<pdata_t> cumulativeWeights(nParticles_);
+  // Accumulated in double, float loses resolution with many particles
+  std::vector<double> cumulativeWeights(nParticles_);
   cumulativeWeights[0] = duplicate[O_WEIGHT][0];
 
   for (uint par = 1; par < nParticles_; par++)
@@ -411,11 +922,24 @@ void ParticleFilter::modifiedMultinomialResampler(uint startAt)
     boost::random::uniform_real_distribution<> dist(0, 1);
     double randNo = dist(seed_);
 
-    int m = 0;
-    while (randNo > cumulativeWeights[m])
-      m++;
+    uint m = drawAncestor(cumulativeWeights, randNo);
 
     copyParticle(particles_, duplicate, par, m, 0, O_TARGET - 1);
+
+    // Regularization - jitter the copy so that it isn't an exact duplicate
+    for (uint s = 0; s < O_TARGET; ++s)
+    {
+      if (kernel[s] > 0)
+        particles_[s][par] += kernel[s] * normal(seed_);
+    }
+
+    for (uint r = 0; r < nRobots_; ++r)
+    {
+      uint o_theta = r * nStatesPerRobot_ + O_THETA;
+      if (kernel[o_theta] > 0)
+        particles_[o_theta][par] =
+            angles::normalize_angle(particles_[o_theta][par]);
+    }
   }
 
   // Target resampling is done for all particles
@@ -424,21 +948,113 @@ void ParticleFilter::modifiedMultinomialResampler(uint startAt)
     boost::random::uniform_real_distribution<> dist(0, 1);
     double randNo = dist(seed_);
 
-    int m = 0;
-    while (randNo > cumulativeWeights[m])
-      m++;
+    uint m = drawAncestor(cumulativeWeights, randNo);
 
     copyParticle(particles_, duplicate, par, m, O_TARGET,
                  nSubParticleSets_ - 1);
+
+    for (uint s = O_TARGET; s < O_WEIGHT; ++s)
+    {
+      if (kernel[s] > 0)
+        particles_[s][par] += kernel[s] * normal(seed_);
+    }
   }
 
   // ROS_DEBUG("End of modifiedMultinomialResampler()");
 }
 
+void ParticleFilter::factorizedResampler(const double startAt,
+                                         const std::vector<double>& kernel)
+{
+  int startParticle = nParticles_ * startAt;
+
+  // One generator per robot, since the robots are resampled in parallel
+  std::vector<RNGType> rngs;
+  for (uint r = 0; r < nRobots_; ++r)
+    rngs.push_back(RNGType(seed_()));
+
+  // Each robot's block is resampled from that robot's own weights
+#pragma omp parallel for schedule(dynamic)
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    const subparticles_t& weights = robotBlockWeights_[r];
+    uint o_robot = r * nStatesPerRobot_;
+
+    std::vector<double> cumulativeWeights(nParticles_);
+    double sum = 0.0;
+    for (uint p = 0; p < nParticles_; ++p)
+    {
+      sum += weights[p];
+      cumulativeWeights[p] = sum;
+    }
+
+    // Nothing to tell the particles apart, leave this block as it is
+    if (sum < MIN_WEIGHTSUM)
+      continue;
+
+    particles_t block(particles_.begin() + o_robot,
+                      particles_.begin() + o_robot + nStatesPerRobot_);
+    boost::random::uniform_real_distribution<> dist(0, sum);
+    boost::random::normal_distribution<> normal(0.0, 1.0);
+
+    for (uint par = startParticle; par < nParticles_; ++par)
+    {
+      uint m = drawAncestor(cumulativeWeights, dist(rngs[r]));
+
+      for (uint s = 0; s < nStatesPerRobot_; ++s)
+      {
+        particles_[o_robot + s][par] = block[s][m];
+
+        // Regularization - jitter the copy so that it isn't an exact duplicate
+        if (kernel[o_robot + s] > 0)
+          particles_[o_robot + s][par] += kernel[o_robot + s] * normal(rngs[r]);
+      }
+
+      particles_[o_robot + O_THETA][par] =
+          angles::normalize_angle(particles_[o_robot + O_THETA][par]);
+    }
+  }
+
+  // The target block and the weights are resampled from the full weights,
+  // which are already normalized
+  particles_t duplicate(particles_.begin() + O_TARGET, particles_.end());
+  boost::random::uniform_real_distribution<> dist(0, 1);
+  boost::random::normal_distribution<> normal(0.0, 1.0);
+
+  std::vector<double> cumulativeWeights(nParticles_);
+  double sum = 0.0;
+  for (uint p = 0; p < nParticles_; ++p)
+  {
+    sum += particles_[O_WEIGHT][p];
+    cumulativeWeights[p] = sum;
+  }
+
+  for (uint par = 0; par < nParticles_; ++par)
+  {
+    uint m = drawAncestor(cumulativeWeights, dist(seed_));
+
+    for (uint s = O_TARGET; s < nSubParticleSets_; ++s)
+    {
+      particles_[s][par] = duplicate[s - O_TARGET][m];
+
+      if (s < O_WEIGHT && kernel[s] > 0)
+        particles_[s][par] += kernel[s] * normal(seed_);
+    }
+  }
+}
+
 void ParticleFilter::resample()
 {
   *iteration_oss << "resample() -> ";
 
+  // Standard deviation of the jitter applied to each state when resampling
+  std::vector<double> kernel(O_WEIGHT, 0.0);
+  std::vector<double> spread(nRobots_, 0.0);
+  double robotBandwidth = kernelBandwidth(nStatesPerRobot_);
+
   for (uint r = 0; r < nRobots_; ++r)
   {
     if (false == robotsUsed_[r])
@@ -451,6 +1067,15 @@ void ParticleFilter::resample()
     pdata_t stdTheta = calc_stdDev<pdata_t>(particles_[o_robot + O_THETA]);
 
     state_.robots[r].conf = 1 / (stdX + stdY + stdTheta);
+    spread[r] = stdX + stdY + stdTheta;
+
+    // Regularized PF - the same spreads set the kernel for this robot
+    if (dynamicVariables_.regularized)
+    {
+      kernel[o_robot + O_X] = robotBandwidth * stdX;
+      kernel[o_robot + O_Y] = robotBandwidth * stdY;
+      kernel[o_robot + O_THETA] = robotBandwidth * stdTheta;
+    }
 
     // ROS_DEBUG("OMNI%d stdX = %f, stdY = %f, stdTheta = %f", r + 1, stdX,
     // stdY,
@@ -467,29 +1092,166 @@ void ParticleFilter::resample()
 
   if (weightSum < MIN_WEIGHTSUM)
   {
-    ROS_WARN("Zero weightsum - returning without resampling");
+    logger_.log(ros::console::levels::Warn,
+                "Zero weightsum - returning without resampling");
+    metrics_.increment("pfuclt_weight_collapses_total");
+    metrics_.set("pfuclt_effective_sample_size", "", 0.0);
 
     // Print iteration and state information
     *iteration_oss << "FAIL! -> ";
 
     converged_ = false;
     resetWeights(1.0 / nParticles_);
+
+    // Re-draw particles from the observations instead of waiting for the
+    // degenerate ones to find their way back
+    if (dynamicVariables_.sensorResetting)
+      sensorResetting(true);
+
+    for (uint r = 0; r < nRobots_; ++r)
+      replicateRobotBlock(r);
+
     return;
   }
 
   converged_ = true;
 
   // All resamplers use normalized weights
+  double sumSquares = 0.0;
   for (uint p = 0; p < nParticles_; ++p)
+  {
     particles_[O_WEIGHT][p] = (pdata_t)(particles_[O_WEIGHT][p] / weightSum);
+    sumSquares += particles_[O_WEIGHT][p] * particles_[O_WEIGHT][p];
+  }
+
+  metrics_.set("pfuclt_effective_sample_size", "", 1.0 / sumSquares);
 
-  modifiedMultinomialResampler(dynamicVariables_.resamplingPercentageToKeep /
-                               100.0);
+  if (dynamicVariables_.regularized)
+  {
+    double targetBandwidth = kernelBandwidth(nStatesPerTarget_);
+    for (uint s = O_TARGET; s < O_WEIGHT; ++s)
+      kernel[s] = targetBandwidth * calc_stdDev<pdata_t>(particles_[s]);
+  }
+
+  if (dynamicVariables_.factorized)
+    factorizedResampler(dynamicVariables_.resamplingPercentageToKeep / 100.0,
+                        kernel);
+  else
+    modifiedMultinomialResampler(
+        dynamicVariables_.resamplingPercentageToKeep / 100.0, kernel);
+
+  // Robots that are lost or see few landmarks get more distinct particles
+  updateRobotBudgets(spread);
+
+  if (dynamicVariables_.sensorResetting)
+    sensorResetting(false);
+
+  for (uint r = 0; r < nRobots_; ++r)
+    replicateRobotBlock(r);
 
   // printWeights("after resampling: ");
 }
 
-void ParticleFilter::estimate()
+void ParticleFilter::sensorResetting(const bool lost)
+{
+  // Robots first, since the target samples are projected through them
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    double ratio = lost ? RECOVERY_MAX_RATIO : robotLikelihood_[r].ratio();
+    uint nInject = robotParticles_[r] * ratio;
+
+    // The last particles are the ones not kept by the resampler, and the ones
+    // beyond this robot's budget are repeated afterwards
+    if (nInject > 0 && seedRobotFromLandmarks(r, robotParticles_[r] - nInject))
+    {
+      *iteration_oss << "reset(OMNI" << r + 1 << ", " << nInject << ") -> ";
+      robotLikelihood_[r].reset();
+    }
+  }
+
+  double ratio = lost ? RECOVERY_MAX_RATIO : targetLikelihood_.ratio();
+  if (nParticles_ * ratio >= 1.0 && state_.target.seen)
+  {
+    drawTargetFromObservations(ratio);
+    targetProposalWeights_.assign(nParticles_, 1.0);
+
+    *iteration_oss << "reset(target, " << (uint)(nParticles_ * ratio)
+                   << ") -> ";
+    targetLikelihood_.reset();
+  }
+}
+
+void ParticleFilter::updateRobotBudgets(const std::vector<double>& spread)
+{
+  if (!dynamicVariables_.robotBudgets)
+  {
+    robotParticles_.assign(nRobots_, nParticles_);
+    return;
+  }
+
+  // Demand grows with the spread and with fewer landmarks to correct it
+  std::vector<double> demand(nRobots_, 0.0);
+  double demandSum = 0.0;
+  uint nUsed = 0;
+
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    uint landmarksSeen = 0;
+    for (uint l = 0; l < nLandmarks_; ++l)
+    {
+      if (bufLandmarkObservations_[r][l].found)
+        ++landmarksSeen;
+    }
+
+    demand[r] = spread[r] / sqrt(1.0 + landmarksSeen);
+    demandSum += demand[r];
+    ++nUsed;
+  }
+
+  double total = dynamicVariables_.robotBudgetRatio * nParticles_ * nUsed;
+  uint minParticles =
+      std::min((uint)std::max(dynamicVariables_.robotMinParticles, 1),
+               nParticles_);
+
+  std::ostringstream oss;
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    double share = demandSum > MIN_WEIGHTSUM ? demand[r] / demandSum
+                                             : 1.0 / nUsed;
+    robotParticles_[r] =
+        std::max(minParticles, std::min((uint)(total * share), nParticles_));
+
+    oss << " OMNI" << r + 1 << "=" << robotParticles_[r];
+  }
+
+  ROS_DEBUG("Particle budgets:%s", oss.str().c_str());
+}
+
+void ParticleFilter::replicateRobotBlock(const uint r)
+{
+  const uint n = robotParticles_[r];
+  if (n >= nParticles_)
+    return;
+
+  uint o_robot = r * nStatesPerRobot_;
+  for (uint s = 0; s < nStatesPerRobot_; ++s)
+  {
+    subparticles_t& sub = particles_[o_robot + s];
+    for (uint p = n; p < nParticles_; ++p)
+      sub[p] = sub[p - n];
+  }
+}
+
+void ParticleFilter::estimate()
 {
   *iteration_oss << "estimate() -> ";
 
@@ -569,12 +1331,12 @@ void ParticleFilter::estimate()
   }
 
   // Target weighted means
-  std::vector<double> targetWeightedMeans(STATES_PER_TARGET, 0.0);
+  std::vector<double> targetWeightedMeans(nStatesPerTarget_, 0.0);
 
   // For each particle
   for (uint p = 0; p < nParticles_; ++p)
   {
-    for (uint t = 0; t < STATES_PER_TARGET; ++t)
+    for (uint t = 0; t < nStatesPerTarget_; ++t)
     {
       targetWeightedMeans[t] +=
           particles_[O_TARGET + t][p] * normalizedWeights[p];
@@ -583,13 +1345,850 @@ void ParticleFilter::estimate()
 
   // Update position
   // Can't use easy copy since one is using double precision
-  state_.target.pos[O_TX] = targetWeightedMeans[O_TX];
-  state_.target.pos[O_TY] = targetWeightedMeans[O_TY];
-  state_.target.pos[O_TZ] = targetWeightedMeans[O_TZ];
+  for (uint t = 0; t < nStatesPerTarget_; ++t)
+    state_.target.pos[t] = targetWeightedMeans[t];
+
+  *iteration_oss << "DONE!";
+}
+
+bool ParticleFilter::exchangeShards(const ros::Time& stamp)
+{
+  if (!shards_)
+    return false;
+
+  *iteration_oss << "exchangeShards() -> ";
+
+  const subparticles_t& weights = particles_[O_WEIGHT];
+
+  // Per robot, the linear states and theta's cosine and sine, then the target
+  const uint nRobotSums = nStatesPerRobot_ + 1;
+  const uint o_targetSums = nRobots_ * nRobotSums;
+
+  ShardMessage local;
+  local.stamp = stamp;
+  local.nParticles = nParticles_;
+  local.weightedSums.assign(o_targetSums + nStatesPerTarget_, 0.0);
+
+  for (uint p = 0; p < nParticles_; ++p)
+  {
+    const double w = weights[p];
+    local.weightSum += w;
+
+    for (uint r = 0; r < nRobots_; ++r)
+    {
+      if (false == robotsUsed_[r])
+        continue;
+
+      uint o_robot = r * nStatesPerRobot_;
+      double* sums = &local.weightedSums[r * nRobotSums];
+
+      for (uint g = 0; g < nStatesPerRobot_ - 1; ++g)
+        sums[g] += w * particles_[o_robot + g][p];
+
+      sums[nStatesPerRobot_ - 1] += w * cos(particles_[o_robot + O_THETA][p]);
+      sums[nStatesPerRobot_] += w * sin(particles_[o_robot + O_THETA][p]);
+    }
+
+    for (uint t = 0; t < nStatesPerTarget_; ++t)
+      local.weightedSums[o_targetSums + t] += w * particles_[O_TARGET + t][p];
+  }
+
+  // The best particles are offered to the other shards, and the worst ones
+  // are replaced with the imported ones
+  std::vector<std::pair<pdata_t, uint> > order(nParticles_);
+  for (uint p = 0; p < nParticles_; ++p)
+    order[p] = std::make_pair(weights[p], p);
+  std::sort(order.begin(), order.end());
+
+  const uint nExport = std::min(
+      (uint)std::max(dynamicVariables_.shardExchangeParticles, 0),
+      nParticles_ / 2);
+  local.particles.assign(nSubParticleSets_, subparticles_t(nExport));
+  for (uint i = 0; i < nExport; ++i)
+  {
+    uint p = order[nParticles_ - 1 - i].second;
+    for (uint s = 0; s < nSubParticleSets_; ++s)
+      local.particles[s][i] = particles_[s][p];
+  }
+
+  ShardMessage reply;
+  if (!shards_->exchange(local, reply))
+  {
+    metrics_.increment("pfuclt_shard_exchange_failures_total");
+    *iteration_oss << "alone -> ";
+    return false;
+  }
+
+  if (shards_->isCoordinator())
+    metrics_.set("pfuclt_shards", "", shards_->shardsCombined());
+
+  const uint nImport =
+      reply.particles.size() != nSubParticleSets_
+          ? 0
+          : std::min((uint)reply.particles[0].size(), nParticles_ - nExport);
+
+  // For the factorized resampler, the imported robot blocks are taken to be
+  // as likely as this shard's best
+  std::vector<pdata_t> bestBlockWeights(nRobots_, 0.0);
+  for (uint r = 0; r < nRobots_ && nImport > 0; ++r)
+    bestBlockWeights[r] = *std::max_element(robotBlockWeights_[r].begin(),
+                                            robotBlockWeights_[r].end());
+
+  // The imports were drawn according to their weights, which they must not
+  // count a second time, so each gets the mean weight over every shard
+  const pdata_t importWeight =
+      reply.nParticles > 0 ? reply.weightSum / reply.nParticles : 0.0;
+
+  for (uint i = 0; i < nImport; ++i)
+  {
+    uint p = order[i].second;
+    for (uint s = 0; s < nSubParticleSets_; ++s)
+      particles_[s][p] = reply.particles[s][i];
+    particles_[O_WEIGHT][p] = importWeight;
+
+    for (uint r = 0; r < nRobots_; ++r)
+      robotBlockWeights_[r][p] = bestBlockWeights[r];
+  }
+
+  metrics_.increment("pfuclt_shard_imported_particles_total", "", nImport);
+  *iteration_oss << "imported(" << nImport << ") -> ";
+
+  // Without any weight, estimate() handles the filter being lost
+  if (reply.weightSum < MIN_WEIGHTSUM)
+    return false;
+
+  // The weighted means over the particles of every shard
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    const double* sums = &reply.weightedSums[r * nRobotSums];
+    for (uint g = 0; g < nStatesPerRobot_ - 1; ++g)
+      state_.robots[r].pose[g] = sums[g] / reply.weightSum;
+
+    state_.robots[r].pose[O_THETA] =
+        atan2(sums[nStatesPerRobot_], sums[nStatesPerRobot_ - 1]);
+  }
+
+  for (uint t = 0; t < nStatesPerTarget_; ++t)
+    state_.target.pos[t] =
+        reply.weightedSums[o_targetSums + t] / reply.weightSum;
+
+  // As in estimate(), return to the old target prediction model stddev
+  if (dynamicVariables_.targetRandStddev !=
+      dynamicVariables_.oldTargetRandSTddev)
+    dynamicVariables_.targetRandStddev = dynamicVariables_.oldTargetRandSTddev;
+
+  return true;
+}
+
+void ParticleFilter::exchangeBeliefs(const ros::Time& stamp)
+{
+  if (!beliefs_)
+    return;
+
+  *iteration_oss << "exchangeBeliefs() -> ";
+
+  // Keep the latest summary of each teammate, datagrams may be reordered
+  BeliefSummary summary;
+  while (beliefs_->receive(summary))
+  {
+    const uint r = summary.robot;
+    if (r >= nRobots_ || r == mainRobotID_)
+      continue;
+
+    bool matches = summary.pose.dimensions == nStatesPerRobot_ &&
+                   (summary.target.components.empty() ||
+                    summary.target.dimensions == nStatesPerTarget_);
+    logger_.tally(ros::console::levels::Warn,
+                  "OMNI%d's belief summaries don't match the states of this "
+                  "filter",
+                  !matches, LogArgs() << (int)r + 1, r);
+    if (!matches)
+      continue;
+
+    metrics_.increment("pfuclt_beliefs_received_total",
+                       MetricsRegistry::label("robot", r + 1));
+
+    if (summary.stamp < teammateBeliefs_[r].stamp)
+      continue;
+
+    teammateBeliefs_[r] = summary;
+    newBeliefs_[r] = true;
+  }
+
+  // Whether this robot sees the target, before the teammates' beliefs
+  const bool targetSeen = state_.target.seen;
+  std::vector<const GaussianMixture*> targets;
+
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    const BeliefSummary& belief = teammateBeliefs_[r];
+    if (r == mainRobotID_ || belief.pose.components.empty())
+      continue;
+
+    const double age = (stamp - belief.stamp).toSec();
+    metrics_.set("pfuclt_belief_age_seconds",
+                 MetricsRegistry::label("robot", r + 1), age);
+
+    // Aggregated, as the summaries keep coming late while the link is down
+    logger_.tally(ros::console::levels::Warn,
+                  "OMNI%d's belief summary is older than belief_max_age",
+                  age > dynamicVariables_.beliefMaxAge,
+                  LogArgs() << (int)r + 1, r);
+
+    if (age <= dynamicVariables_.beliefMaxAge &&
+        !belief.target.components.empty())
+      targets.push_back(&belief.target);
+
+    if (!newBeliefs_[r])
+      continue;
+    newBeliefs_[r] = false;
+
+    if (!robotsUsed_[r])
+    {
+      robotLikelihood_[r] = LikelihoodAverage();
+      robotsUsed_[r] = true;
+      ROS_INFO("OMNI%d joined the particle filter from its belief summaries",
+               r + 1);
+    }
+
+    // This robot doesn't observe the teammate, so the summary replaces its
+    // subparticles, which are all as likely
+    uint o_robot = r * nStatesPerRobot_;
+    double pose[BELIEF_MAX_DIMENSIONS];
+    for (uint p = 0; p < robotParticles_[r]; ++p)
+    {
+      belief.pose.sample(seed_, pose);
+      for (uint s = 0; s < nStatesPerRobot_; ++s)
+        particles_[o_robot + s][p] = pose[s];
+    }
+    replicateRobotBlock(r);
+
+    weightComponents_[r].assign(nParticles_, 1.0);
+    robotBlockWeights_[r].assign(nParticles_, 1.0);
+  }
+
+  double target[BELIEF_MAX_DIMENSIONS];
+
+  if (!targets.empty() && targetSeen)
+  {
+    // Tempered product of this robot's target belief with the teammates',
+    // normalized to a mean of 1 so that the weights keep their scale
+    std::vector<double> logFactors(nParticles_, 0.0);
+    for (uint p = 0; p < nParticles_; ++p)
+    {
+      for (uint s = 0; s < nStatesPerTarget_; ++s)
+        target[s] = particles_[O_TARGET + s][p];
+
+      for (uint i = 0; i < targets.size(); ++i)
+        logFactors[p] += dynamicVariables_.beliefFusionWeight *
+                         targets[i]->logDensity(target);
+    }
+
+    double maxLog = *std::max_element(logFactors.begin(), logFactors.end());
+    double sum = 0.0;
+    for (uint p = 0; p < nParticles_; ++p)
+    {
+      logFactors[p] = exp(logFactors[p] - maxLog);
+      sum += logFactors[p];
+    }
+
+    for (uint p = 0; p < nParticles_; ++p)
+      particles_[O_WEIGHT][p] *= logFactors[p] * nParticles_ / sum;
+  }
+  else if (!targets.empty())
+  {
+    // Without an observation, the target subparticles are only the prediction,
+    // so they are drawn from the teammates' beliefs, pooled equally
+    boost::random::uniform_int_distribution<> pick(0, targets.size() - 1);
+    for (uint p = 0; p < nParticles_; ++p)
+    {
+      targets[pick(seed_)]->sample(seed_, target);
+      for (uint s = 0; s < nStatesPerTarget_; ++s)
+        particles_[O_TARGET + s][p] = target[s];
+    }
+
+    state_.target.seen = true;
+  }
+
+  if (!lastBeliefSent_.isZero() && stamp >= lastBeliefSent_ &&
+      (stamp - lastBeliefSent_).toSec() < dynamicVariables_.beliefPeriod)
+    return;
+
+  // This robot's summary, the target only when it sees it, so that a belief
+  // drawn from the teammates isn't sent back to them
+  BeliefSummary own;
+  own.robot = mainRobotID_;
+  own.sequence = beliefSequence_;
+  own.stamp = stamp;
+
+  const uint nComponents = std::max(dynamicVariables_.beliefComponents, 1);
+  std::vector<const subparticles_t*> states;
+  for (uint s = 0; s < nStatesPerRobot_; ++s)
+    states.push_back(&particles_[mainRobotID_ * nStatesPerRobot_ + s]);
+
+  // Nothing to share if the weights collapsed
+  if (!own.pose.fit(states, particles_[O_WEIGHT], nComponents, O_THETA))
+    return;
+
+  own.target.dimensions = nStatesPerTarget_;
+  if (targetSeen)
+  {
+    states.clear();
+    for (uint s = 0; s < nStatesPerTarget_; ++s)
+      states.push_back(&particles_[O_TARGET + s]);
+    own.target.fit(states, particles_[O_WEIGHT], nComponents, -1);
+  }
+
+  size_t bytes = beliefs_->send(own);
+  metrics_.increment("pfuclt_beliefs_sent_total");
+  metrics_.increment("pfuclt_belief_sent_bytes_total", "", bytes);
+
+  lastBeliefSent_ = stamp;
+  ++beliefSequence_;
+}
+
+void ParticleFilter::checkHybridSwitch()
+{
+  if (!dynamicVariables_.hybrid || !converged_)
+  {
+    convergedIterations_ = 0;
+    return;
+  }
+
+  // Every robot's particles must be tightly spread
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (robotsUsed_[r] &&
+        state_.robots[r].conf < dynamicVariables_.hybridConfThreshold)
+    {
+      convergedIterations_ = 0;
+      return;
+    }
+  }
+
+  if (++convergedIterations_ < (uint)dynamicVariables_.hybridConvergedIterations)
+    return;
+
+  initEKFFromParticles();
+  ekfActive_ = true;
+
+  *iteration_oss << "switched to EKF -> ";
+  ROS_INFO("Hybrid mode: particles converged for %d iterations, switching to "
+           "the EKF",
+           convergedIterations_);
+}
+
+void ParticleFilter::initEKFFromParticles()
+{
+  // The resampled particles represent the posterior with equal weights, and
+  // estimate() has already placed the means in state_
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    uint o_robot = r * nStatesPerRobot_;
+    const std::vector<pdata_t>& pose = state_.robots[r].pose;
+
+    TeamEKF::RobotMean mean(pose[O_X], pose[O_Y], pose[O_THETA]);
+    TeamEKF::RobotCov cov = TeamEKF::RobotCov::Zero();
+
+    for (uint p = 0; p < nParticles_; ++p)
+    {
+      Eigen::Vector3d d(
+          particles_[o_robot + O_X][p] - mean(O_X),
+          particles_[o_robot + O_Y][p] - mean(O_Y),
+          angles::normalize_angle(particles_[o_robot + O_THETA][p] -
+                                  mean(O_THETA)));
+      cov += d * d.transpose();
+    }
+
+    ekf_.initRobot(r, mean, cov / nParticles_);
+  }
+
+  Eigen::VectorXd mean(nStatesPerTarget_);
+  for (uint t = 0; t < nStatesPerTarget_; ++t)
+    mean(t) = state_.target.pos[t];
+
+  Eigen::MatrixXd cov =
+      Eigen::MatrixXd::Zero(nStatesPerTarget_, nStatesPerTarget_);
+  Eigen::VectorXd d(nStatesPerTarget_);
+
+  for (uint p = 0; p < nParticles_; ++p)
+  {
+    for (uint t = 0; t < nStatesPerTarget_; ++t)
+      d(t) = particles_[O_TARGET + t][p] - mean(t);
+
+    cov += d * d.transpose();
+  }
+
+  ekf_.initTarget(mean, cov / nParticles_);
+}
+
+void ParticleFilter::iterateEKF()
+{
+  *iteration_oss << "iterateEKF() -> ";
+
+  // Hybrid mode was disabled at runtime - back to the particle filter, with
+  // particles spawned from the EKF belief as when a check fails
+  if (!dynamicVariables_.hybrid)
+  {
+    ROS_INFO("Hybrid mode disabled, re-spawning particles from the EKF");
+    *iteration_oss << "EKF disabled -> ";
+
+    respawnParticlesFromEKF();
+    ekfActive_ = false;
+    convergedIterations_ = 0;
+
+    predictTarget();
+    fuseRobots();
+    fuseTarget();
+    resample();
+    estimate();
+    return;
+  }
+
+  // Save the latest observation time to be used when publishing
+  savedLatestObservationTime_ = latestObservationTime_;
+
+  const double gate = dynamicVariables_.hybridInnovationGate;
+  bool consistent = true;
+
+  ekf_.predictTarget(targetIterationTime_.diff,
+                     dynamicVariables_.targetRandStddev);
+
+  // The predicted belief, which the particles are re-spawned from if a check
+  // fails, so that the particle filter doesn't fuse the updates twice
+  std::vector<TeamEKF::RobotMean, Eigen::aligned_allocator<TeamEKF::RobotMean> >
+      predictedRobotMean(ekf_.robotMean);
+  std::vector<TeamEKF::RobotCov, Eigen::aligned_allocator<TeamEKF::RobotCov> >
+      predictedRobotCov(ekf_.robotCov);
+  Eigen::VectorXd predictedTargetMean(ekf_.targetMean);
+  Eigen::MatrixXd predictedTargetCov(ekf_.targetCov);
+
+  for (uint r = 0; r < nRobots_ && consistent; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    for (uint l = 0; l < nLandmarks_ && consistent; ++l)
+    {
+      LandmarkObservation& m = bufLandmarkObservations_[r][l];
+
+      if (m.found)
+        consistent = ekf_.updateLandmark(r, m.x, m.y, m.covXX, m.covYY,
+                                         landmarksMap_[l].x,
+                                         landmarksMap_[l].y, gate);
+    }
+
+    // Divergence check - robot no longer well localized
+    if (ekf_.robotSpread(r) > 1.0 / dynamicVariables_.hybridConfThreshold *
+                                  dynamicVariables_.hybridDivergenceFactor)
+      consistent = false;
+  }
+
+  bool ballSeen = false;
+  for (uint r = 0; r < nRobots_ && consistent; ++r)
+  {
+    TargetObservation& obs = bufTargetObservations_[r];
+
+    if (false == robotsUsed_[r] || false == obs.found)
+      continue;
+
+    ballSeen = true;
+    consistent = ekf_.updateTarget(r, Eigen::Vector3d(obs.x, obs.y, obs.z),
+                                   obs.covXX, obs.covYY, TARGET_OBS_COV_ZZ,
+                                   gate);
+  }
+
+  if (!consistent)
+  {
+    // Back to the particle filter, with particles spawned from the predicted
+    // EKF belief, before any update. Every observation of this iteration is
+    // then fused by the particle filter
+    ROS_WARN("Hybrid mode: EKF innovation or divergence check failed, "
+             "re-spawning particles");
+    *iteration_oss << "EKF failed -> ";
+
+    ekf_.robotMean = predictedRobotMean;
+    ekf_.robotCov = predictedRobotCov;
+    ekf_.targetMean = predictedTargetMean;
+    ekf_.targetCov = predictedTargetCov;
+
+    respawnParticlesFromEKF();
+    ekfActive_ = false;
+    convergedIterations_ = 0;
+
+    fuseRobots();
+    fuseTarget();
+    resample();
+    estimate();
+    return;
+  }
+
+  // Estimate directly from the EKF
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    for (uint s = 0; s < nStatesPerRobot_; ++s)
+      state_.robots[r].pose[s] = ekf_.robotMean[r](s);
+
+    state_.robots[r].conf = 1 / ekf_.robotSpread(r);
+  }
+
+  for (uint t = 0; t < nStatesPerTarget_; ++t)
+    state_.target.pos[t] = ekf_.targetMean(t);
+
+  state_.target.seen = ballSeen;
+  converged_ = true;
 
   *iteration_oss << "DONE!";
 }
 
+/**
+ * @brief covarianceSqrt - a lower triangular L with L L^T = cov. A covariance
+ * that is singular, e.g. after the particles collapsed, gets a floor on its
+ * diagonal, and the diagonal's square root is the last resort
+ */
+static Eigen::MatrixXd covarianceSqrt(const Eigen::MatrixXd& cov)
+{
+  Eigen::LLT<Eigen::MatrixXd> llt(cov);
+  if (llt.info() == Eigen::Success &&
+      llt.matrixL().toDenseMatrix().allFinite())
+    return llt.matrixL();
+
+  Eigen::MatrixXd floored = cov;
+  floored.diagonal().array() += EKF_RESPAWN_MIN_VARIANCE;
+  llt.compute(floored);
+  if (llt.info() == Eigen::Success &&
+      llt.matrixL().toDenseMatrix().allFinite())
+    return llt.matrixL();
+
+  Eigen::MatrixXd L = Eigen::MatrixXd::Zero(cov.rows(), cov.cols());
+  for (int i = 0; i < cov.rows(); ++i)
+  {
+    double variance = cov(i, i);
+    L(i, i) = sqrt(std::isfinite(variance) && variance > 0.0
+                       ? variance + EKF_RESPAWN_MIN_VARIANCE
+                       : EKF_RESPAWN_MIN_VARIANCE);
+  }
+  return L;
+}
+
+void ParticleFilter::respawnParticlesFromEKF()
+{
+  boost::random::normal_distribution<> normal(0.0, 1.0);
+
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (false == robotsUsed_[r])
+      continue;
+
+    uint o_robot = r * nStatesPerRobot_;
+    Eigen::Matrix3d L = covarianceSqrt(ekf_.robotCov[r]);
+
+    for (uint p = 0; p < nParticles_; ++p)
+    {
+      Eigen::Vector3d sample =
+          ekf_.robotMean[r] +
+          L * Eigen::Vector3d(normal(seed_), normal(seed_), normal(seed_));
+
+      particles_[o_robot + O_X][p] = sample(O_X);
+      particles_[o_robot + O_Y][p] = sample(O_Y);
+      particles_[o_robot + O_THETA][p] = angles::normalize_angle(sample(O_THETA));
+    }
+  }
+
+  Eigen::MatrixXd L = covarianceSqrt(ekf_.targetCov);
+  Eigen::VectorXd n(nStatesPerTarget_);
+
+  for (uint p = 0; p < nParticles_; ++p)
+  {
+    for (uint t = 0; t < nStatesPerTarget_; ++t)
+      n(t) = normal(seed_);
+
+    Eigen::VectorXd sample = ekf_.targetMean + L * n;
+
+    for (uint t = 0; t < nStatesPerTarget_; ++t)
+      particles_[O_TARGET + t][p] = sample(t);
+  }
+
+  targetProposalWeights_.assign(nParticles_, 1.0);
+  resetWeights(1.0 / nParticles_);
+}
+
+size_t ParticleFilter::bytesPerParticle(const uint nSubParticleSets,
+                                        const uint nRobots)
+{
+  // The particle set, plus the full copies made by fuseRobots() and by the
+  // resampler
+  size_t perParticle = 3 * nSubParticleSets * sizeof(pdata_t);
+
+  // weightComponents_, auxWeights_, robotBlockWeights_ and the likelihoods in
+  // fuseRobots()
+  perParticle += 4 * nRobots * sizeof(pdata_t);
+
+  // targetProposalWeights_, the normalized weights in estimate(), the
+  // cumulative weights in the resampler and the sorted indexes
+  perParticle += 2 * sizeof(pdata_t) + sizeof(double) + sizeof(uint);
+
+  return perParticle;
+}
+
+uint ParticleFilter::particlesWithinBudget(const int requested,
+                                           const size_t bytesPerParticle,
+                                           const double budgetMB)
+{
+  uint n = std::max(requested, 1);
+
+  if (budgetMB <= 0)
+    return n;
+
+  uint limit = std::max(
+      (uint)(budgetMB * 1024 * 1024 / bytesPerParticle), (uint)1);
+
+  if (n > limit)
+  {
+    ROS_WARN("%d particles would need %.1fMB, above the memory budget of "
+             "%.1fMB - using %d particles",
+             n, n * bytesPerParticle / (1024.0 * 1024.0), budgetMB, limit);
+    n = limit;
+  }
+
+  return n;
+}
+
+const char* ParticleFilter::sensorName(const Sensor sensor)
+{
+  switch (sensor)
+  {
+  case ODOMETRY:
+    return "odometry";
+  case TARGET:
+    return "target";
+  case LANDMARKS:
+    return "landmarks";
+  default:
+    return "unknown";
+  }
+}
+
+void ParticleFilter::recordReceipt(const uint robotNumber, const Sensor sensor,
+                                   const ros::Time& stamp)
+{
+  ObservationLatency& l = latencies_[robotNumber][sensor];
+
+  // If the previous one wasn't fused yet, it was superseded by this one
+  l.stamp = stamp;
+  l.received = ros::WallTime::now();
+  l.transport = (ros::Time::now() - stamp).toSec();
+  l.pending = true;
+}
+
+void ParticleFilter::collectFusedLatencies()
+{
+  fusedLatencies_.clear();
+
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    for (uint s = 0; s < NUM_SENSORS; ++s)
+    {
+      ObservationLatency& l = latencies_[r][s];
+      if (!l.pending)
+        continue;
+
+      l.queue =
+          std::max(0.0, (iterationEvalTime_ - l.received).toNSec() * 1e-9);
+      l.pending = false;
+      fusedLatencies_.push_back(l);
+    }
+  }
+}
+
+void ParticleFilter::stampLatencies(const ros::WallTime& published)
+{
+  double compute = (estimateComputedTime_ - iterationEvalTime_).toNSec() * 1e-9;
+  double publish = (published - estimateComputedTime_).toNSec() * 1e-9;
+
+  for (uint i = 0; i < fusedLatencies_.size(); ++i)
+  {
+    fusedLatencies_[i].compute = compute;
+    fusedLatencies_[i].publish = publish;
+  }
+}
+
+void ParticleFilter::recordLatencyMetrics()
+{
+  for (uint i = 0; i < fusedLatencies_.size(); ++i)
+  {
+    const ObservationLatency& l = fusedLatencies_[i];
+    std::string labels = MetricsRegistry::label("robot", l.robot + 1) + "," +
+                         MetricsRegistry::label("sensor", sensorName(l.sensor)) +
+                         ",";
+
+    metrics_.observe("pfuclt_latency_seconds",
+                     labels + MetricsRegistry::label("stage", "transport"),
+                     l.transport);
+    metrics_.observe("pfuclt_latency_seconds",
+                     labels + MetricsRegistry::label("stage", "queue"),
+                     l.queue);
+    metrics_.observe("pfuclt_latency_seconds",
+                     labels + MetricsRegistry::label("stage", "compute"),
+                     l.compute);
+    metrics_.observe("pfuclt_latency_seconds",
+                     labels + MetricsRegistry::label("stage", "publish"),
+                     l.publish);
+    metrics_.observe("pfuclt_latency_seconds",
+                     labels + MetricsRegistry::label("stage", "total"),
+                     l.total());
+  }
+}
+
+void ParticleFilter::logMemoryFootprint()
+{
+  double mb = nParticles_ * bytesPerParticle(nSubParticleSets_, nRobots_) /
+              (1024.0 * 1024.0);
+
+  ROS_INFO("Memory footprint of %d particles is %.1fMB (budget %.1fMB)",
+           nParticles_, mb, dynamicVariables_.memoryBudgetMB);
+}
+
+void ParticleFilter::initMetrics()
+{
+  metrics_.describe("pfuclt_stage_seconds", MetricsRegistry::SUMMARY,
+                    "Wall time of each step of an iteration");
+  metrics_.describe("pfuclt_iteration_seconds", MetricsRegistry::SUMMARY,
+                    "Wall time of a whole iteration");
+  metrics_.describe("pfuclt_iterations_total", MetricsRegistry::COUNTER,
+                    "Iterations performed");
+  metrics_.describe("pfuclt_iteration_rate_hz", MetricsRegistry::GAUGE,
+                    "Iteration rate, from the main robot's odometry");
+  metrics_.describe("pfuclt_effective_sample_size", MetricsRegistry::GAUGE,
+                    "Effective sample size before resampling");
+  metrics_.describe("pfuclt_weight_collapses_total", MetricsRegistry::COUNTER,
+                    "Iterations where the weights summed to zero");
+  metrics_.describe("pfuclt_landmarks_seen", MetricsRegistry::GAUGE,
+                    "Landmarks seen by each robot in the last iteration");
+  metrics_.describe("pfuclt_messages_total", MetricsRegistry::COUNTER,
+                    "Messages received, by robot and type");
+  metrics_.describe("pfuclt_late_messages_total", MetricsRegistry::COUNTER,
+                    "Messages older than the last iteration's observations");
+  metrics_.describe("pfuclt_message_age_seconds", MetricsRegistry::SUMMARY,
+                    "Time between a message's stamp and its callback, which "
+                    "grows with the subscriber queue depth");
+  metrics_.describe("pfuclt_dropped_messages_total", MetricsRegistry::COUNTER,
+                    "Messages that never reached their callback, from gaps in "
+                    "the header sequence numbers or stamps");
+  metrics_.describe("pfuclt_out_of_order_messages_total",
+                    MetricsRegistry::COUNTER,
+                    "Messages older than the previous one of the same topic");
+  metrics_.describe("pfuclt_subscriber_queue_size", MetricsRegistry::GAUGE,
+                    "Configured subscriber queue size, 0 being unbounded");
+  metrics_.describe("pfuclt_callback_seconds", MetricsRegistry::SUMMARY,
+                    "Wall time of each callback, during which the spinner "
+                    "thread can't serve the other subscribers");
+  metrics_.describe("pfuclt_latency_seconds", MetricsRegistry::SUMMARY,
+                    "Latency of the observations fused in each estimate, by "
+                    "stage: transport (stamp to callback), queue (callback to "
+                    "iteration), compute, publish and total");
+  metrics_.describe("pfuclt_particles", MetricsRegistry::GAUGE,
+                    "Number of particles");
+  metrics_.describe("pfuclt_particles_memory_bytes", MetricsRegistry::GAUGE,
+                    "Estimated memory used by the particles");
+  metrics_.describe("pfuclt_resident_memory_bytes", MetricsRegistry::GAUGE,
+                    "Resident memory of the process, sampled every "
+                    "diagnostics period");
+  metrics_.describe("pfuclt_shards", MetricsRegistry::GAUGE,
+                    "Shards combined in the last iteration, on the "
+                    "coordinator");
+  metrics_.describe("pfuclt_shard_exchange_failures_total",
+                    MetricsRegistry::COUNTER,
+                    "Iterations estimated without the other shards, after a "
+                    "timeout or without a connection");
+  metrics_.describe("pfuclt_shard_imported_particles_total",
+                    MetricsRegistry::COUNTER,
+                    "Particles imported from the other shards");
+  metrics_.describe("pfuclt_beliefs_sent_total", MetricsRegistry::COUNTER,
+                    "Belief summaries sent to the teammates");
+  metrics_.describe("pfuclt_belief_sent_bytes_total", MetricsRegistry::COUNTER,
+                    "Bytes of the belief summaries sent, over every peer");
+  metrics_.describe("pfuclt_beliefs_received_total", MetricsRegistry::COUNTER,
+                    "Belief summaries received, by robot");
+  metrics_.describe("pfuclt_belief_age_seconds", MetricsRegistry::GAUGE,
+                    "Age of each teammate's latest belief summary, at the "
+                    "last iteration");
+
+  if (dynamicVariables_.metricsPort > 0)
+    metricsServer_.reset(
+        new MetricsServer(metrics_, dynamicVariables_.metricsPort));
+
+  if (dynamicVariables_.diagnosticsPeriod > 0 && nh_)
+    diagnosticsPublisher_ =
+        nh_->advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+}
+
+ros::WallTime ParticleFilter::observeStage(const char* stage,
+                                           const ros::WallTime& start)
+{
+  ros::WallTime now = ros::WallTime::now();
+  metrics_.observe("pfuclt_stage_seconds",
+                   MetricsRegistry::label("stage", stage),
+                   (now - start).toNSec() * 1e-9);
+  return now;
+}
+
+void ParticleFilter::updateIterationMetrics()
+{
+  metrics_.observe("pfuclt_iteration_seconds", "",
+                   deltaIteration_.toNSec() * 1e-9);
+  metrics_.increment("pfuclt_iterations_total");
+
+  if (odometryTime_.diff > 0)
+    metrics_.set("pfuclt_iteration_rate_hz", "", 1.0 / odometryTime_.diff);
+
+  metrics_.set("pfuclt_particles", "", nParticles_);
+  metrics_.set("pfuclt_particles_memory_bytes", "",
+               (double)nParticles_ *
+                   bytesPerParticle(nSubParticleSets_, nRobots_));
+
+  if (dynamicVariables_.diagnosticsPeriod <= 0 ||
+      (ros::WallTime::now() - lastDiagnostics_).toNSec() * 1e-9 <
+          dynamicVariables_.diagnosticsPeriod)
+    return;
+
+  lastDiagnostics_ = ros::WallTime::now();
+
+  // Second field of statm is the resident set size in pages. Read only once
+  // per diagnostics period, as it is a system call and a file parse
+  std::ifstream statm("/proc/self/statm");
+  unsigned long size, resident;
+  if (statm >> size >> resident)
+    metrics_.set("pfuclt_resident_memory_bytes", "",
+                 (double)resident * sysconf(_SC_PAGESIZE));
+
+  // Without ROS, the metrics are only served
+  if (!diagnosticsPublisher_)
+    return;
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "pfuclt_omni_dataset: filter";
+  status.hardware_id = "OMNI" + boost::lexical_cast<std::string>(mainRobotID_ + 1);
+  status.level = converged_ ? (uint8_t)diagnostic_msgs::DiagnosticStatus::OK
+                            : (uint8_t)diagnostic_msgs::DiagnosticStatus::WARN;
+  status.message = converged_ ? "Running" : "Weights collapsed";
+  metrics_.fillDiagnostics(status);
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  msg.status.push_back(status);
+  diagnosticsPublisher_.publish(msg);
+}
+
 void ParticleFilter::printWeights(std::string pre)
 {
   std::ostringstream debug;
@@ -641,6 +2240,10 @@ void ParticleFilter::init(const std::vector<double>& customRandInit,
 
   ROS_INFO("Initializing particle filter");
 
+  // Low-discrepancy points cover the boxes more evenly than pseudo-random
+  // ones. Each robot and target gets its own scrambled sequence
+  HaltonSequence halton(std::max(nStatesPerRobot_, nStatesPerTarget_));
+
   // For all subparticle sets except the particle weights
   for (size_t i = 0; i < numVars; ++i)
   {
@@ -650,9 +2253,22 @@ void ParticleFilter::init(const std::vector<double>& customRandInit,
     boost::random::uniform_real_distribution<> dist(customRandInit[2 * i],
                                                     customRandInit[2 * i + 1]);
 
+    uint dim = i < O_TARGET ? i % nStatesPerRobot_
+                            : (i - O_TARGET) % nStatesPerTarget_;
+    if (0 == dim)
+      halton.scramble(seed_);
+
     // Sample a value from the uniform distribution for each particle
     for (uint p = 0; p < nParticles_; ++p)
-      particles_[i][p] = (pdata_t)dist(seed_);
+    {
+      if (dynamicVariables_.quasiRandom)
+        particles_[i][p] = (pdata_t)(
+            customRandInit[2 * i] +
+            (customRandInit[2 * i + 1] - customRandInit[2 * i]) *
+                halton(p, dim));
+      else
+        particles_[i][p] = (pdata_t)dist(seed_);
+    }
   }
 
   // Particle weights init with same weight (1/nParticles)
@@ -673,10 +2289,68 @@ void ParticleFilter::init(const std::vector<double>& customRandInit,
   ROS_INFO("Particle filter initialized");
 }
 
+void ParticleFilter::initRobot(const uint r,
+                               const std::vector<double>& customRandInit,
+                               const std::vector<double>& customPosInit)
+{
+  if (!initialized_)
+  {
+    // The first robot to report also initializes the target and the weights,
+    // the other robots join the filter as they report
+    init(customRandInit, customPosInit);
+    robotsUsed_.assign(nRobots_, false);
+  }
+  else if (robotsUsed_[r])
+    return;
+  else
+  {
+    // This robot's subparticles were left behind while it wasn't playing, so
+    // sample them again from the initial distribution
+    uint o_robot = r * nStatesPerRobot_;
+    HaltonSequence halton(nStatesPerRobot_);
+    halton.scramble(seed_);
+
+    for (uint s = 0; s < nStatesPerRobot_; ++s)
+    {
+      uint i = o_robot + s;
+      if (2 * i + 1 >= customRandInit.size())
+        break;
+
+      boost::random::uniform_real_distribution<> dist(customRandInit[2 * i],
+                                                      customRandInit[2 * i + 1]);
+      for (uint p = 0; p < nParticles_; ++p)
+      {
+        if (dynamicVariables_.quasiRandom)
+          particles_[i][p] = (pdata_t)(
+              customRandInit[2 * i] +
+              (customRandInit[2 * i + 1] - customRandInit[2 * i]) *
+                  halton(p, s));
+        else
+          particles_[i][p] = (pdata_t)dist(seed_);
+      }
+    }
+
+    // The EKF has no belief for this robot, go back to the particles
+    if (ekfActive_)
+    {
+      respawnParticlesFromEKF();
+      ekfActive_ = false;
+      convergedIterations_ = 0;
+    }
+  }
+
+  // Don't let the previous weight components of this robot zero the weights
+  weightComponents_[r].assign(nParticles_, 1.0);
+  robotLikelihood_[r] = LikelihoodAverage();
+  robotsUsed_[r] = true;
+
+  ROS_INFO("OMNI%d joined the particle filter", r + 1);
+}
+
 void ParticleFilter::predict(const uint robotNumber, const Odometry odom,
                              const ros::Time stamp)
 {
-  if (!initialized_)
+  if (!initialized_ || !robotsUsed_[robotNumber])
     return;
 
   *iteration_oss << "predict(OMNI" << robotNumber + 1 << ") -> ";
@@ -698,57 +2372,80 @@ void ParticleFilter::predict(const uint robotNumber, const Odometry odom,
   pdata_t deltaTrans = sqrt(odom.x * odom.x + odom.y * odom.y);
   pdata_t deltaFinalRot = odom.theta - deltaRot;
 
-  // Create an error model based on a gaussian distribution
-  normal_distribution<> deltaRotEffective(deltaRot, alpha[0] * fabs(deltaRot) +
-                                                        alpha[1] * deltaTrans);
+  // Hybrid mode - while the EKF is active only its belief is propagated
+  if (ekfActive_)
+    ekf_.predictRobot(robotNumber, deltaRot, deltaTrans, deltaFinalRot, alpha);
+  else
+  {
+    // Auxiliary particle filter - choose the ancestors that will be propagated
+    // according to the landmarks this robot is observing
+    if (dynamicVariables_.auxiliaryPF)
+      auxiliaryResample(robotNumber, deltaRot, deltaTrans, deltaFinalRot);
 
-  normal_distribution<> deltaTransEffective(
-      deltaTrans,
-      alpha[2] * deltaTrans + alpha[3] * fabs(deltaRot + deltaFinalRot));
+    // Create an error model based on a gaussian distribution
+    normal_distribution<> deltaRotEffective(
+        deltaRot, alpha[0] * fabs(deltaRot) + alpha[1] * deltaTrans);
 
-  normal_distribution<> deltaFinalRotEffective(
-      deltaFinalRot, alpha[0] * fabs(deltaFinalRot) + alpha[1] * deltaTrans);
+    normal_distribution<> deltaTransEffective(
+        deltaTrans,
+        alpha[2] * deltaTrans + alpha[3] * fabs(deltaRot + deltaFinalRot));
 
-  for (uint i = 0; i < nParticles_; i++)
-  {
-    // Rotate to final position
-    particles_[O_THETA + robot_offset][i] += deltaRotEffective(seed_);
+    normal_distribution<> deltaFinalRotEffective(
+        deltaFinalRot, alpha[0] * fabs(deltaFinalRot) + alpha[1] * deltaTrans);
 
-    pdata_t sampleTrans = deltaTransEffective(seed_);
+    // Only this robot's distinct subparticles are propagated
+    const uint n = robotParticles_[robotNumber];
 
-    // Translate to final position
-    particles_[O_X + robot_offset][i] +=
-        sampleTrans * cos(particles_[O_THETA + robot_offset][i]);
-    particles_[O_Y + robot_offset][i] +=
-        sampleTrans * sin(particles_[O_THETA + robot_offset][i]);
+    for (uint i = 0; i < n; i++)
+    {
+      // Rotate to final position
+      particles_[O_THETA + robot_offset][i] += deltaRotEffective(seed_);
 
-    // Rotate to final position and normalize angle
-    particles_[O_THETA + robot_offset][i] = angles::normalize_angle(
-        particles_[O_THETA + robot_offset][i] + deltaFinalRotEffective(seed_));
-  }
+      pdata_t sampleTrans = deltaTransEffective(seed_);
 
-  // Check if we should activate robotRandom
-  // Only if no landmarks and no target seen
-  uint nLandmarksSeen = 0;
-  for (std::vector<LandmarkObservation>::iterator it =
-           bufLandmarkObservations_[robotNumber].begin();
-       it != bufLandmarkObservations_[robotNumber].end(); ++it)
-  {
-    if (it->found)
-      nLandmarksSeen++;
-  }
+      // Translate to final position
+      particles_[O_X + robot_offset][i] +=
+          sampleTrans * cos(particles_[O_THETA + robot_offset][i]);
+      particles_[O_Y + robot_offset][i] +=
+          sampleTrans * sin(particles_[O_THETA + robot_offset][i]);
 
-  if (nLandmarksSeen == 0 && !bufTargetObservations_[robotNumber].found)
-  {
-    // Randomize a bit for this robot since it does not see landmarks and target
-    // isn't seen
-    boost::random::uniform_real_distribution<> randPar(-0.05, 0.05);
+      // Rotate to final position and normalize angle
+      particles_[O_THETA + robot_offset][i] =
+          angles::normalize_angle(particles_[O_THETA + robot_offset][i] +
+                                  deltaFinalRotEffective(seed_));
+    }
 
-    for (uint p = 0; p < nParticles_; ++p)
+    // Check if we should activate robotRandom
+    // Only if no landmarks and no target seen
+    uint nLandmarksSeen = 0;
+    for (std::vector<LandmarkObservation>::iterator it =
+             bufLandmarkObservations_[robotNumber].begin();
+         it != bufLandmarkObservations_[robotNumber].end(); ++it)
     {
-      for (uint s = 0; s < nStatesPerRobot_; ++s)
-        particles_[robot_offset + s][p] += randPar(seed_);
+      if (it->found)
+        nLandmarksSeen++;
     }
+
+    // With the regularized PF, resampling already keeps the particles diverse
+    if (nLandmarksSeen == 0 && !bufTargetObservations_[robotNumber].found &&
+        !dynamicVariables_.regularized)
+    {
+      // Randomize a bit for this robot since it does not see landmarks and
+      // target isn't seen
+      boost::random::uniform_real_distribution<> randPar(-0.05, 0.05);
+      HaltonSequence halton(nStatesPerRobot_);
+      halton.scramble(seed_);
+
+      for (uint p = 0; p < n; ++p)
+      {
+        for (uint s = 0; s < nStatesPerRobot_; ++s)
+          particles_[robot_offset + s][p] +=
+              dynamicVariables_.quasiRandom ? 0.1 * halton(p, s) - 0.05
+                                            : randPar(seed_);
+      }
+    }
+
+    replicateRobotBlock(robotNumber);
   }
 
   // If this is the main robot, perform one PF-UCLT iteration
@@ -757,41 +2454,212 @@ void ParticleFilter::predict(const uint robotNumber, const Odometry odom,
     // Lock mutex
     boost::mutex::scoped_lock(mutex_);
 
-    // All the PF-UCLT steps
-    predictTarget();
-    fuseRobots();
-    fuseTarget();
-    resample();
-    estimate();
+    // Every observation received since the last iteration is fused in this one
+    collectFusedLatencies();
 
-    ROS_INFO("(WALL TIME) Odometry analyzed with = %fms",
-             1e3 * odometryTime_.diff);
+    ros::WallTime t = ros::WallTime::now();
 
-    deltaIteration_ = ros::WallTime::now() - iterationEvalTime_;
+    if (ekfActive_)
+    {
+      iterateEKF();
+      observeStage("iterateEKF", t);
+    }
+    else
+    {
+      // All the PF-UCLT steps, each timed for the metrics
+      predictTarget();
+      t = observeStage("predictTarget", t);
+      fuseRobots();
+      t = observeStage("fuseRobots", t);
+      fuseTarget();
+      t = observeStage("fuseTarget", t);
+
+      // Decentralized mode - fuse the teammates' beliefs and share this one's
+      exchangeBeliefs(stamp);
+      if (beliefs_)
+        t = observeStage("exchangeBeliefs", t);
+
+      // Sharded mode - estimate from every shard, before resampling locally
+      bool estimated = exchangeShards(stamp);
+      if (shards_)
+        t = observeStage("exchangeShards", t);
+
+      resample();
+      t = observeStage("resample", t);
+      if (!estimated)
+        estimate();
+      t = observeStage("estimate", t);
+
+      // Hybrid mode - switch to the EKF if the particles have converged
+      checkHybridSwitch();
+    }
+
+    estimateComputedTime_ = ros::WallTime::now();
+    deltaIteration_ = estimateComputedTime_ - iterationEvalTime_;
     if (deltaIteration_ > maxDeltaIteration_)
       maxDeltaIteration_ = deltaIteration_;
 
     durationSum += deltaIteration_;
     numberIterations++;
 
-    ROS_INFO_STREAM("(WALL TIME) Iteration time: "
-                    << 1e-6 * deltaIteration_.toNSec() << "ms ::: Worst case: "
-                    << 1e-6 * maxDeltaIteration_.toNSec() << "ms ::: Average: "
-                    << 1e-6 * (durationSum.toNSec() / numberIterations) << "ms");
+    // Formatted by the logging thread, at most once per log period
+    logger_.log(ros::console::levels::Info,
+                "(WALL TIME) Odometry analyzed with = %fms",
+                LogArgs() << 1e3 * odometryTime_.diff);
+    logger_.log(ros::console::levels::Info,
+                "(WALL TIME) Iteration time: %fms ::: Worst case: %fms ::: "
+                "Average: %fms",
+                LogArgs() << 1e-6 * deltaIteration_.toNSec()
+                          << 1e-6 * maxDeltaIteration_.toNSec()
+                          << 1e-6 * (durationSum.toNSec() / numberIterations));
+
+    updateIterationMetrics();
 
     // ROS_DEBUG("Iteration: %s", iteration_oss->str().c_str());
     // Clear ostringstream
     iteration_oss->str("");
     iteration_oss->clear();
 
+    // Without publishing, the estimate is available once computed
+    stampLatencies(estimateComputedTime_);
+
     // Start next iteration
     nextIteration();
+
+    recordLatencyMetrics();
   }
 }
 
 void ParticleFilter::saveAllLandmarkMeasurementsDone(const uint robotNumber)
 {
   *iteration_oss << "allLandmarks(OMNI" << robotNumber + 1 << ") -> ";
+
+  // Seed this robot's particles as soon as it sees enough landmarks
+  if (initialized_ && landmarkInitPending_[robotNumber] &&
+      seedRobotFromLandmarks(robotNumber))
+    landmarkInitPending_[robotNumber] = false;
+}
+
+void ParticleFilter::initFromLandmarks()
+{
+  for (uint r = 0; r < nRobots_; ++r)
+  {
+    if (robotsUsed_[r])
+      initFromLandmarks(r);
+  }
+}
+
+void ParticleFilter::initFromLandmarks(const uint r)
+{
+  landmarkInitPending_[r] = true;
+
+  ROS_INFO("OMNI%d particles will be seeded from its first landmark "
+           "observations",
+           r + 1);
+}
+
+bool ParticleFilter::seedRobotFromLandmarks(const uint r, const uint first)
+{
+  std::vector<uint> seen;
+  for (uint l = 0; l < nLandmarks_; ++l)
+  {
+    if (bufLandmarkObservations_[r][l].found)
+      seen.push_back(l);
+  }
+
+  if (seen.size() < 2)
+    return false;
+
+  // Pose hypotheses, one for each consistent pair of landmarks seen
+  subparticles_t hx, hy, htheta;
+  std::vector<double> hSigma, hSigmaTheta;
+
+  for (uint i = 0; i < seen.size(); ++i)
+  {
+    for (uint j = i + 1; j < seen.size(); ++j)
+    {
+      const LandmarkObservation& a = bufLandmarkObservations_[r][seen[i]];
+      const LandmarkObservation& b = bufLandmarkObservations_[r][seen[j]];
+      const Landmark& La = landmarksMap_[seen[i]];
+      const Landmark& Lb = landmarksMap_[seen[j]];
+
+      // Segment between the landmarks in the global and robot frames
+      double lx = Lb.x - La.x, ly = Lb.y - La.y;
+      double zx = b.x - a.x, zy = b.y - a.y;
+      double lNorm = sqrt(lx * lx + ly * ly), zNorm = sqrt(zx * zx + zy * zy);
+      double sigma = sqrt(0.25 * (a.covXX + a.covYY + b.covXX + b.covYY));
+
+      // Skip pairs too close together or whose observed distance doesn't
+      // match the map
+      if (lNorm < LANDMARK_INIT_MIN_BASELINE ||
+          fabs(lNorm - zNorm) > LANDMARK_INIT_MAX_SIGMAS * 2 * sigma)
+        continue;
+
+      // Rotation aligns the segments, translation aligns their midpoints
+      double theta = atan2(ly, lx) - atan2(zy, zx);
+      double c = cos(theta), s = sin(theta);
+      double mzx = 0.5 * (a.x + b.x), mzy = 0.5 * (a.y + b.y);
+
+      hx.push_back(0.5 * (La.x + Lb.x) - (c * mzx - s * mzy));
+      hy.push_back(0.5 * (La.y + Lb.y) - (s * mzx + c * mzy));
+      htheta.push_back(angles::normalize_angle(theta));
+      hSigma.push_back(sigma);
+      hSigmaTheta.push_back(2 * sigma / zNorm);
+    }
+  }
+
+  if (hx.empty())
+    return false;
+
+  // Weigh the hypotheses with every landmark seen by this robot
+  subparticles_t hWeights(hx.size(), 1.0);
+  landmarkLikelihood(r, hx, hy, htheta, hWeights,
+                     tuner_.config(KernelTuner::FUSE_ROBOTS));
+
+  std::vector<double> cumulative(hx.size());
+  double sum = 0.0;
+  for (uint h = 0; h < hx.size(); ++h)
+  {
+    // If all are unlikely, use them uniformly
+    sum += (hWeights[h] > 0 ? hWeights[h] : MIN_WEIGHTSUM);
+    cumulative[h] = sum;
+  }
+
+  // Seed the particles around the hypotheses
+  uint o_robot = r * nStatesPerRobot_;
+  boost::random::uniform_real_distribution<> pick(0, sum);
+  boost::random::normal_distribution<> normal(0.0, 1.0);
+
+  for (uint p = first; p < nParticles_; ++p)
+  {
+    uint h = std::min(
+        (uint)(std::upper_bound(cumulative.begin(), cumulative.end(),
+                                pick(seed_)) -
+               cumulative.begin()),
+        (uint)hx.size() - 1);
+
+    particles_[o_robot + O_X][p] = hx[h] + hSigma[h] * normal(seed_);
+    particles_[o_robot + O_Y][p] = hy[h] + hSigma[h] * normal(seed_);
+    particles_[o_robot + O_THETA][p] = angles::normalize_angle(
+        htheta[h] + hSigmaTheta[h] * normal(seed_));
+  }
+
+  // Only part of the particles were replaced, keep the current belief
+  if (first > 0)
+    return true;
+
+  // Initial belief is the most likely hypothesis
+  uint best = std::max_element(hWeights.begin(), hWeights.end()) -
+              hWeights.begin();
+  state_.robots[r].pose[O_X] = hx[best];
+  state_.robots[r].pose[O_Y] = hy[best];
+  state_.robots[r].pose[O_THETA] = htheta[best];
+
+  ROS_INFO("OMNI%d particles seeded from %d landmark pair hypotheses, best at "
+           "{%.2f;%.2f;%.2f}",
+           r + 1, (int)hx.size(), hx[best], hy[best], htheta[best]);
+
+  return true;
 }
 
 void ParticleFilter::saveAllTargetMeasurementsDone(const uint robotNumber)
@@ -805,12 +2673,74 @@ ParticleFilter::dynamicVariables_s::dynamicVariables_s(ros::NodeHandle& nh,
 {
   // Get node parameters, assume they exist
   readParam<double>(nh, "percentage_to_keep", resamplingPercentageToKeep);
+  readParam<bool>(nh, "regularized", regularized);
+  readParam<bool>(nh, "factorized", factorized);
 
   readParam<int>(nh, "particles", nParticles);
 
   readParam<double>(nh, "predict_model_stddev", targetRandStddev);
   oldTargetRandSTddev = targetRandStddev;
 
+  readParam<bool>(nh, "auxiliary_pf", auxiliaryPF);
+  readParam<double>(nh, "target_observation_proposal",
+                    targetObsProposalRatio);
+
+  readParam<bool>(nh, "hybrid_ekf", hybrid);
+  readParam<double>(nh, "hybrid_conf_threshold", hybridConfThreshold);
+  readParam<int>(nh, "hybrid_converged_iterations", hybridConvergedIterations);
+  readParam<double>(nh, "hybrid_innovation_gate", hybridInnovationGate);
+  readParam<double>(nh, "hybrid_divergence_factor", hybridDivergenceFactor);
+
+  readParam<bool>(nh, "sensor_resetting", sensorResetting);
+  readParam<double>(nh, "recovery_alpha_slow", recoveryAlphaSlow);
+  readParam<double>(nh, "recovery_alpha_fast", recoveryAlphaFast);
+
+  readParam<bool>(nh, "quasi_random", quasiRandom);
+
+  readParam<bool>(nh, "robot_budgets", robotBudgets);
+  readParam<double>(nh, "robot_budget_ratio", robotBudgetRatio);
+  readParam<int>(nh, "robot_min_particles", robotMinParticles);
+
+  readParam<int>(nh, "large_scale_threshold", largeScaleThreshold);
+  readParam<double>(nh, "memory_budget_mb", memoryBudgetMB);
+  readParam<int>(nh, "publish_max_particles", publishMaxParticles);
+
+  readParam<int>(nh, "metrics_port", metricsPort);
+  readParam<double>(nh, "diagnostics_period", diagnosticsPeriod);
+
+  readParam<double>(nh, "log_period", logPeriod);
+
+  readParam<bool>(nh, "autotune", autotune);
+  readParam<int>(nh, "autotune_samples", autotuneSamples);
+  readParam<int>(nh, "autotune_retune_period", autotuneRetunePeriod);
+  readParam<std::string>(nh, "autotune_export_file", autotuneExportFile);
+
+  readParam<std::string>(nh, "record_file", recordFile);
+  readParam<bool>(nh, "record_particles", recordParticles);
+  readParam<int>(nh, "record_particles_period", recordParticlesPeriod);
+  readParam<bool>(nh, "record_particles_compressed", recordParticlesCompressed);
+
+  readParam<int>(nh, "stream_keyframe_period", streamKeyframePeriod);
+  readParam<double>(nh, "stream_position_step", streamPositionStep);
+  readParam<double>(nh, "stream_angle_step", streamAngleStep);
+
+  readParam<int>(nh, "shard_count", shardCount);
+  readParam<int>(nh, "shard_index", shardIndex);
+  readParam<std::string>(nh, "shard_address", shardAddress);
+  readParam<double>(nh, "shard_timeout", shardTimeout);
+  readParam<int>(nh, "shard_exchange_particles", shardExchangeParticles);
+
+  readParam<bool>(nh, "belief_exchange", beliefExchange);
+  readParam<std::string>(nh, "belief_address", beliefAddress);
+  readParam<std::string>(nh, "belief_peers", beliefPeers);
+  readParam<double>(nh, "belief_period", beliefPeriod);
+  readParam<int>(nh, "belief_components", beliefComponents);
+  readParam<double>(nh, "belief_max_age", beliefMaxAge);
+  readParam<double>(nh, "belief_fusion_weight", beliefFusionWeight);
+
+  // The particles are those of the whole filter, split across the shards
+  nParticles = shardParticles(nParticles);
+
   // Get alpha values for some robots (hard-coded for our 4 robots..)
   for (uint r = 0; r < nRobots; ++r)
   {
@@ -825,6 +2755,92 @@ ParticleFilter::dynamicVariables_s::dynamicVariables_s(ros::NodeHandle& nh,
   }
 }
 
+ParticleFilter::dynamicVariables_s::dynamicVariables_s(
+    const DynamicConfig& config, const uint nRobots)
+    : firstCallback(true), alpha(nRobots, std::vector<float>(NUM_ALPHAS))
+{
+  resamplingPercentageToKeep = config.percentage_to_keep;
+  regularized = config.regularized;
+  factorized = config.factorized;
+
+  nParticles = config.particles;
+
+  targetRandStddev = config.predict_model_stddev;
+  oldTargetRandSTddev = targetRandStddev;
+
+  auxiliaryPF = config.auxiliary_pf;
+  targetObsProposalRatio = config.target_observation_proposal;
+
+  hybrid = config.hybrid_ekf;
+  hybridConfThreshold = config.hybrid_conf_threshold;
+  hybridConvergedIterations = config.hybrid_converged_iterations;
+  hybridInnovationGate = config.hybrid_innovation_gate;
+  hybridDivergenceFactor = config.hybrid_divergence_factor;
+
+  sensorResetting = config.sensor_resetting;
+  recoveryAlphaSlow = config.recovery_alpha_slow;
+  recoveryAlphaFast = config.recovery_alpha_fast;
+
+  quasiRandom = config.quasi_random;
+
+  robotBudgets = config.robot_budgets;
+  robotBudgetRatio = config.robot_budget_ratio;
+  robotMinParticles = config.robot_min_particles;
+
+  largeScaleThreshold = config.large_scale_threshold;
+  memoryBudgetMB = config.memory_budget_mb;
+  publishMaxParticles = config.publish_max_particles;
+
+  metricsPort = config.metrics_port;
+  diagnosticsPeriod = config.diagnostics_period;
+
+  logPeriod = config.log_period;
+
+  autotune = config.autotune;
+  autotuneSamples = config.autotune_samples;
+  autotuneRetunePeriod = config.autotune_retune_period;
+  autotuneExportFile = config.autotune_export_file;
+
+  recordFile = config.record_file;
+  recordParticles = config.record_particles;
+  recordParticlesPeriod = config.record_particles_period;
+  recordParticlesCompressed = config.record_particles_compressed;
+
+  streamKeyframePeriod = config.stream_keyframe_period;
+  streamPositionStep = config.stream_position_step;
+  streamAngleStep = config.stream_angle_step;
+
+  shardCount = config.shard_count;
+  shardIndex = config.shard_index;
+  shardAddress = config.shard_address;
+  shardTimeout = config.shard_timeout;
+  shardExchangeParticles = config.shard_exchange_particles;
+
+  beliefExchange = config.belief_exchange;
+  beliefAddress = config.belief_address;
+  beliefPeers = config.belief_peers;
+  beliefPeriod = config.belief_period;
+  beliefComponents = config.belief_components;
+  beliefMaxAge = config.belief_max_age;
+  beliefFusionWeight = config.belief_fusion_weight;
+
+  // The particles are those of the whole filter, split across the shards
+  nParticles = shardParticles(nParticles);
+
+  // The configuration only has alpha values for some robots
+  for (uint r = 0; r < nRobots; ++r)
+    fill_alpha(r, "0.015,0.1,0.5,0.001");
+
+  if (nRobots > 0)
+    fill_alpha(0, config.OMNI1_alpha);
+  if (nRobots > 2)
+    fill_alpha(2, config.OMNI3_alpha);
+  if (nRobots > 3)
+    fill_alpha(3, config.OMNI4_alpha);
+  if (nRobots > 4)
+    fill_alpha(4, config.OMNI5_alpha);
+}
+
 void ParticleFilter::dynamicVariables_s::fill_alpha(const uint robot,
                                                     const std::string& str)
 {
@@ -8,33 +8,43 @@ PFPublisher::PFPublisher(struct ParticleFilter::PFinitData &data,
         : ParticleFilter(data), pubData(publishData),
           particleStdPublishers_(data.nRobots),
           robotGTPublishers_(data.nRobots), robotEstimatePublishers_(data.nRobots),
-          robotBroadcasters(data.nRobots){
+          robotBroadcasters(data.nRobots),
+          streamEncoder_(streamBlockSizes(), streamSteps(),
+                         dynamicVariables_.streamKeyframePeriod),
+          iterationsSinceParticlesRecorded_(0) {
     // Prepare particle message
     resize_particles(nParticles_);
 
     // Subscribe to GT data
-    GT_sub_ = nh_.subscribe<read_omni_dataset::LRMGTData>(
+    GT_sub_ = nh_->subscribe<read_omni_dataset::LRMGTData>(
             "/gtData_4robotExp", 10,
             boost::bind(&PFPublisher::gtDataCallback, this, _1));
 
     // Other publishers
     estimatePublisher_ =
-            nh_.advertise<read_omni_dataset::Estimate>("/pfuclt_estimate", 100);
+            nh_->advertise<read_omni_dataset::Estimate>("/pfuclt_estimate", 100);
     particlePublisher_ =
-            nh_.advertise<pfuclt_omni_dataset::particles>("/pfuclt_particles", 10);
+            nh_->advertise<pfuclt_omni_dataset::particles>("/pfuclt_particles", 10);
+    compressedParticlePublisher_ =
+            nh_->advertise<pfuclt_omni_dataset::compressed_particles>(
+                    "/pfuclt_particles_compressed", 10,
+                    boost::bind(&PFPublisher::compressedParticlesConnected, this,
+                                _1));
+    latencyPublisher_ =
+            nh_->advertise<pfuclt_omni_dataset::latencies>("/pfuclt_latency", 100);
 
     // Rviz visualization publishers
     // Target
     targetEstimatePublisher_ =
-            nh_.advertise<geometry_msgs::PointStamped>("/target/estimatedPose", 1000);
+            nh_->advertise<geometry_msgs::PointStamped>("/target/estimatedPose", 1000);
     targetGTPublisher_ =
-            nh_.advertise<geometry_msgs::PointStamped>("/target/gtPose", 1000);
+            nh_->advertise<geometry_msgs::PointStamped>("/target/gtPose", 1000);
     targetParticlePublisher_ =
-            nh_.advertise<sensor_msgs::PointCloud>("/target/particles", 10);
+            nh_->advertise<sensor_msgs::PointCloud>("/target/particles", 10);
 
     // target observations publisher
     targetObservationsPublisher_ =
-            nh_.advertise<visualization_msgs::Marker>("/targetObservations", 100);
+            nh_->advertise<visualization_msgs::Marker>("/targetObservations", 100);
 
     // Robots
     for (uint r = 0; r < nRobots_; ++r) {
@@ -42,11 +52,11 @@ PFPublisher::PFPublisher(struct ParticleFilter::PFinitData &data,
         robotName << "omni" << r + 1;
 
         // particle publisher
-        particleStdPublishers_[r] = nh_.advertise<geometry_msgs::PoseArray>(
+        particleStdPublishers_[r] = nh_->advertise<geometry_msgs::PoseArray>(
                 "/" + robotName.str() + "/particles", 1000);
 
         // estimated state
-        robotEstimatePublishers_[r] = nh_.advertise<geometry_msgs::PoseStamped>(
+        robotEstimatePublishers_[r] = nh_->advertise<geometry_msgs::PoseStamped>(
                 "/" + robotName.str() + "/estimatedPose", 1000);
 
         // build estimate msg
@@ -55,29 +65,58 @@ PFPublisher::PFPublisher(struct ParticleFilter::PFinitData &data,
 
 // ground truth publisher, in the simulation package we have PoseStamped
 #ifndef USE_NEWER_READ_OMNI_PACKAGE
-        robotGTPublishers_[r] = nh_.advertise<geometry_msgs::PointStamped>(
+        robotGTPublishers_[r] = nh_->advertise<geometry_msgs::PointStamped>(
                 "/" + robotName.str() + "/gtPose", 1000);
 #else
-        robotGTPublishers_[r] = nh_.advertise<geometry_msgs::PoseStamped>(
+        robotGTPublishers_[r] = nh_->advertise<geometry_msgs::PoseStamped>(
                 "/" + robotName.str() + "/gtPose", 1000);
 #endif
     }
 
+    // Results are recorded in this process instead of by rosbag record
+    if (!dynamicVariables_.recordFile.empty())
+        recorder_ = boost::shared_ptr<ResultRecorder>(
+                new ResultRecorder(dynamicVariables_.recordFile));
+
     ROS_INFO("It's a publishing particle filter!");
 }
 
+void PFPublisher::resizeParticleMessage(const uint n) {
+    msg_particles_.particles.resize(n);
+    for (uint p = 0; p < n; ++p) {
+        msg_particles_.particles[p].particle.resize(nSubParticleSets_);
+    }
+}
+
 void PFPublisher::publishParticles() {
+    // Large particle sets are downsampled, the stride may change at runtime
+    const uint stride = publishStride();
+    const uint nPublished = (nParticles_ + stride - 1) / stride;
+    if (msg_particles_.particles.size() != nPublished)
+        resizeParticleMessage(nPublished);
+
     // The eval package would rather have the particles in the format
     // particle->subparticle instead, so we have to inverse it
-    for (uint p = 0; p < nParticles_; ++p) {
+    for (uint i = 0; i < nPublished; ++i) {
         for (uint s = 0; s < nSubParticleSets_; ++s) {
-            msg_particles_.particles[p].particle[s] = particles_[s][p];
+            msg_particles_.particles[i].particle[s] = particles_[s][i * stride];
         }
     }
 
     // Send it!
     particlePublisher_.publish(msg_particles_);
 
+    publishCompressedParticles(stride);
+
+    if (recorder_ && dynamicVariables_.recordParticles &&
+        !dynamicVariables_.recordParticlesCompressed &&
+        ++iterationsSinceParticlesRecorded_ >=
+                (uint) dynamicVariables_.recordParticlesPeriod) {
+        recorder_->record(particlePublisher_.getTopic(), ros::Time::now(),
+                          msg_particles_);
+        iterationsSinceParticlesRecorded_ = 0;
+    }
+
     // Also send as a series of PoseArray messages for each robot
     for (uint r = 0; r < nRobots_; ++r) {
         if (false == robotsUsed_[r])
@@ -87,8 +126,12 @@ void PFPublisher::publishParticles() {
         geometry_msgs::PoseArray msgStd_particles;
         msgStd_particles.header.stamp = savedLatestObservationTime_;
         msgStd_particles.header.frame_id = "world";
+        msgStd_particles.poses.reserve(nPublished);
 
-        for (uint p = 0; p < nParticles_; ++p) {
+        // Last to first, the same order as before without inserting at the
+        // front
+        for (int i = nPublished - 1; i >= 0; --i) {
+            uint p = i * stride;
             tf2::Quaternion tf2q(tf2::Vector3(0, 0, 1),
                                  particles_[o_robot + O_THETA][p]);
             tf2::Transform tf2t(tf2q, tf2::Vector3(particles_[o_robot + O_X][p],
@@ -97,7 +140,7 @@ void PFPublisher::publishParticles() {
 
             geometry_msgs::Pose pose;
             tf2::toMsg(tf2t, pose);
-            msgStd_particles.poses.insert(msgStd_particles.poses.begin(), pose);
+            msgStd_particles.poses.push_back(pose);
         }
 
         particleStdPublishers_[r].publish(msgStd_particles);
@@ -107,18 +150,66 @@ void PFPublisher::publishParticles() {
     sensor_msgs::PointCloud target_particles;
     target_particles.header.stamp = ros::Time::now();
     target_particles.header.frame_id = "world";
+    target_particles.points.reserve(nPublished);
 
-    for (uint p = 0; p < nParticles_; ++p) {
+    for (int i = nPublished - 1; i >= 0; --i) {
+        uint p = i * stride;
         geometry_msgs::Point32 point;
         point.x = particles_[O_TARGET + O_TX][p];
         point.y = particles_[O_TARGET + O_TY][p];
-        point.z = particles_[O_TARGET + O_TZ][p];
+        point.z = (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+                      ? particles_[O_TARGET + O_TZ][p]
+                      : 0.0;
 
-        target_particles.points.insert(target_particles.points.begin(), point);
+        target_particles.points.push_back(point);
     }
     targetParticlePublisher_.publish(target_particles);
 }
 
+std::vector<uint> PFPublisher::streamBlockSizes() {
+    std::vector<uint> blockSizes(nRobots_, nStatesPerRobot_);
+    blockSizes.insert(blockSizes.end(), nTargets_, nStatesPerTarget_);
+    blockSizes.push_back(1);
+
+    return blockSizes;
+}
+
+std::vector<float> PFPublisher::streamSteps() {
+    std::vector<float> steps(nSubParticleSets_,
+                             dynamicVariables_.streamPositionStep);
+
+    for (uint r = 0; r < nRobots_; ++r)
+        steps[r * nStatesPerRobot_ + O_THETA] =
+                dynamicVariables_.streamAngleStep;
+
+    // Weights are quantized relative to the largest one
+    steps[O_WEIGHT] = 0;
+
+    return steps;
+}
+
+void PFPublisher::publishCompressedParticles(const uint stride) {
+    bool record = recorder_ && dynamicVariables_.recordParticles &&
+                  dynamicVariables_.recordParticlesCompressed;
+
+    if (!record && compressedParticlePublisher_.getNumSubscribers() == 0)
+        return;
+
+    streamEncoder_.encode(particles_, stride, msg_compressed_particles_);
+    msg_compressed_particles_.header.stamp = savedLatestObservationTime_;
+    msg_compressed_particles_.header.frame_id = "world";
+
+    compressedParticlePublisher_.publish(msg_compressed_particles_);
+    if (record)
+        recorder_->record(compressedParticlePublisher_.getTopic(),
+                          ros::Time::now(), msg_compressed_particles_);
+}
+
+void PFPublisher::compressedParticlesConnected(
+        const ros::SingleSubscriberPublisher &) {
+    streamEncoder_.forceKeyframe();
+}
+
 void PFPublisher::publishRobotStates() {
     // This is pretty much copy and paste
     for (uint r = 0; r < nRobots_; ++r) {
@@ -165,7 +256,12 @@ void PFPublisher::publishTargetState() {
     // Our custom message type
     msg_estimate_.targetEstimate.x = state_.target.pos[O_TX];
     msg_estimate_.targetEstimate.y = state_.target.pos[O_TY];
-    msg_estimate_.targetEstimate.z = state_.target.pos[O_TZ];
+    // A 2D target is on the ground plane
+    pdata_t targetZ = (nStatesPerTarget_ == STATES_PER_TARGET_3D)
+                          ? state_.target.pos[O_TZ]
+                          : 0.0;
+
+    msg_estimate_.targetEstimate.z = targetZ;
     msg_estimate_.targetEstimate.found = state_.target.seen;
 
     for (uint r = 0; r < nRobots_; ++r) {
@@ -178,7 +274,7 @@ void PFPublisher::publishTargetState() {
     estPoint.header.frame_id = "world";
     estPoint.point.x = state_.target.pos[O_TX];
     estPoint.point.y = state_.target.pos[O_TY];
-    estPoint.point.z = state_.target.pos[O_TZ];
+    estPoint.point.z = targetZ;
 
     targetEstimatePublisher_.publish(estPoint);
 }
@@ -189,7 +285,37 @@ void PFPublisher::publishEstimate() {
     msg_estimate_.computationTime = deltaIteration_.toNSec() * 1e-9;
     msg_estimate_.converged = converged_;
 
+    stampLatencies(ros::WallTime::now());
     estimatePublisher_.publish(msg_estimate_);
+    if (recorder_)
+        recorder_->record(estimatePublisher_.getTopic(), ros::Time::now(),
+                          msg_estimate_);
+
+    publishLatencies();
+}
+
+void PFPublisher::publishLatencies() {
+    msg_latencies_.header.stamp = msg_estimate_.header.stamp;
+    msg_latencies_.latencies.resize(fusedLatencies_.size());
+
+    for (uint i = 0; i < fusedLatencies_.size(); ++i) {
+        const ObservationLatency &l = fusedLatencies_[i];
+        pfuclt_omni_dataset::latency &msg = msg_latencies_.latencies[i];
+
+        msg.robot = l.robot + 1;
+        msg.sensor = sensorName(l.sensor);
+        msg.stamp = l.stamp;
+        msg.transport = l.transport;
+        msg.queue = l.queue;
+        msg.compute = l.compute;
+        msg.publish = l.publish;
+        msg.total = l.total();
+    }
+
+    latencyPublisher_.publish(msg_latencies_);
+    if (recorder_)
+        recorder_->record(latencyPublisher_.getTopic(), ros::Time::now(),
+                          msg_latencies_);
 }
 
 void PFPublisher::publishTargetObservations() {
@@ -313,14 +439,20 @@ void PFPublisher::publishGTData() {
 void PFPublisher::gtDataCallback(
         const read_omni_dataset::LRMGTData::ConstPtr &gtMsgReceived) {
     msg_GT_ = *gtMsgReceived;
+
+    // Recorded with the results, for the evaluation
+    if (recorder_)
+        recorder_->record(GT_sub_.getTopic(), ros::Time::now(), msg_GT_);
 }
 
 void PFPublisher::nextIteration() {
     // Call the base class method
     ParticleFilter::nextIteration();
 
-    // Publish the particles first
-    publishParticles();
+    // Publish the particles first, unless the hybrid mode is using the EKF and
+    // they're not being updated
+    if (!isEKFActive())
+        publishParticles();
 
     // Publish robot states
     publishRobotStates();
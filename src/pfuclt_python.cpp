@@ -0,0 +1,413 @@
+// Python bindings of the particle filter, built as the pfuclt_py module when
+// pybind11 is available. Unlike the rest of the package this needs C++11
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <pfuclt_omni_dataset/pfuclt_particles.h>
+#include <dynamic_reconfigure/config_tools.h>
+#include <boost/shared_ptr.hpp>
+#include <cstdlib>
+
+#define PY_STATES_PER_ROBOT 3
+
+namespace py = pybind11;
+
+namespace pfuclt_omni_dataset
+{
+/**
+ * @brief The PyFilterData struct - data the ParticleFilter keeps references
+ * to, owned by the Python object, and constructed before the filter itself
+ */
+struct PyFilterData
+{
+  boost::shared_ptr<ros::NodeHandle> nh; // only with a namespace
+  boost::shared_ptr<ParticleFilter::dynamicVariables_s> parameters;
+  std::vector<bool> robotsUsed;
+  std::vector<Landmark> landmarks;
+  boost::shared_ptr<ParticleFilter::PFinitData> initData;
+
+  PyFilterData(const py::dict& params, const py::object& ns,
+               const uint mainRobotID, const std::vector<bool>& robotsUsed,
+               const std::vector<std::pair<float, float> >& landmarkPositions,
+               const uint nTargets, const uint statesPerTarget)
+      : robotsUsed(robotsUsed), landmarks(toLandmarks(landmarkPositions))
+  {
+    const uint nRobots = this->robotsUsed.size();
+
+    if (!ns.is_none())
+    {
+      if (params.size() > 0)
+        throw py::value_error("params can't be given with a namespace, the "
+                              "parameters are read from the server");
+
+      nh.reset(new ros::NodeHandle(ns.cast<std::string>()));
+
+      // Parameters not on the server yet take the dynamic reconfigure
+      // defaults, as the filter reads them at construction
+      DynamicConfig config = DynamicConfig::__getDefault__();
+      config.__fromServer__(*nh);
+      config.__toServer__(*nh);
+
+      initData.reset(new ParticleFilter::PFinitData(
+          *nh, mainRobotID, nTargets, PY_STATES_PER_ROBOT, statesPerTarget,
+          nRobots, landmarks.size(), this->robotsUsed, landmarks));
+      return;
+    }
+
+    // Without ROS, the latencies still take ros::Time::now() from the clock
+    if (!ros::isInitialized())
+      ros::Time::init();
+
+    parameters.reset(
+        new ParticleFilter::dynamicVariables_s(toConfig(params), nRobots));
+
+    for (auto item : params)
+    {
+      std::string name = py::str(item.first);
+      int r = alphaRobot(name);
+      if (r < 0)
+        continue;
+
+      if (r >= (int)nRobots)
+        throw py::key_error("no such robot: " + name);
+
+      parameters->fill_alpha(r, item.second.cast<std::string>());
+    }
+
+    initData.reset(new ParticleFilter::PFinitData(
+        *parameters, mainRobotID, nTargets, PY_STATES_PER_ROBOT,
+        statesPerTarget, nRobots, landmarks.size(), this->robotsUsed,
+        landmarks));
+  }
+
+  /**
+   * @brief alphaRobot - the robot of an OMNI<n>_alpha parameter, or -1 for
+   * any other parameter
+   */
+  static int alphaRobot(const std::string& name)
+  {
+    const std::string prefix = "OMNI", suffix = "_alpha";
+    if (name.size() <= prefix.size() + suffix.size() ||
+        name.compare(0, prefix.size(), prefix) != 0 ||
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+      return -1;
+
+    std::string number = name.substr(
+        prefix.size(), name.size() - prefix.size() - suffix.size());
+    if (number.find_first_not_of("0123456789") != std::string::npos)
+      return -1;
+
+    return atoi(number.c_str()) - 1;
+  }
+
+  /**
+   * @brief toConfig - the dynamic reconfigure defaults, with the parameters
+   * given in a dict, converted to each parameter's type and clamped to its
+   * range. The alpha values are left to the caller
+   */
+  static DynamicConfig toConfig(const py::dict& params)
+  {
+    const std::vector<DynamicConfig::AbstractParamDescriptionConstPtr>&
+        descriptions = DynamicConfig::__getParamDescriptions__();
+
+    dynamic_reconfigure::Config msg;
+    for (auto item : params)
+    {
+      std::string name = py::str(item.first);
+      if (alphaRobot(name) >= 0)
+        continue;
+
+      std::string type;
+      for (uint i = 0; i < descriptions.size(); ++i)
+      {
+        if (descriptions[i]->name == name)
+          type = descriptions[i]->type;
+      }
+
+      if (type == "bool")
+        dynamic_reconfigure::ConfigTools::appendParameter(
+            msg, name, item.second.cast<bool>());
+      else if (type == "int")
+        dynamic_reconfigure::ConfigTools::appendParameter(
+            msg, name, item.second.cast<int>());
+      else if (type == "double")
+        dynamic_reconfigure::ConfigTools::appendParameter(
+            msg, name, item.second.cast<double>());
+      else if (type == "str")
+        dynamic_reconfigure::ConfigTools::appendParameter(
+            msg, name, item.second.cast<std::string>());
+      else
+        throw py::key_error("no such parameter: " + name);
+    }
+
+    DynamicConfig config = DynamicConfig::__getDefault__();
+    config.__fromMessage__(msg);
+    config.__clamp__();
+    return config;
+  }
+
+  static std::vector<Landmark>
+  toLandmarks(const std::vector<std::pair<float, float> >& positions)
+  {
+    std::vector<Landmark> landmarks(positions.size());
+    for (uint l = 0; l < positions.size(); ++l)
+    {
+      landmarks[l].serial = l;
+      landmarks[l].x = positions[l].first;
+      landmarks[l].y = positions[l].second;
+    }
+    return landmarks;
+  }
+};
+
+/**
+ * @brief The PyParticleFilter class - a ParticleFilter driven directly from
+ * Python, with its particles and state exposed without copies
+ */
+class PyParticleFilter : private PyFilterData, public ParticleFilter
+{
+public:
+  PyParticleFilter(const uint mainRobotID, const std::vector<bool>& robotsUsed,
+                   const std::vector<std::pair<float, float> >& landmarks,
+                   const uint nTargets, const uint statesPerTarget,
+                   const py::dict& params, const py::object& ns)
+      : PyFilterData(params, ns, mainRobotID, robotsUsed, landmarks, nTargets,
+                     statesPerTarget),
+        ParticleFilter(*initData)
+  {
+  }
+
+  uint numParticles() const { return nParticles_; }
+  uint numSubParticleSets() const { return nSubParticleSets_; }
+  uint numRobots() const { return nRobots_; }
+
+  pdata_t* row(const uint s) { return &particles_.at(s)[0]; }
+
+  pdata_t* robotPose(const uint r) { return &state_.robots.at(r).pose[0]; }
+  pdata_t robotConfidence(const uint r) { return state_.robots.at(r).conf; }
+  pdata_t* targetPosition() { return &state_.target.pos[0]; }
+  bool targetSeen() const { return state_.target.seen; }
+  uint targetSize() const { return state_.target.pos.size(); }
+
+  /**
+   * @brief saveLandmark - save a landmark observation in the robot's frame,
+   * with the same covariance model as the node's landmark callback
+   */
+  void saveLandmark(const uint r, const uint l, const double x, const double y,
+                    const double covDD, const double covPP, const double stamp)
+  {
+    LandmarkObservation obs;
+    obs.found = true;
+    obs.x = x;
+    obs.y = y;
+    obs.d = sqrt(x * x + y * y);
+    obs.phi = atan2(y, x);
+    obs.covDD = covDD;
+    obs.covPP = covPP;
+    fillCovariance(obs);
+
+    saveLandmarkObservation(r, l, obs, ros::Time(stamp));
+  }
+
+  /**
+   * @brief saveTarget - save a target observation in the robot's frame, with
+   * the same covariance model as the node's target callback
+   */
+  void saveTarget(const uint r, const double x, const double y, const double z,
+                  const double covDD, const double covPP, const double stamp)
+  {
+    TargetObservation obs;
+    obs.found = true;
+    obs.x = x;
+    obs.y = y;
+    obs.z = z;
+    obs.d = sqrt(x * x + y * y);
+    obs.r = sqrt(x * x + y * y + z * z);
+    obs.phi = atan2(y, x);
+    obs.covDD = covDD;
+    obs.covPP = covPP;
+    fillCovariance(obs);
+
+    saveTargetObservation(r, obs, ros::Time(stamp));
+  }
+
+private:
+  template <typename Obs> static void fillCovariance(Obs& obs)
+  {
+    const double cos2p = pow(cos(obs.phi), 2);
+    const double sin2p = pow(sin(obs.phi), 2);
+    const double d2 = pow(obs.d, 2);
+
+    obs.covXX =
+        cos2p * obs.covDD + sin2p * (d2 * obs.covPP + obs.covDD * obs.covPP);
+    obs.covYY =
+        sin2p * obs.covDD + cos2p * (d2 * obs.covPP + obs.covDD * obs.covPP);
+  }
+};
+
+/**
+ * @brief view - a numpy array over memory owned by a PyParticleFilter, which
+ * is kept alive by the array
+ */
+static py::array_t<pdata_t> view(py::object owner, pdata_t* data,
+                                 const size_t size)
+{
+  return py::array_t<pdata_t>(std::vector<size_t>(1, size),
+                              std::vector<size_t>(1, sizeof(pdata_t)), data,
+                              owner);
+}
+
+// end of namespace pfuclt_omni_dataset
+}
+
+PYBIND11_MODULE(pfuclt_py, m)
+{
+  using namespace pfuclt_omni_dataset;
+
+  m.doc() = "PF-UCLT particle filter, driven directly from Python";
+
+  m.def("init",
+        [](const std::string& name)
+        {
+          int argc = 0;
+          ros::init(argc, NULL, name,
+                    ros::init_options::NoSigintHandler |
+                        ros::init_options::AnonymousName);
+        },
+        py::arg("name") = "pfuclt_py",
+        "Initialize ROS, once before creating a filter with a namespace, "
+        "which needs a master for the parameters and dynamic reconfigure. "
+        "Filters created without a namespace don't need it");
+
+  py::class_<PyParticleFilter>(m, "ParticleFilter")
+      .def(py::init<uint, const std::vector<bool>&,
+                    const std::vector<std::pair<float, float> >&, uint, uint,
+                    const py::dict&, const py::object&>(),
+           py::arg("main_robot_id"), py::arg("robots_used"),
+           py::arg("landmarks"), py::arg("n_targets") = 1,
+           py::arg("states_per_target") = STATES_PER_TARGET_3D,
+           py::arg("params") = py::dict(), py::arg("namespace") = py::none(),
+           "main_robot_id starts at 1 and landmarks is a list of (x, y). "
+           "Without a namespace the filter runs without ROS: params is a dict "
+           "of the Dynamic.cfg parameters and OMNI<n>_alpha values, the "
+           "others taking their defaults, and there is no dynamic "
+           "reconfigure or diagnostics topic. With a namespace, the "
+           "parameters are read from the server there, after ros init()")
+
+      // Initialization
+      .def("init",
+           [](PyParticleFilter& pf, const std::vector<double>& customRandInit,
+              const std::vector<double>& customPosInit)
+           {
+             if (customRandInit.empty())
+               pf.init();
+             else
+               pf.init(customRandInit, customPosInit);
+           },
+           py::arg("custom_rand_init") = std::vector<double>(),
+           py::arg("custom_pos_init") = std::vector<double>())
+      .def("init_robot", &PyParticleFilter::initRobot, py::arg("robot"),
+           py::arg("custom_rand_init"), py::arg("custom_pos_init"))
+      .def("init_from_landmarks",
+           (void (PyParticleFilter::*)()) & PyParticleFilter::initFromLandmarks)
+      .def("is_initialized",
+           (bool (PyParticleFilter::*)()) & PyParticleFilter::isInitialized)
+
+      // Steps - the main robot's predict runs a whole iteration
+      .def("predict",
+           [](PyParticleFilter& pf, uint robot, double x, double y,
+              double theta, double stamp)
+           {
+             Odometry odom;
+             odom.x = x;
+             odom.y = y;
+             odom.theta = theta;
+             py::gil_scoped_release release;
+             pf.predict(robot, odom, ros::Time(stamp));
+           },
+           py::arg("robot"), py::arg("x"), py::arg("y"), py::arg("theta"),
+           py::arg("stamp"))
+      .def("save_landmark", &PyParticleFilter::saveLandmark, py::arg("robot"),
+           py::arg("landmark"), py::arg("x"), py::arg("y"), py::arg("cov_dd"),
+           py::arg("cov_pp"), py::arg("stamp"))
+      .def("clear_landmark",
+           [](PyParticleFilter& pf, uint robot, uint landmark)
+           { pf.saveLandmarkObservation(robot, landmark, false); },
+           py::arg("robot"), py::arg("landmark"))
+      .def("landmarks_done", &PyParticleFilter::saveAllLandmarkMeasurementsDone,
+           py::arg("robot"))
+      .def("save_target", &PyParticleFilter::saveTarget, py::arg("robot"),
+           py::arg("x"), py::arg("y"), py::arg("z"), py::arg("cov_dd"),
+           py::arg("cov_pp"), py::arg("stamp"))
+      .def("clear_target",
+           [](PyParticleFilter& pf, uint robot)
+           { pf.saveTargetObservation(robot, false); },
+           py::arg("robot"))
+      .def("targets_done", &PyParticleFilter::saveAllTargetMeasurementsDone,
+           py::arg("robot"))
+      .def("update_target_iteration_time",
+           [](PyParticleFilter& pf, double stamp)
+           { pf.updateTargetIterationTime(ros::Time(stamp)); },
+           py::arg("stamp"))
+
+      // Zero-copy views. The filter updates the particles in place, so a view
+      // follows every iteration, but the buffers are reallocated when the
+      // number of particles changes: the particles parameter, the memory
+      // budget or the shards
+      .def_property_readonly("n_particles", &PyParticleFilter::numParticles)
+      .def("row",
+           [](py::object self, uint s)
+           {
+             PyParticleFilter& pf = self.cast<PyParticleFilter&>();
+             if (s >= pf.numSubParticleSets())
+               throw py::index_error("no such subparticle set");
+             return view(self, pf.row(s), pf.numParticles());
+           },
+           py::arg("subparticle_set"),
+           "One subparticle set, e.g. a robot's x for every particle. A view, "
+           "updated in place by every iteration and invalid once the number "
+           "of particles changes")
+      .def_property_readonly(
+           "particles",
+           [](py::object self)
+           {
+             PyParticleFilter& pf = self.cast<PyParticleFilter&>();
+             py::list rows;
+             for (uint s = 0; s < pf.numSubParticleSets(); ++s)
+               rows.append(view(self, pf.row(s), pf.numParticles()));
+             return rows;
+           },
+           "Every subparticle set, the last one being the weights. Views, "
+           "updated in place by every iteration and invalid once the number "
+           "of particles changes")
+      .def_property_readonly(
+           "weights",
+           [](py::object self)
+           {
+             PyParticleFilter& pf = self.cast<PyParticleFilter&>();
+             return view(self, pf.row(pf.O_WEIGHT), pf.numParticles());
+           },
+           "The particle weights. A view, updated in place by every iteration "
+           "and invalid once the number of particles changes")
+      .def("robot_pose",
+           [](py::object self, uint r)
+           {
+             PyParticleFilter& pf = self.cast<PyParticleFilter&>();
+             if (r >= pf.numRobots())
+               throw py::index_error("no such robot");
+             return view(self, pf.robotPose(r), PY_STATES_PER_ROBOT);
+           },
+           py::arg("robot"), "Estimated [x, y, theta] of a robot")
+      .def("robot_confidence", &PyParticleFilter::robotConfidence,
+           py::arg("robot"))
+      .def_property_readonly(
+           "target_position",
+           [](py::object self)
+           {
+             PyParticleFilter& pf = self.cast<PyParticleFilter&>();
+             return view(self, pf.targetPosition(), pf.targetSize());
+           })
+      .def_property_readonly("target_seen", &PyParticleFilter::targetSeen);
+}
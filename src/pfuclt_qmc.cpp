@@ -0,0 +1,48 @@
+#include <pfuclt_omni_dataset/pfuclt_qmc.h>
+#include <algorithm>
+
+// The first primes, one for each dimension
+#define HALTON_PRIMES                                                          \
+  {                                                                            \
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53                 \
+  }
+
+namespace pfuclt_omni_dataset
+{
+
+HaltonSequence::HaltonSequence(const uint dimensions)
+    : shift_(dimensions, 0.0), offset_(0)
+{
+  const uint primes[] = HALTON_PRIMES;
+  uint n = std::min(dimensions, maxDimensions());
+  bases_.assign(primes, primes + n);
+
+  // Beyond the available primes the bases repeat, and those dimensions are
+  // only shifted copies of the first ones
+  for (uint d = n; d < dimensions; ++d)
+    bases_.push_back(primes[d % n]);
+}
+
+uint HaltonSequence::maxDimensions()
+{
+  const uint primes[] = HALTON_PRIMES;
+  return sizeof(primes) / sizeof(primes[0]);
+}
+
+double HaltonSequence::radicalInverse(unsigned long index, const uint base)
+{
+  const double invBase = 1.0 / base;
+  double result = 0.0, f = invBase;
+
+  while (index > 0)
+  {
+    result += f * (index % base);
+    index /= base;
+    f *= invBase;
+  }
+
+  return result;
+}
+
+// end of namespace pfuclt_omni_dataset
+}
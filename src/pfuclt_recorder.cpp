@@ -0,0 +1,94 @@
+#include <pfuclt_omni_dataset/pfuclt_recorder.h>
+
+namespace pfuclt_omni_dataset
+{
+
+ResultRecorder::ResultRecorder(const std::string& filename)
+    : filename_(filename), open_(false), written_(0), failed_(0), stop_(false)
+{
+  try
+  {
+    bag_.open(filename, rosbag::bagmode::Write);
+    open_ = true;
+  }
+  catch (rosbag::BagException& e)
+  {
+    ROS_ERROR("Couldn't open bag \"%s\" to record results: %s",
+              filename.c_str(), e.what());
+    return;
+  }
+
+  thread_ = boost::thread(boost::bind(&ResultRecorder::run, this));
+  ROS_INFO("Recording results to \"%s\"", filename.c_str());
+}
+
+ResultRecorder::~ResultRecorder()
+{
+  if (!open_)
+    return;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+
+  queued_.notify_one();
+  thread_.join();
+  bag_.close();
+
+  ROS_INFO("Recorded %d messages to \"%s\"", written_, filename_.c_str());
+  if (failed_ > 0)
+    ROS_WARN("%d messages couldn't be recorded to \"%s\"", failed_,
+             filename_.c_str());
+}
+
+void ResultRecorder::enqueue(const Entry& entry)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (queue_.size() >= RECORDER_MAX_QUEUE)
+    dequeued_.wait(lock);
+
+  queue_.push_back(entry);
+  queued_.notify_one();
+}
+
+void ResultRecorder::run()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (true)
+  {
+    while (queue_.empty() && !stop_)
+      queued_.wait(lock);
+
+    // Write without holding the lock, so the filter only waits when full
+    std::deque<Entry> entries;
+    entries.swap(queue_);
+    bool stopping = stop_;
+
+    lock.unlock();
+    dequeued_.notify_all();
+
+    for (std::deque<Entry>::const_iterator it = entries.begin();
+         it != entries.end(); ++it)
+    {
+      try
+      {
+        it->message->write(bag_, it->topic, it->time);
+        ++written_;
+      }
+      catch (rosbag::BagException& e)
+      {
+        ++failed_;
+      }
+    }
+    lock.lock();
+
+    if (stopping && queue_.empty())
+      break;
+  }
+}
+
+// end of namespace pfuclt_omni_dataset
+}
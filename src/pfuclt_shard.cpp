@@ -0,0 +1,565 @@
+#include <pfuclt_omni_dataset/pfuclt_shard.h>
+#include <pfuclt_omni_dataset/pfuclt_serialize.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Bytes read from a socket at once
+#define SHARD_RECEIVE_CHUNK 65536
+
+namespace pfuclt_omni_dataset
+{
+
+/**
+ * @brief serialize - a message as its magic number, the size of the rest, and
+ * the rest
+ */
+static void serialize(const ShardMessage& msg, std::vector<uint8_t>& out)
+{
+  out.clear();
+  put<uint32_t>(out, SHARD_MAGIC);
+  put<uint32_t>(out, 0);
+
+  put<uint32_t>(out, msg.stamp.sec);
+  put<uint32_t>(out, msg.stamp.nsec);
+  put<uint32_t>(out, msg.nParticles);
+  put<double>(out, msg.weightSum);
+
+  put<uint32_t>(out, msg.weightedSums.size());
+  for (uint i = 0; i < msg.weightedSums.size(); ++i)
+    put<double>(out, msg.weightedSums[i]);
+
+  uint32_t nSets = msg.particles.size();
+  uint32_t n = nSets > 0 ? msg.particles[0].size() : 0;
+  put<uint32_t>(out, nSets);
+  put<uint32_t>(out, n);
+
+  for (uint s = 0; s < nSets && n > 0; ++s)
+  {
+    const uint8_t* bytes = (const uint8_t*)&msg.particles[s][0];
+    out.insert(out.end(), bytes, bytes + n * sizeof(float));
+  }
+
+  uint32_t size = out.size() - 2 * sizeof(uint32_t);
+  memcpy(&out[sizeof(uint32_t)], &size, sizeof(size));
+}
+
+/**
+ * @brief deserialize - the part of a message after its size
+ * @return false if the message is malformed
+ */
+static bool deserialize(const uint8_t* in, const uint8_t* end,
+                        ShardMessage& msg)
+{
+  uint32_t sec, nsec, nSums;
+  if (!get(in, end, sec) || !get(in, end, nsec) ||
+      !get(in, end, msg.nParticles) || !get(in, end, msg.weightSum) ||
+      !get(in, end, nSums) || nSums > (size_t)(end - in) / sizeof(double))
+    return false;
+
+  msg.stamp = ros::Time(sec, nsec);
+  msg.weightedSums.resize(nSums);
+  for (uint i = 0; i < nSums; ++i)
+    get(in, end, msg.weightedSums[i]);
+
+  uint32_t nSets, n;
+  if (!get(in, end, nSets) || !get(in, end, n) ||
+      (nSets > 0 && n > (size_t)(end - in) / sizeof(float) / nSets))
+    return false;
+
+  msg.particles.assign(nSets, std::vector<float>(n));
+  for (uint s = 0; s < nSets && n > 0; ++s)
+  {
+    memcpy(&msg.particles[s][0], in, n * sizeof(float));
+    in += n * sizeof(float);
+  }
+
+  return in == end;
+}
+
+/**
+ * @brief configureSocket - send small messages right away, and don't block
+ * on a shard that stopped reading for longer than the timeout
+ */
+static void configureSocket(const int socket, const double timeout)
+{
+  int one = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  struct timeval tv;
+  tv.tv_sec = (long)timeout;
+  tv.tv_usec = (long)((timeout - tv.tv_sec) * 1e6);
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * @brief openSocket - create a socket for an address, either the path of a
+ * Unix socket or host:port for TCP, and listen on it or connect to it
+ * @return the socket, or -1
+ */
+static int openSocket(const std::string& address, const bool listening)
+{
+  size_t colon = address.rfind(':');
+
+  if (colon == std::string::npos)
+  {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (address.empty() || address.size() >= sizeof(addr.sun_path))
+      return -1;
+    strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+      return -1;
+
+    bool ok;
+    if (listening)
+    {
+      // The socket of a previous run would make bind fail
+      unlink(address.c_str());
+      ok = bind(s, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+           listen(s, SOMAXCONN) == 0;
+    }
+    else
+      ok = connect(s, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+
+    if (!ok)
+    {
+      close(s);
+      return -1;
+    }
+    return s;
+  }
+
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+
+  struct addrinfo hints, *result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+
+  if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints,
+                  &result) != 0)
+    return -1;
+
+  int s = -1;
+  for (struct addrinfo* ai = result; ai != NULL && s < 0; ai = ai->ai_next)
+  {
+    s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (s < 0)
+      continue;
+
+    bool ok;
+    if (listening)
+    {
+      int reuse = 1;
+      setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+      ok = bind(s, ai->ai_addr, ai->ai_addrlen) == 0 &&
+           listen(s, SOMAXCONN) == 0;
+    }
+    else
+      ok = connect(s, ai->ai_addr, ai->ai_addrlen) == 0;
+
+    if (!ok)
+    {
+      close(s);
+      s = -1;
+    }
+  }
+
+  freeaddrinfo(result);
+  return s;
+}
+
+ShardLink::ShardLink(const uint index, const uint count,
+                     const std::string& address, const double timeout,
+                     const uint maxImports)
+    : index_(index), count_(count), address_(address), timeout_(timeout),
+      maxImports_(maxImports), listener_(-1), shardsCombined_(0),
+      rng_(time(0))
+{
+  if (isCoordinator())
+  {
+    listener_ = openSocket(address_, true);
+    if (listener_ < 0)
+      ROS_ERROR("Shard 0: couldn't listen on \"%s\", the other shards can't "
+                "join",
+                address_.c_str());
+    else
+      ROS_INFO("Shard 0 of %d: waiting for the other shards on \"%s\"",
+               count_, address_.c_str());
+  }
+  else if (!connect())
+    ROS_WARN("Shard %d of %d: couldn't connect to the coordinator at \"%s\", "
+             "retrying every %.1fs",
+             index_, count_, address_.c_str(), SHARD_RECONNECT_PERIOD);
+}
+
+ShardLink::~ShardLink()
+{
+  for (uint c = 0; c < connections_.size(); ++c)
+    closeConnection(connections_[c]);
+
+  if (listener_ >= 0)
+  {
+    ::close(listener_);
+    if (address_.find(':') == std::string::npos)
+      unlink(address_.c_str());
+  }
+}
+
+bool ShardLink::connect()
+{
+  lastConnectAttempt_ = ros::WallTime::now();
+  connections_.clear();
+
+  int s = openSocket(address_, false);
+  if (s < 0)
+    return false;
+
+  configureSocket(s, timeout_);
+  connections_.push_back(Connection(s));
+  ROS_INFO("Shard %d of %d: connected to the coordinator at \"%s\"", index_,
+           count_, address_.c_str());
+  return true;
+}
+
+void ShardLink::acceptPending()
+{
+  if (listener_ < 0)
+    return;
+
+  while (true)
+  {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(listener_, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+
+    if (select(listener_ + 1, &fds, NULL, NULL, &timeout) <= 0)
+      return;
+
+    int s = accept(listener_, NULL, NULL);
+    if (s < 0)
+      return;
+
+    configureSocket(s, timeout_);
+    connections_.push_back(Connection(s));
+    ROS_INFO("Shard 0: a shard joined, %d of %d connected",
+             (int)connections_.size() + 1, count_);
+  }
+}
+
+bool ShardLink::send(Connection& connection, const ShardMessage& msg)
+{
+  std::vector<uint8_t> bytes;
+  serialize(msg, bytes);
+
+  size_t sent = 0;
+  while (sent < bytes.size())
+  {
+    ssize_t n = ::send(connection.socket, &bytes[sent], bytes.size() - sent,
+                       MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+    {
+      ROS_WARN("Shard %d: lost a connection while sending", index_);
+      closeConnection(connection);
+      return false;
+    }
+    sent += n;
+  }
+
+  return true;
+}
+
+bool ShardLink::receive(Connection& connection, const ros::WallTime& deadline,
+                        ShardMessage& msg)
+{
+  const size_t headerSize = 2 * sizeof(uint32_t);
+  std::vector<uint8_t>& received = connection.received;
+
+  while (connection.socket >= 0)
+  {
+    // A whole message may already have been received
+    if (received.size() >= headerSize)
+    {
+      uint32_t magic, size;
+      memcpy(&magic, &received[0], sizeof(magic));
+      memcpy(&size, &received[sizeof(magic)], sizeof(size));
+
+      if (magic != SHARD_MAGIC || size > SHARD_MAX_MESSAGE_BYTES)
+      {
+        ROS_ERROR("Shard %d: received a corrupt message, closing the "
+                  "connection",
+                  index_);
+        closeConnection(connection);
+        return false;
+      }
+
+      if (received.size() >= headerSize + size)
+      {
+        bool ok = deserialize(&received[headerSize],
+                              &received[headerSize] + size, msg);
+        received.erase(received.begin(),
+                       received.begin() + headerSize + size);
+
+        if (!ok)
+        {
+          ROS_ERROR("Shard %d: received a malformed message, closing the "
+                    "connection",
+                    index_);
+          closeConnection(connection);
+        }
+        return ok;
+      }
+    }
+
+    double remaining = (deadline - ros::WallTime::now()).toSec();
+    if (remaining <= 0)
+      return false;
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(connection.socket, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = (long)remaining;
+    timeout.tv_usec = (long)((remaining - timeout.tv_sec) * 1e6);
+
+    int ready = select(connection.socket + 1, &fds, NULL, NULL, &timeout);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready <= 0)
+      return false;
+
+    size_t old = received.size();
+    received.resize(old + SHARD_RECEIVE_CHUNK);
+    ssize_t n = recv(connection.socket, &received[old], SHARD_RECEIVE_CHUNK, 0);
+    received.resize(old + std::max<ssize_t>(n, 0));
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+    {
+      ROS_WARN("Shard %d: a connection was closed", index_);
+      closeConnection(connection);
+    }
+  }
+
+  return false;
+}
+
+bool ShardLink::receiveIteration(Connection& connection,
+                                 const ros::Time& stamp,
+                                 const ros::WallTime& deadline,
+                                 ShardMessage& msg)
+{
+  if (connection.hasPending)
+  {
+    // The other shard is ahead, its message waits for that iteration
+    if (connection.pending.stamp > stamp)
+      return false;
+
+    connection.hasPending = false;
+    if (connection.pending.stamp == stamp)
+    {
+      msg = connection.pending;
+      return true;
+    }
+  }
+
+  while (receive(connection, deadline, msg))
+  {
+    if (msg.stamp == stamp)
+      return true;
+
+    if (msg.stamp > stamp)
+    {
+      connection.pending = msg;
+      connection.hasPending = true;
+      return false;
+    }
+
+    // Older messages are from iterations this shard gave up on
+  }
+
+  return false;
+}
+
+void ShardLink::closeConnection(Connection& connection)
+{
+  if (connection.socket >= 0)
+    ::close(connection.socket);
+
+  connection.socket = -1;
+  connection.received.clear();
+  connection.hasPending = false;
+}
+
+bool ShardLink::exchange(const ShardMessage& local, ShardMessage& reply)
+{
+  const ros::WallTime deadline =
+      ros::WallTime::now() + ros::WallDuration(timeout_);
+  shardsCombined_ = 0;
+
+  if (!isCoordinator())
+  {
+    if (connections_.empty() || connections_[0].socket < 0)
+    {
+      if ((ros::WallTime::now() - lastConnectAttempt_).toSec() <
+              SHARD_RECONNECT_PERIOD ||
+          !connect())
+        return false;
+    }
+
+    Connection& coordinator = connections_[0];
+    return send(coordinator, local) &&
+           receiveIteration(coordinator, local.stamp, deadline, reply);
+  }
+
+  acceptPending();
+
+  // The shards that reported this iteration in time, this one first
+  std::vector<ShardMessage> received(connections_.size());
+  std::vector<const ShardMessage*> messages(1, &local);
+  std::vector<uint> senders;
+
+  for (uint c = 0; c < connections_.size(); ++c)
+  {
+    if (!receiveIteration(connections_[c], local.stamp, deadline,
+                          received[c]))
+      continue;
+
+    // Shards configured with other robots or targets can't be combined
+    if (received[c].weightedSums.size() != local.weightedSums.size() ||
+        received[c].particles.size() != local.particles.size())
+    {
+      ROS_WARN("Shard 0: ignoring a shard with a different configuration");
+      continue;
+    }
+
+    messages.push_back(&received[c]);
+    senders.push_back(c);
+  }
+
+  std::vector<ShardMessage> replies;
+  combine(messages, maxImports_, rng_, replies);
+
+  for (uint i = 0; i < senders.size(); ++i)
+    send(connections_[senders[i]], replies[i + 1]);
+
+  reply = replies[0];
+  shardsCombined_ = messages.size();
+
+  // Closed connections are dropped, their shards may connect again
+  std::vector<Connection> open;
+  for (uint c = 0; c < connections_.size(); ++c)
+  {
+    if (connections_[c].socket >= 0)
+      open.push_back(connections_[c]);
+  }
+  connections_.swap(open);
+
+  return messages.size() > 1;
+}
+
+void ShardLink::combine(const std::vector<const ShardMessage*>& messages,
+                        const uint maxImports, RNGType& rng,
+                        std::vector<ShardMessage>& replies)
+{
+  const uint nShards = messages.size();
+  replies.assign(nShards, ShardMessage());
+  if (nShards == 0)
+    return;
+
+  // Sums over every shard
+  ShardMessage total;
+  total.stamp = messages[0]->stamp;
+  total.weightedSums.assign(messages[0]->weightedSums.size(), 0.0);
+
+  for (uint k = 0; k < nShards; ++k)
+  {
+    total.nParticles += messages[k]->nParticles;
+    total.weightSum += messages[k]->weightSum;
+    for (uint i = 0; i < total.weightedSums.size(); ++i)
+      total.weightedSums[i] += messages[k]->weightedSums[i];
+  }
+
+  const uint nSets = messages[0]->particles.size();
+
+  for (uint k = 0; k < nShards; ++k)
+  {
+    replies[k] = total;
+    replies[k].particles.assign(nSets, std::vector<float>());
+
+    if (nSets == 0 || total.weightSum <= 0)
+      continue;
+
+    // The particles a shard has beyond its share of the weight are the ones
+    // worth replacing
+    double share = total.nParticles * messages[k]->weightSum / total.weightSum;
+    double surplus = messages[k]->nParticles - share;
+    uint nImports = surplus >= 1.0 ? std::min((uint)surplus, maxImports) : 0;
+    if (nImports == 0)
+      continue;
+
+    // The other shards' particles, drawn according to their weights
+    std::vector<double> cumulative;
+    std::vector<std::pair<uint, uint> > sources;
+    double sum = 0.0;
+
+    for (uint j = 0; j < nShards; ++j)
+    {
+      if (j == k)
+        continue;
+
+      const std::vector<float>& weights = messages[j]->particles.back();
+      for (uint p = 0; p < weights.size(); ++p)
+      {
+        sum += weights[p];
+        cumulative.push_back(sum);
+        sources.push_back(std::make_pair(j, p));
+      }
+    }
+
+    if (sum <= 0)
+      continue;
+
+    boost::random::uniform_real_distribution<> dist(0, sum);
+    for (uint s = 0; s < nSets; ++s)
+      replies[k].particles[s].resize(nImports);
+
+    for (uint i = 0; i < nImports; ++i)
+    {
+      uint m = std::lower_bound(cumulative.begin(), cumulative.end(),
+                                dist(rng)) -
+               cumulative.begin();
+      m = std::min(m, (uint)cumulative.size() - 1);
+
+      const ShardMessage& source = *messages[sources[m].first];
+      for (uint s = 0; s < nSets; ++s)
+        replies[k].particles[s][i] = source.particles[s][sources[m].second];
+    }
+  }
+}
+
+// end of namespace pfuclt_omni_dataset
+}
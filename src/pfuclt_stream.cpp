@@ -0,0 +1,357 @@
+#include <pfuclt_omni_dataset/pfuclt_stream.h>
+#include <ros/ros.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <zlib.h>
+
+namespace pfuclt_omni_dataset
+{
+
+// Signed values are zigzag-coded, so that small magnitudes take few bytes
+static inline uint64_t zigzag(const int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(const uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint varintSize(uint64_t v)
+{
+  uint size = 1;
+  while (v >= 0x80)
+  {
+    v >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+static inline void putVarint(uint64_t v, std::vector<uint8_t>& out)
+{
+  while (v >= 0x80)
+  {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+static inline bool getVarint(const std::vector<uint8_t>& in, size_t& pos,
+                             uint64_t& v)
+{
+  v = 0;
+  for (uint shift = 0; shift < 64 && pos < in.size(); shift += 7)
+  {
+    uint8_t byte = in[pos++];
+    v |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static inline int32_t quantize(const float value, const float step)
+{
+  double q = std::floor(value / step + 0.5);
+  q = std::max(q, (double)std::numeric_limits<int32_t>::min());
+  q = std::min(q, (double)std::numeric_limits<int32_t>::max());
+  return (int32_t)q;
+}
+
+// Reference codes of a block - the previous particle of this frame, the
+// particle of the previous frame used by the last block, or any other particle
+// of the previous frame, its offset coded from REF_OFFSET on
+#define REF_INTRA 0
+#define REF_LAST 1
+#define REF_OFFSET 2
+
+/**
+ * @brief prediction - the value a set of a particle is coded against
+ * @param ref - index of the reference particle in the previous frame, or -1
+ * for the previous particle of this frame
+ */
+static inline int64_t
+prediction(const std::vector<std::vector<int32_t> >& current,
+           const std::vector<std::vector<int32_t> >& previous, const uint s,
+           const uint p, const int ref)
+{
+  if (ref < 0)
+    return p > 0 ? current[s][p - 1] : 0;
+
+  return previous[s][ref];
+}
+
+ParticleStreamEncoder::ParticleStreamEncoder(const std::vector<uint>& blockSizes,
+                                             const std::vector<float>& steps,
+                                             const uint keyframePeriod,
+                                             const int level)
+    : blockSizes_(blockSizes), steps_(steps),
+      keyframePeriod_(std::max(keyframePeriod, 1u)),
+      framesSinceKeyframe_(keyframePeriod_), level_(level), sequence_(0)
+{
+}
+
+void ParticleStreamEncoder::encode(const stream_particles_t& particles,
+                                   const uint stride,
+                                   compressed_particles& msg)
+{
+  const uint nSets = steps_.size();
+  if (nSets == 0 || particles.size() != nSets)
+  {
+    ROS_ERROR("Particle stream expects %d subparticle sets, got %d", nSets,
+              (int)particles.size());
+    return;
+  }
+
+  const uint nParticles = (particles[0].size() + stride - 1) / stride;
+  const bool keyframe = framesSinceKeyframe_ >= keyframePeriod_ ||
+                        previous_.size() != nSets ||
+                        previous_[0].size() != nParticles;
+
+  msg.sequence = sequence_;
+  msg.keyframe = keyframe;
+  msg.particles = nParticles;
+  msg.block_sizes.assign(blockSizes_.begin(), blockSizes_.end());
+  msg.steps.resize(nSets);
+
+  // Quantize
+  current_.resize(nSets);
+  for (uint s = 0; s < nSets; ++s)
+  {
+    float step = steps_[s];
+    if (step <= 0)
+    {
+      float max = 0;
+      for (uint p = 0; p < nParticles; ++p)
+        max = std::max(max, std::fabs(particles[s][p * stride]));
+      step = max > 0 ? max / STREAM_RELATIVE_LEVELS : 1.0f;
+    }
+
+    msg.steps[s] = step;
+    current_[s].resize(nParticles);
+    for (uint p = 0; p < nParticles; ++p)
+      current_[s][p] = quantize(particles[s][p * stride], step);
+  }
+
+  std::vector<uint8_t> raw;
+  raw.reserve(nParticles * (blockSizes_.size() + nSets) * 2);
+
+  // Robot blocks often share the ancestor, so the last reference is tried
+  // first, starting with the same particle
+  std::vector<int> refs(nParticles, -1);
+  std::vector<int> lastRefs(nParticles);
+  for (uint p = 0; p < nParticles; ++p)
+    lastRefs[p] = p;
+
+  std::vector<uint64_t> codes(nParticles, REF_INTRA);
+  std::vector<std::pair<int32_t, uint> > sorted;
+
+  for (uint b = 0, first = 0; b < blockSizes_.size(); first += blockSizes_[b++])
+  {
+    const uint last = first + blockSizes_[b];
+
+    if (!keyframe)
+    {
+      // Previous particles by their first state, to find similar ones
+      sorted.resize(nParticles);
+      for (uint p = 0; p < nParticles; ++p)
+        sorted[p] = std::make_pair(previous_[first][p], p);
+      std::sort(sorted.begin(), sorted.end());
+
+      // Particles moved together since the previous frame, by the median
+      // change of the first state, so the search is centered on their origin
+      std::vector<int64_t> shifts(nParticles);
+      for (uint p = 0; p < nParticles; ++p)
+        shifts[p] = (int64_t)current_[first][p] - previous_[first][p];
+      std::nth_element(shifts.begin(), shifts.begin() + nParticles / 2,
+                       shifts.end());
+      const int64_t shift = shifts[nParticles / 2];
+
+      for (uint p = 0; p < nParticles; ++p)
+      {
+        refs[p] = -1;
+        codes[p] = REF_INTRA;
+
+        uint bestCost = 0;
+        for (uint s = first; s < last; ++s)
+          bestCost += varintSize(zigzag(
+              current_[s][p] - prediction(current_, previous_, s, p, -1)));
+
+        // The last reference, then the previous particles closest to this one
+        int32_t origin = (int32_t)std::max<int64_t>(
+            std::min<int64_t>(current_[first][p] - shift,
+                              std::numeric_limits<int32_t>::max()),
+            std::numeric_limits<int32_t>::min());
+        int closest = std::lower_bound(sorted.begin(), sorted.end(),
+                                       std::make_pair(origin, 0u)) -
+                      sorted.begin();
+        int from = std::max(closest - STREAM_SEARCH_WINDOW, 0);
+        int to = std::min(closest + STREAM_SEARCH_WINDOW, (int)nParticles);
+
+        for (int c = from - 1; c < to; ++c)
+        {
+          int k = c < from ? lastRefs[p] : sorted[c].second;
+          uint64_t code = k == lastRefs[p] ? REF_LAST
+                                           : zigzag(k - (int)p) + REF_OFFSET;
+
+          uint cost = varintSize(code);
+          for (uint s = first; s < last && cost < bestCost; ++s)
+            cost += varintSize(zigzag(current_[s][p] - previous_[s][k]));
+
+          if (cost < bestCost)
+          {
+            bestCost = cost;
+            refs[p] = k;
+            codes[p] = code;
+          }
+        }
+
+        if (refs[p] >= 0)
+          lastRefs[p] = refs[p];
+      }
+    }
+
+    for (uint p = 0; p < nParticles; ++p)
+      putVarint(codes[p], raw);
+
+    for (uint s = first; s < last; ++s)
+      for (uint p = 0; p < nParticles; ++p)
+        putVarint(zigzag(current_[s][p] -
+                         prediction(current_, previous_, s, p, refs[p])),
+                  raw);
+  }
+
+  // Entropy coding
+  uLongf size = compressBound(raw.size());
+  msg.data.resize(size);
+  compress2(&msg.data[0], &size, raw.empty() ? NULL : &raw[0], raw.size(),
+            level_);
+  msg.data.resize(size);
+  msg.raw_size = raw.size();
+
+  previous_.swap(current_);
+  framesSinceKeyframe_ = keyframe ? 1 : framesSinceKeyframe_ + 1;
+  ++sequence_;
+}
+
+ParticleStreamDecoder::ParticleStreamDecoder() : valid_(false), sequence_(0)
+{
+}
+
+bool ParticleStreamDecoder::decode(const compressed_particles& msg,
+                                   stream_particles_t& particles)
+{
+  const uint nSets = msg.steps.size();
+  const uint nParticles = msg.particles;
+
+  uint setsInBlocks = 0;
+  for (uint b = 0; b < msg.block_sizes.size(); ++b)
+    setsInBlocks += msg.block_sizes[b];
+
+  if (nSets == 0 || setsInBlocks != nSets)
+  {
+    ROS_ERROR("Particle stream frame %d has blocks of %d sets for %d sets",
+              msg.sequence, setsInBlocks, nSets);
+    valid_ = false;
+    return false;
+  }
+
+  if (!msg.keyframe &&
+      (!valid_ || msg.sequence != sequence_ + 1 ||
+       previous_.size() != nSets || previous_[0].size() != nParticles))
+  {
+    ROS_WARN("Particle stream frame %d doesn't follow the last decoded frame, "
+             "waiting for a keyframe",
+             msg.sequence);
+    valid_ = false;
+    return false;
+  }
+
+  std::vector<uint8_t> raw(msg.raw_size);
+  uLongf size = raw.size();
+  if (uncompress(raw.empty() ? NULL : &raw[0], &size,
+                 msg.data.empty() ? NULL : &msg.data[0],
+                 msg.data.size()) != Z_OK ||
+      size != raw.size())
+  {
+    ROS_ERROR("Particle stream frame %d couldn't be decompressed",
+              msg.sequence);
+    valid_ = false;
+    return false;
+  }
+
+  current_.assign(nSets, std::vector<int32_t>(nParticles));
+  std::vector<int> refs(nParticles);
+  std::vector<int> lastRefs(nParticles);
+  for (uint p = 0; p < nParticles; ++p)
+    lastRefs[p] = p;
+
+  size_t pos = 0;
+  bool malformed = false;
+
+  for (uint b = 0, first = 0; b < msg.block_sizes.size() && !malformed;
+       first += msg.block_sizes[b++])
+  {
+    const uint last = first + msg.block_sizes[b];
+
+    for (uint p = 0; p < nParticles && !malformed; ++p)
+    {
+      uint64_t code;
+      malformed = !getVarint(raw, pos, code);
+
+      if (code == REF_INTRA)
+        refs[p] = -1;
+      else if (code == REF_LAST)
+        refs[p] = lastRefs[p];
+      else
+        refs[p] = p + unzigzag(code - REF_OFFSET);
+
+      // The reference must be a particle of the previous frame
+      if (refs[p] >= 0)
+      {
+        malformed |= msg.keyframe || refs[p] >= (int)nParticles;
+        lastRefs[p] = refs[p];
+      }
+      else
+        malformed |= code != REF_INTRA;
+    }
+
+    for (uint s = first; s < last && !malformed; ++s)
+    {
+      for (uint p = 0; p < nParticles && !malformed; ++p)
+      {
+        uint64_t v;
+        malformed = !getVarint(raw, pos, v);
+        current_[s][p] = (int32_t)(
+            prediction(current_, previous_, s, p, refs[p]) + unzigzag(v));
+      }
+    }
+  }
+
+  if (malformed)
+  {
+    ROS_ERROR("Particle stream frame %d is malformed", msg.sequence);
+    valid_ = false;
+    return false;
+  }
+
+  particles.resize(nSets);
+  for (uint s = 0; s < nSets; ++s)
+  {
+    particles[s].resize(nParticles);
+    for (uint p = 0; p < nParticles; ++p)
+      particles[s][p] = current_[s][p] * msg.steps[s];
+  }
+
+  previous_.swap(current_);
+  sequence_ = msg.sequence;
+  valid_ = true;
+  return true;
+}
+
+// end of namespace pfuclt_omni_dataset
+}
@@ -0,0 +1,169 @@
+// Compression ratio and encoding time of the particle stream, on particles
+// moved, weighted and resampled the way the filter does it
+
+#include <pfuclt_omni_dataset/pfuclt_stream.h>
+#include <boost/random.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+
+#define BENCHMARK_ROBOTS 5
+#define BENCHMARK_STATES_PER_ROBOT 3
+#define BENCHMARK_STATES_PER_TARGET 3
+
+// Standard deviations of the simulated motion and resampling jitter
+#define BENCHMARK_ROBOT_MOTION 0.02
+#define BENCHMARK_ROBOT_NOISE 0.005
+#define BENCHMARK_TARGET_NOISE 0.05
+#define BENCHMARK_JITTER 0.002
+
+using namespace pfuclt_omni_dataset;
+
+typedef boost::random::mt19937 RNGType;
+
+static uint drawAncestor(const std::vector<double>& cumulative, const double u)
+{
+  uint m = std::lower_bound(cumulative.begin(), cumulative.end(), u) -
+           cumulative.begin();
+  return std::min(m, (uint)cumulative.size() - 1);
+}
+
+/**
+ * @brief simulate - one iteration of a filter tracking robots standing still
+ * or moving slowly, with a percentage of the particles kept as they are
+ */
+static void simulate(stream_particles_t& particles, RNGType& rng)
+{
+  const uint nParticles = particles[0].size();
+  const uint oWeight = particles.size() - 1;
+  boost::random::normal_distribution<> normal(0.0, 1.0);
+
+  // Predict
+  for (uint s = 0; s < oWeight; ++s)
+  {
+    bool target = s >= BENCHMARK_ROBOTS * BENCHMARK_STATES_PER_ROBOT;
+    double motion = target ? 0 : BENCHMARK_ROBOT_MOTION * normal(rng);
+    double noise = target ? BENCHMARK_TARGET_NOISE : BENCHMARK_ROBOT_NOISE;
+
+    for (uint p = 0; p < nParticles; ++p)
+      particles[s][p] += motion + noise * normal(rng);
+  }
+
+  // Weight by the distance of the first robot to the origin
+  std::vector<double> cumulative(nParticles);
+  double sum = 0;
+  for (uint p = 0; p < nParticles; ++p)
+  {
+    double d2 = particles[0][p] * particles[0][p] +
+                particles[1][p] * particles[1][p];
+    particles[oWeight][p] = exp(-d2);
+    sum += particles[oWeight][p];
+    cumulative[p] = sum;
+  }
+
+  // As the filter's resampler, the robots are resampled from the second half
+  // on, as with percentage_to_keep at 50, and the target for every particle
+  const uint oTarget = BENCHMARK_ROBOTS * BENCHMARK_STATES_PER_ROBOT;
+  stream_particles_t duplicate(particles);
+  boost::random::uniform_real_distribution<> dist(0, sum);
+
+  for (uint p = 0; p < nParticles; ++p)
+  {
+    if (p >= nParticles / 2)
+    {
+      uint m = drawAncestor(cumulative, dist(rng));
+      for (uint s = 0; s < oTarget; ++s)
+        particles[s][p] = duplicate[s][m] + BENCHMARK_JITTER * normal(rng);
+    }
+
+    uint m = drawAncestor(cumulative, dist(rng));
+    for (uint s = oTarget; s < oWeight; ++s)
+      particles[s][p] = duplicate[s][m] + BENCHMARK_JITTER * normal(rng);
+    particles[oWeight][p] = duplicate[oWeight][m];
+  }
+
+  for (uint p = 0; p < nParticles; ++p)
+    particles[oWeight][p] /= sum;
+}
+
+static void run(const uint nParticles, const uint nFrames,
+                const uint keyframePeriod, const float step, const int level)
+{
+  const uint nRobotStates = BENCHMARK_ROBOTS * BENCHMARK_STATES_PER_ROBOT;
+  const uint nSets = nRobotStates + BENCHMARK_STATES_PER_TARGET + 1;
+
+  std::vector<uint> blockSizes(BENCHMARK_ROBOTS, BENCHMARK_STATES_PER_ROBOT);
+  blockSizes.push_back(BENCHMARK_STATES_PER_TARGET);
+  blockSizes.push_back(1);
+
+  std::vector<float> steps(nSets, step);
+  steps.back() = 0;
+
+  RNGType rng(42);
+  boost::random::uniform_real_distribution<> uniform(-1.0, 1.0);
+  stream_particles_t particles(nSets, std::vector<float>(nParticles));
+  for (uint s = 0; s < nSets - 1; ++s)
+    for (uint p = 0; p < nParticles; ++p)
+      particles[s][p] = uniform(rng);
+
+  ParticleStreamEncoder encoder(blockSizes, steps, keyframePeriod, level);
+  ParticleStreamDecoder decoder;
+  compressed_particles msg;
+  stream_particles_t decoded;
+
+  double encodeTime = 0, decodeTime = 0, maxError = 0;
+  size_t rawBytes = 0, compressedBytes = 0;
+
+  for (uint f = 0; f < nFrames; ++f)
+  {
+    simulate(particles, rng);
+
+    ros::WallTime start = ros::WallTime::now();
+    encoder.encode(particles, 1, msg);
+    ros::WallTime encoded = ros::WallTime::now();
+    if (!decoder.decode(msg, decoded))
+    {
+      printf("Frame %d couldn't be decoded\n", f);
+      return;
+    }
+    ros::WallTime end = ros::WallTime::now();
+
+    encodeTime += (encoded - start).toSec();
+    decodeTime += (end - encoded).toSec();
+
+    // As in pfuclt_omni_dataset/particles, float32 values
+    rawBytes += nSets * nParticles * sizeof(float);
+    compressedBytes += msg.data.size();
+
+    for (uint s = 0; s < nSets - 1; ++s)
+      for (uint p = 0; p < nParticles; ++p)
+        maxError = std::max(maxError,
+                            (double)fabs(decoded[s][p] - particles[s][p]));
+  }
+
+  printf("%9d %9d %8.4f %5d %10.1f %10.3f %10.3f %10.5f\n", nParticles,
+         keyframePeriod, step, level, (double)rawBytes / compressedBytes,
+         1e3 * encodeTime / nFrames, 1e3 * decodeTime / nFrames, maxError);
+}
+
+int main(int argc, char* argv[])
+{
+  uint nParticles = argc > 1 ? boost::lexical_cast<uint>(argv[1]) : 1000;
+  uint nFrames = argc > 2 ? boost::lexical_cast<uint>(argv[2]) : 200;
+
+  ros::Time::init();
+
+  printf("Usage: pfuclt_stream_benchmark [particles] [frames]\n");
+  printf("%9s %9s %8s %5s %10s %10s %10s %10s\n", "particles", "keyframes",
+         "step", "zlib", "ratio", "encode ms", "decode ms", "max error");
+
+  const uint keyframePeriods[] = { 1, 10, 100 };
+  const float steps[] = { 0.01f, 0.001f, 0.0001f };
+  const int levels[] = { 1, 6 };
+
+  for (uint k = 0; k < 3; ++k)
+    for (uint s = 0; s < 3; ++s)
+      for (uint l = 0; l < 2; ++l)
+        run(nParticles, nFrames, keyframePeriods[k], steps[s], levels[l]);
+
+  return EXIT_SUCCESS;
+}
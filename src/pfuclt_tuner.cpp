@@ -0,0 +1,239 @@
+#include <pfuclt_omni_dataset/pfuclt_tuner.h>
+#include <minicsv/minicsv.h>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Chunk sizes tried for each thread count, besides the plain static schedule
+#define TUNER_BLOCK_SIZES                                                      \
+  {                                                                            \
+    16, 64, 256                                                                \
+  }
+
+namespace pfuclt_omni_dataset
+{
+
+KernelTuner::KernelTuner(bool enabled, uint samples, uint retunePeriod,
+                         const std::string& exportFile)
+    : enabled_(enabled), samples_(samples > 0 ? samples : 1),
+      retunePeriod_(retunePeriod), nParticles_(0), maxThreads_(1),
+      exportFile_(exportFile), kernels_(NUM_KERNELS)
+{
+#ifdef _OPENMP
+  maxThreads_ = (uint)omp_get_max_threads();
+#endif
+}
+
+const char* KernelTuner::kernelName(const Kernel k)
+{
+  switch (k)
+  {
+  case FUSE_ROBOTS:
+    return "fuseRobots";
+  case FUSE_TARGET:
+    return "fuseTarget";
+  default:
+    return "unknown";
+  }
+}
+
+void KernelTuner::reset(const uint nParticles)
+{
+  nParticles_ = nParticles;
+
+  // Default is the previous behavior - every thread with a static schedule
+  defaultConfig_ = KernelConfig(
+      maxThreads_, std::max(1u, (nParticles + maxThreads_ - 1) / maxThreads_));
+
+  // Serial, and then 2, 4, ... threads up to the maximum available
+  std::vector<KernelConfig> candidates(1, KernelConfig(1, nParticles));
+  for (uint t = 2; t < 2 * maxThreads_; t *= 2)
+  {
+    uint nThreads = std::min(t, maxThreads_);
+    uint staticChunk = std::max(1u, (nParticles + nThreads - 1) / nThreads);
+    candidates.push_back(KernelConfig(nThreads, staticChunk));
+
+    const uint blockSizes[] = TUNER_BLOCK_SIZES;
+    for (uint b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); ++b)
+    {
+      if (blockSizes[b] < staticChunk)
+        candidates.push_back(KernelConfig(nThreads, blockSizes[b]));
+    }
+
+    if (nThreads == maxThreads_)
+      break;
+  }
+
+  for (uint k = 0; k < NUM_KERNELS; ++k)
+  {
+    kernels_[k].candidates = candidates;
+    restart(kernels_[k]);
+  }
+
+  if (enabled_)
+    ROS_INFO("Autotuner: timing %d variants per kernel for %d particles",
+             (int)candidates.size(), nParticles);
+}
+
+void KernelTuner::restart(KernelState& ks)
+{
+  ks.timeSums.assign(ks.candidates.size(), 0.0);
+  ks.counts.assign(ks.candidates.size(), 0);
+  ks.current = 0;
+  ks.chosen = 0;
+  ks.iterationsSinceTuned = 0;
+  ks.tuning = enabled_ && ks.candidates.size() > 1;
+}
+
+const KernelConfig& KernelTuner::begin(const Kernel k)
+{
+  KernelState& ks = kernels_[k];
+
+  if (!enabled_)
+    return defaultConfig_;
+
+  ks.start = ros::WallTime::now();
+
+  if (ks.tuning)
+    return ks.candidates[ks.current];
+  else
+    return ks.candidates[ks.chosen];
+}
+
+const KernelConfig& KernelTuner::config(const Kernel k) const
+{
+  const KernelState& ks = kernels_[k];
+
+  if (!enabled_)
+    return defaultConfig_;
+
+  return ks.tuning ? ks.candidates[ks.current] : ks.candidates[ks.chosen];
+}
+
+void KernelTuner::end(const Kernel k)
+{
+  if (!enabled_)
+    return;
+
+  KernelState& ks = kernels_[k];
+
+  if (!ks.tuning)
+  {
+    // Online re-tuning, since the cost also depends on what is being observed
+    if (retunePeriod_ > 0 && ++ks.iterationsSinceTuned >= retunePeriod_)
+      restart(ks);
+
+    return;
+  }
+
+  ks.timeSums[ks.current] += (ros::WallTime::now() - ks.start).toNSec() * 1e-9;
+  ++ks.counts[ks.current];
+
+  // Round-robin over the variants so that they all see similar conditions
+  ks.current = (ks.current + 1) % ks.candidates.size();
+
+  if (ks.current == 0 && ks.counts.back() >= samples_)
+    choose(k);
+}
+
+void KernelTuner::choose(const Kernel k)
+{
+  KernelState& ks = kernels_[k];
+
+  uint best = 0;
+  for (uint c = 1; c < ks.candidates.size(); ++c)
+  {
+    if (ks.timeSums[c] / ks.counts[c] < ks.timeSums[best] / ks.counts[best])
+      best = c;
+  }
+
+  ks.chosen = best;
+  ks.tuning = false;
+  ks.iterationsSinceTuned = 0;
+
+  ROS_INFO("Autotuner: %s with %d particles will use %d thread(s), chunk "
+           "size %d (%fms)",
+           kernelName(k), nParticles_, ks.candidates[best].nThreads,
+           ks.candidates[best].chunkSize,
+           1e3 * ks.timeSums[best] / ks.counts[best]);
+
+  if (!isTuning())
+  {
+    logConfiguration();
+
+    if (!exportFile_.empty())
+      exportCSV(exportFile_);
+  }
+}
+
+bool KernelTuner::isTuning() const
+{
+  for (uint k = 0; k < NUM_KERNELS; ++k)
+  {
+    if (kernels_[k].tuning)
+      return true;
+  }
+  return false;
+}
+
+void KernelTuner::logConfiguration() const
+{
+  std::ostringstream oss;
+  oss << "Autotuner configuration for " << nParticles_ << " particles:";
+
+  for (uint k = 0; k < NUM_KERNELS; ++k)
+  {
+    const KernelConfig& cfg =
+        enabled_ ? kernels_[k].candidates[kernels_[k].chosen] : defaultConfig_;
+    oss << " " << kernelName((Kernel)k) << "={threads=" << cfg.nThreads
+        << ", chunk=" << cfg.chunkSize << "}";
+  }
+
+  ROS_INFO("%s", oss.str().c_str());
+}
+
+bool KernelTuner::exportCSV(const std::string& filename) const
+{
+  mini::csv::ofstream os(filename.c_str());
+
+  if (!os.is_open())
+  {
+    ROS_ERROR("Autotuner: couldn't open file \"%s\"", filename.c_str());
+    return false;
+  }
+
+  // Mean times to the microsecond
+  os.enable_buffered_writes(true);
+  os.set_fixed_precision(3);
+
+  os << "kernel"
+     << "particles"
+     << "threads"
+     << "chunk"
+     << "samples"
+     << "mean_ms"
+     << "chosen" << NEWLINE;
+
+  for (uint k = 0; k < NUM_KERNELS; ++k)
+  {
+    const KernelState& ks = kernels_[k];
+
+    for (uint c = 0; c < ks.candidates.size(); ++c)
+    {
+      double mean = ks.counts[c] > 0 ? 1e3 * ks.timeSums[c] / ks.counts[c] : 0;
+
+      os << kernelName((Kernel)k) << nParticles_ << ks.candidates[c].nThreads
+         << ks.candidates[c].chunkSize << ks.counts[c] << mean
+         << (c == ks.chosen ? 1 : 0) << NEWLINE;
+    }
+  }
+
+  os.close();
+  ROS_INFO("Autotuner: results exported to %s", filename.c_str());
+  return true;
+}
+
+// end of namespace pfuclt_omni_dataset
+}